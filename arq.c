@@ -0,0 +1,373 @@
+#define	_DEFAULT_SOURCE
+#include <stdlib.h>
+#include <err.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/uio.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "frame.h"
+#include "arq.h"
+
+/*
+ * Send frame with header hdr and len bytes of payload to addr by socket fd.
+ *
+ * Returns result of sendmsg.
+ */
+static ssize_t arq_send(int fd, struct sockaddr * addr, socklen_t addrlen,
+	char * hdr, char * payload, size_t len) {
+
+	struct iovec iov[2];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof (msg));
+	msg.msg_name = addr;
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = FRAME_HEADER_SIZE;
+	iov[1].iov_base = payload;
+	iov[1].iov_len = len;
+	return (sendmsg(fd, &msg, 0));
+}
+
+/*
+ * Initialize sending side of ARQ of output cfg.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int arq_tx_init(struct arq_tx * tx, struct endpt_cfg * cfg) {
+	tx->cfg = cfg;
+	tx->fd = -1;
+	tx->first = 0;
+	tx->n = 0;
+	tx->running = 0;
+	tx->stop = 0;
+	tx->max = cfg->buf->nitems/2;
+	tx->sent = malloc(sizeof (uint64_t)*tx->max);
+	if (tx->sent == NULL)
+		return (-1);
+	pthread_mutex_init(&tx->lock, NULL);
+	return (0);
+}
+
+/* Release n oldest held chunks, called with the lock held */
+static void arq_tx_release(struct arq_tx * tx, size_t n) {
+	buffer_release(tx->cfg->buf, n);
+	tx->first = (tx->first+n)%tx->max;
+	tx->n -= n;
+}
+
+/* Send frame seq again if its chunk is held, called with the lock held */
+static void arq_tx_resend(struct arq_tx * tx, uint64_t seq) {
+	struct chunk_meta meta;
+	char hdr[FRAME_HEADER_SIZE];
+	char * data;
+	ssize_t len;
+	len = buffer_held_find(tx->cfg->buf, seq, &data, &meta);
+	if (len <= 0) {
+		tx->cfg->arq_missed++;
+		return;
+	}
+	frame_header(hdr, FRAME_DATA, &meta, data, len);
+	if (arq_send(tx->fd, (struct sockaddr *)&tx->addr, tx->addrlen, hdr,
+		data, len) == -1) {
+
+		warn("Error in sending data again\n");
+		return;
+	}
+	tx->cfg->arq_resent++;
+}
+
+/* Thread receiving NACKs of an output and sending requested frames again */
+static void * arq_tx_thread(void * args) {
+	struct arq_tx * tx;
+	char nack[FRAME_HEADER_SIZE+8*ARQ_NACK_MAX];
+	tx = (struct arq_tx *)args;
+	while (!__atomic_load_n(&tx->stop, __ATOMIC_ACQUIRE)) {
+		struct pollfd pfd;
+		ssize_t n;
+		ssize_t npayload;
+		pfd.fd = tx->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, ARQ_TICK) <= 0)
+			continue;
+		n = recv(tx->fd, nack, sizeof (nack), MSG_DONTWAIT);
+		if (n <= 0)
+			continue;
+		npayload = frame_check(nack, n);
+		if (npayload < 0 || nack[3] != FRAME_NACK || npayload%8 != 0)
+			continue;
+		tx->cfg->arq_nacks++;
+		pthread_mutex_lock(&tx->lock);
+		for (ssize_t i = 0; i < npayload; i += 8) {
+			uint64_t seq;
+			memcpy(&seq, nack+FRAME_HEADER_SIZE+i, 8);
+			arq_tx_resend(tx, be64toh(seq));
+		}
+		pthread_mutex_unlock(&tx->lock);
+	}
+	return (NULL);
+}
+
+/*
+ * Start serving NACKs of frames sent by socket fd to addr.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int arq_tx_start(struct arq_tx * tx, int fd, struct sockaddr * addr,
+	socklen_t addrlen) {
+
+	tx->fd = fd;
+	memcpy(&tx->addr, addr, addrlen);
+	tx->addrlen = addrlen;
+	tx->stop = 0;
+	if (pthread_create(&tx->thread, NULL, arq_tx_thread, (void *)tx))
+		return (-1);
+	tx->running = 1;
+	return (0);
+}
+
+/*
+ * Keep the chunk at consumer position of the buffer of the output, it is
+ * going to be sent. Chunks sent longer than the window ago are released, and
+ * the oldest ones when a half of the ring is held. When the ring is going to
+ * be resized, all chunks are released, so that it can move.
+ */
+void arq_tx_keep(struct arq_tx * tx) {
+	struct buffer * buf;
+	uint64_t now;
+	buf = tx->cfg->buf;
+	now = now_ns();
+	pthread_mutex_lock(&tx->lock);
+	if (buffer_resizing(buf)) {
+		arq_tx_release(tx, tx->n);
+		pthread_mutex_unlock(&tx->lock);
+		return;
+	}
+	// The ring was resized, nothing is held
+	if (tx->n == 0 && buf->nitems/2 != tx->max) {
+		uint64_t * sent;
+		sent = realloc(tx->sent, sizeof (uint64_t)*(buf->nitems/2));
+		if (sent != NULL) {
+			tx->sent = sent;
+			tx->max = buf->nitems/2;
+			tx->first = 0;
+		}
+	}
+	while (tx->n > 0 && (tx->n >= tx->max ||
+		now-tx->sent[tx->first] > tx->cfg->arq*1000000ULL))
+		arq_tx_release(tx, 1);
+	if (buffer_hold(buf) == 0) {
+		tx->sent[(tx->first+tx->n)%tx->max] = now;
+		tx->n++;
+	}
+	pthread_mutex_unlock(&tx->lock);
+}
+
+/*
+ * Stop serving NACKs and release all held chunks. With linger, NACKs are
+ * served for the window first, so that the last frames can still be sent
+ * again.
+ */
+void arq_tx_stop(struct arq_tx * tx, int linger) {
+	if (!tx->running)
+		return;
+	if (linger) {
+		struct timespec ts;
+		ts.tv_sec = tx->cfg->arq/1000;
+		ts.tv_nsec = (tx->cfg->arq%1000)*1000000L;
+		nanosleep(&ts, NULL);
+	}
+	__atomic_store_n(&tx->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(tx->thread, NULL);
+	tx->running = 0;
+	pthread_mutex_lock(&tx->lock);
+	arq_tx_release(tx, tx->n);
+	pthread_mutex_unlock(&tx->lock);
+}
+
+/*
+ * Create receiving side of ARQ of input id, which counts frames in st,
+ * receives frames up to max_frame bytes and waits for a missing frame for
+ * budget ms.
+ *
+ * Returns the state or NULL on error.
+ */
+struct arq_rx * arq_rx_create(void * id, struct frame_stats * st,
+	size_t max_frame, int budget) {
+
+	struct arq_rx * rx;
+	rx = calloc(1, sizeof (struct arq_rx));
+	if (rx == NULL)
+		return (NULL);
+	rx->id = id;
+	rx->st = st;
+	rx->max_frame = max_frame;
+	rx->budget = budget*1000000ULL;
+	rx->fd = -1;
+	for (int i = 0; i < ARQ_WINDOW; i++) {
+		rx->slots[i].data = malloc(max_frame);
+		if (rx->slots[i].data == NULL) {
+			arq_rx_free(rx);
+			return (NULL);
+		}
+	}
+	return (rx);
+}
+
+/* Free receiving side rx */
+void arq_rx_free(struct arq_rx * rx) {
+	if (rx == NULL)
+		return;
+	for (int i = 0; i < ARQ_WINDOW; i++)
+		free(rx->slots[i].data);
+	free(rx);
+}
+
+/* NACKs are sent by socket fd to addr, the sender of the last datagram */
+void arq_rx_peer(struct arq_rx * rx, int fd, struct sockaddr * addr,
+	socklen_t addrlen) {
+
+	rx->fd = fd;
+	memcpy(&rx->peer, addr, addrlen);
+	rx->peerlen = addrlen;
+}
+
+/* Forget all frames, the sequence starts again at seq */
+static void arq_rx_restart(struct arq_rx * rx, uint64_t seq) {
+	for (int i = 0; i < ARQ_WINDOW; i++) {
+		rx->slots[i].have = 0;
+		rx->slots[i].seq = 0;
+	}
+	rx->next = seq;
+	rx->high = seq;
+}
+
+/* Skip the next frame, which is given up */
+static void arq_rx_skip(struct arq_rx * rx) {
+	struct arq_slot * slot;
+	slot = &rx->slots[rx->next%ARQ_WINDOW];
+	slot->have = 0;
+	slot->seq = 0;
+	rx->next++;
+}
+
+/* Add received data frame of len bytes (header and payload) */
+void arq_rx_add(struct arq_rx * rx, char * frame, size_t len) {
+	struct arq_slot * slot;
+	uint64_t seq;
+	uint64_t now;
+	memcpy(&seq, frame+8, 8);
+	seq = be64toh(seq);
+	if (!rx->started || seq+ARQ_WINDOW < rx->next ||
+		seq > rx->high+ARQ_WINDOW) {
+
+		arq_rx_restart(rx, seq);
+		rx->started = 1;
+	}
+	if (seq < rx->next) {
+		rx->st->dups++;
+		return;
+	}
+	// Frames too far behind are given up to make room
+	while (seq >= rx->next+ARQ_WINDOW)
+		arq_rx_skip(rx);
+	now = now_ns();
+	// Frames between the highest and this one are missing
+	for (uint64_t s = rx->high+1; s < seq; s++) {
+		slot = &rx->slots[s%ARQ_WINDOW];
+		slot->seq = s;
+		slot->have = 0;
+		slot->since = now;
+		slot->nacked = 0;
+	}
+	slot = &rx->slots[seq%ARQ_WINDOW];
+	if (slot->seq == seq && slot->have) {
+		rx->st->dups++;
+		return;
+	}
+	if (slot->seq == seq && slot->nacked != 0)
+		rx->st->resent++;
+	memcpy(slot->data, frame, len);
+	slot->len = len;
+	slot->seq = seq;
+	slot->have = 1;
+	if (seq > rx->high)
+		rx->high = seq;
+}
+
+/* Send NACK of n sequence numbers in payload to the sender */
+static void arq_rx_send(struct arq_rx * rx, char * payload, int n) {
+	struct chunk_meta meta;
+	char hdr[FRAME_HEADER_SIZE];
+	meta.seq = 0;
+	meta.stamp = 0;
+	frame_header(hdr, FRAME_NACK, &meta, payload, 8*n);
+	if (arq_send(rx->fd, (struct sockaddr *)&rx->peer, rx->peerlen, hdr,
+		payload, 8*n) == -1)
+		tdprint(rx->id, WARN, "Error in sending NACK\n");
+}
+
+/*
+ * Request missing frames which were not requested yet or were requested
+ * longer than a quarter of the budget ago.
+ */
+static void arq_rx_nack(struct arq_rx * rx, uint64_t now) {
+	char payload[8*ARQ_NACK_MAX];
+	int n;
+	if (rx->fd == -1)
+		return;
+	n = 0;
+	for (uint64_t s = rx->next; s < rx->high; s++) {
+		struct arq_slot * slot;
+		uint64_t seq;
+		slot = &rx->slots[s%ARQ_WINDOW];
+		if (slot->have || (slot->nacked != 0 &&
+			now-slot->nacked < rx->budget/4))
+			continue;
+		slot->nacked = now;
+		rx->st->requested++;
+		seq = htobe64(s);
+		memcpy(payload+8*n, &seq, 8);
+		if (++n == ARQ_NACK_MAX) {
+			arq_rx_send(rx, payload, n);
+			n = 0;
+		}
+	}
+	if (n > 0)
+		arq_rx_send(rx, payload, n);
+}
+
+/*
+ * Get the next data frame in order of sequence numbers, pointer to it is
+ * stored to frame and it is valid until the next frame is added. Missing
+ * frames are requested, a missing frame is waited for until the budget runs
+ * out, then it is skipped.
+ *
+ * Returns length of the frame or -1 if there is none now.
+ */
+ssize_t arq_rx_next(struct arq_rx * rx, char ** frame) {
+	uint64_t now;
+	if (!rx->started)
+		return (-1);
+	now = now_ns();
+	arq_rx_nack(rx, now);
+	while (rx->next <= rx->high) {
+		struct arq_slot * slot;
+		slot = &rx->slots[rx->next%ARQ_WINDOW];
+		if (slot->have && slot->seq == rx->next) {
+			slot->have = 0;
+			rx->next++;
+			*frame = slot->data;
+			return (slot->len);
+		}
+		if (now-slot->since < rx->budget)
+			return (-1);
+		arq_rx_skip(rx);
+	}
+	return (-1);
+}
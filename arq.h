@@ -0,0 +1,84 @@
+#ifndef ARQ_H
+#define	ARQ_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "netstream.h"
+
+/*
+ * Retransmission of lost frames of framed UDP streams (ARQ). A receiver with
+ * ARQ waits for a missing frame and asks the sender for it by NACK frames
+ * sent back to the source address of the stream. A missing frame is asked
+ * for again after a quarter of the latency budget and skipped when the
+ * budget runs out. Frames are passed on in order of sequence numbers.
+ *
+ * A sender with ARQ keeps sent chunks held in the ring of its buffer for the
+ * retransmission window (at most a half of the ring) and sends a requested
+ * frame again from the ring, the chunk is not copied. NACKs are received by
+ * own thread, so they are served also while the output waits for data.
+ *
+ * Payload of a NACK frame is a list of requested sequence numbers, each 8
+ * bytes in big endian.
+ */
+#define	ARQ_MAX_TIME 10000 	// Longest window or latency budget in ms
+#define	ARQ_NACK_MAX 64 	// Sequence numbers in a NACK frame
+#define	ARQ_WINDOW 1024 	// Frames kept by receiver for reordering
+#define	ARQ_TICK 10 		// Period of checking timers in ms
+
+// Sending side of ARQ of an output
+struct arq_tx {
+	struct endpt_cfg * cfg; // Output
+	int fd; 		// Socket of the output
+	struct sockaddr_storage addr; // Destination of frames
+	socklen_t addrlen; 	// Length of addr
+	uint64_t * sent; 	// Times of sending of held chunks, oldest first
+	size_t max; 		// Size of sent
+	size_t first; 		// Index of the oldest held chunk in sent
+	size_t n; 		// Number of held chunks
+	pthread_mutex_t lock; 	// Held chunks are not released while resent
+	pthread_t thread; 	// Thread receiving NACKs
+	int running; 		// Is the thread running?
+	int stop; 		// Should the thread end?
+};
+
+// Receiving state of a frame
+struct arq_slot {
+	uint64_t seq; 		// Sequence number
+	int have; 		// Is the frame here?
+	uint64_t since; 	// When was the frame found missing (ns)
+	uint64_t nacked; 	// Last request of the frame (ns, 0 - none)
+	size_t len; 		// Length of the frame
+	char * data; 		// The frame
+};
+
+// Receiving side of ARQ of an input
+struct arq_rx {
+	void * id; 		// Input, used in messages
+	struct frame_stats * st; // Counters of the input
+	size_t max_frame; 	// Longest data frame
+	uint64_t budget; 	// How long a missing frame is waited for (ns)
+	struct arq_slot slots[ARQ_WINDOW]; // Frames by sequence number
+	int started; 		// Was any data frame received?
+	uint64_t next; 		// Sequence number of the next frame to give
+	uint64_t high; 		// Highest sequence number received
+	int fd; 		// Socket of the input (-1 - sender not known)
+	struct sockaddr_storage peer; // Sender of the stream
+	socklen_t peerlen; 	// Length of peer
+};
+
+int arq_tx_init(struct arq_tx * tx, struct endpt_cfg * cfg);
+int arq_tx_start(struct arq_tx * tx, int fd, struct sockaddr * addr,
+	socklen_t addrlen);
+void arq_tx_keep(struct arq_tx * tx);
+void arq_tx_stop(struct arq_tx * tx, int linger);
+struct arq_rx * arq_rx_create(void * id, struct frame_stats * st,
+	size_t max_frame, int budget);
+void arq_rx_free(struct arq_rx * rx);
+void arq_rx_peer(struct arq_rx * rx, int fd, struct sockaddr * addr,
+	socklen_t addrlen);
+void arq_rx_add(struct arq_rx * rx, char * frame, size_t len);
+ssize_t arq_rx_next(struct arq_rx * rx, char ** frame);
+
+#endif
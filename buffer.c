@@ -1,60 +1,448 @@
+#define	_DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "netstream.h"
 #include "buffer.h"
+#include "spill.h"
+#include "trace.h"
+
+static uint64_t last_seq; 	// Sequence number of the last chunk read
+static size_t mem_cap; 		// Memory for all buffers (0 - unlimited)
+static size_t mem_used; 	// Memory taken by all buffers
+static int mem_nbufs; 		// Number of buffers
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Memory taken by one item of a ring with items of it_size bytes
+#define	ITEM_COST(it_size) ((it_size)+sizeof (ssize_t)+sizeof (char *)+\
+	sizeof (struct chunk_meta))
 
 /*
- * Insert into buffer buf ndata bytes from address data. If ndata < 0,
- * nothing is copied and datalens is set to ndata at producers position. This
- * is used for indicating end of stream and other special cases.
- *
- * If next position is position of reader, this position is skipped and data are
- * copied to the next position.
+ * Take at most n and at least min bytes from the memory of buffers.
  *
- * Returns 0 always.
+ * Returns the number of bytes taken or 0 if not even min bytes are left.
  */
-int buffer_insert(struct buffer * buf, char * data, ssize_t ndata) {
+static size_t mem_take(size_t n, size_t min) {
+	pthread_mutex_lock(&mem_lock);
+	if (mem_cap > 0 && mem_used+n > mem_cap)
+		n = mem_cap > mem_used ? mem_cap-mem_used : 0;
+	if (n < min)
+		n = 0;
+	mem_used += n;
+	pthread_mutex_unlock(&mem_lock);
+	return (n);
+}
+
+/* Return n bytes to the memory of buffers */
+static void mem_give(size_t n) {
+	pthread_mutex_lock(&mem_lock);
+	mem_used -= n;
+	pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * Set the memory for all buffers to cap bytes (0 - unlimited), before any
+ * buffer is created.
+ */
+void buffer_set_mem_cap(size_t cap) {
+	mem_cap = cap;
+}
+
+/* Returns memory taken by all buffers */
+size_t buffer_mem_used(void) {
+	size_t used;
+	pthread_mutex_lock(&mem_lock);
+	used = mem_used;
+	pthread_mutex_unlock(&mem_lock);
+	return (used);
+}
+
+/*
+ * Measure the chunk rate of buffer buf sized by time, a chunk was put now.
+ * Once per BUF_RATE_INTERVAL, the ring size needed for the rate is computed;
+ * the consumer resizes the ring if it is too small or more than twice too
+ * large. The rate follows increases at once and decreases slowly.
+ */
+static void rate_update(struct buffer * buf) {
+	struct timespec ts;
+	double elapsed;
+	double rate;
+	size_t need;
+	size_t want;
+	buf->rate_chunks++;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	elapsed = (ts.tv_sec-buf->rate_since.tv_sec)*1000.0+
+		(ts.tv_nsec-buf->rate_since.tv_nsec)/1e6;
+	if (elapsed < BUF_RATE_INTERVAL)
+		return;
+	rate = buf->rate_chunks*1000.0/elapsed;
+	if (rate > buf->chunk_rate)
+		buf->chunk_rate = rate;
+	else
+		buf->chunk_rate = (buf->chunk_rate*7+rate)/8;
+	buf->rate_chunks = 0;
+	buf->rate_since = ts;
+	need = buf->chunk_rate*buf->buf_time/1000+2;
+	// A quarter more, so that small changes of the rate do not resize
+	want = need+need/4;
+	if (want < BUF_MIN_ITEMS)
+		want = BUF_MIN_ITEMS;
+	if (want > BUF_MAX_ITEMS)
+		want = BUF_MAX_ITEMS;
+	buf->want_items = 0;
+	if ((need > buf->nitems && buf->nitems < BUF_MAX_ITEMS) ||
+		want < buf->nitems/2)
+		buf->want_items = want;
+}
+
+/*
+ * Resize the ring of buffer buf to nitems items, waiting items are kept.
+ * Called by the consumer with the lock held, when it uses no item. Growth is
+ * limited by the memory cap, shrinking waits until the items fit.
+ */
+static void buffer_resize(struct buffer * buf, size_t nitems) {
+	size_t nwaiting;
+	size_t cost;
+	size_t taken;
+	char * buffer;
+	ssize_t * datalens;
+	char ** refs;
+	struct chunk_meta * metas;
+	nwaiting = (buf->prod_pos+buf->nitems-buf->cons_pos-1)%buf->nitems;
+	if (nitems < nwaiting+2)
+		return;
+	buf->want_items = 0;
+	cost = ITEM_COST(buf->it_size);
+	taken = 0;
+	if (nitems > buf->nitems) {
+		// With the cap, a buffer grows at most to an equal share of it
+		int nbufs;
+		nbufs = __atomic_load_n(&mem_nbufs, __ATOMIC_RELAXED);
+		if (mem_cap > 0 && nitems*cost > mem_cap/nbufs) {
+			size_t share;
+			share = mem_cap/nbufs/cost;
+			if (!buf->capped)
+				dprint(NOTICE, "Buffer %p is limited by the "
+					"memory cap\n", buf);
+			buf->capped = 1;
+			if (share <= buf->nitems)
+				return;
+			nitems = share;
+		}
+		taken = mem_take((nitems-buf->nitems)*cost, cost);
+		if (taken < (nitems-buf->nitems)*cost && !buf->capped) {
+			dprint(NOTICE, "Buffer %p is limited by the memory "
+				"cap\n", buf);
+			buf->capped = 1;
+		}
+		mem_give(taken%cost);
+		taken -= taken%cost;
+		if (taken == 0)
+			return;
+		nitems = buf->nitems+taken/cost;
+	}
+	buffer = malloc(sizeof (char)*buf->it_size*nitems);
+	datalens = calloc(sizeof (ssize_t), nitems);
+	refs = calloc(sizeof (char *), nitems);
+	metas = calloc(sizeof (struct chunk_meta), nitems);
+	if (buffer == NULL || datalens == NULL || refs == NULL ||
+		metas == NULL) {
+
+		dprint(WARN, "Can't allocate memory for buffers\n");
+		free(buffer);
+		free(datalens);
+		free(refs);
+		free(metas);
+		mem_give(taken);
+		return;
+	}
+	// Waiting items follow the consumer position 0
+	for (size_t i = 0; i < nwaiting; i++) {
+		size_t from;
+		from = (buf->cons_pos+1+i)%buf->nitems;
+		datalens[i+1] = buf->datalens[from];
+		refs[i+1] = buf->refs[from];
+		metas[i+1] = buf->metas[from];
+		if (refs[i+1] == NULL && datalens[i+1] > 0)
+			memcpy(buffer+(i+1)*buf->it_size,
+				buf->buffer+from*buf->it_size,
+				datalens[i+1]);
+	}
+	if (nitems < buf->nitems)
+		mem_give((buf->nitems-nitems)*cost);
+	free(buf->buffer);
+	free(buf->datalens);
+	free(buf->refs);
+	free(buf->metas);
+	buf->buffer = buffer;
+	buf->datalens = datalens;
+	buf->refs = refs;
+	buf->metas = metas;
+	buf->nitems = nitems;
+	buf->cons_pos = 0;
+	buf->prod_pos = nwaiting+1;
+	buf->resizes++;
+	dprint(INFO, "Buffer %p resized to %zu items (%.0f chunks/s)\n", buf,
+		nitems, buf->chunk_rate);
+}
+
+/*
+ * Fill meta of a newly read chunk with the next sequence number and the
+ * current time. Markers get no sequence number.
+ */
+static void meta_stamp(struct chunk_meta * meta, ssize_t ndata) {
+	struct timespec ts;
+	meta->seq = 0;
+	meta->stamp = 0;
+	if (ndata <= 0)
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	meta->seq = __atomic_add_fetch(&last_seq, 1, __ATOMIC_RELAXED);
+	meta->stamp = (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/* Returns sequence number of the last chunk read */
+uint64_t buffer_last_seq(void) {
+	return (__atomic_load_n(&last_seq, __ATOMIC_RELAXED));
+}
+
+/*
+ * Continue numbering of chunks after seq, which was reached by the previous
+ * process.
+ */
+void buffer_set_last_seq(uint64_t seq) {
+	__atomic_store_n(&last_seq, seq, __ATOMIC_RELAXED);
+}
+
+/*
+ * Put ndata bytes from address data with meta at producers position of buffer
+ * buf. If ref is set, only the pointer is stored and data has to stay valid
+ * until it is consumed.
+ */
+static void buffer_put(struct buffer * buf, char * data, ssize_t ndata,
+	struct chunk_meta * meta, int ref) {
+
 	pthread_mutex_lock(&buf->lock);
 	dprint(DEBUG, "Buf:%p, Prod:%d, Cons:%d, Inserting:%d\n",
 		buf,
 		buf->prod_pos,
 		buf->cons_pos,
 		ndata);
+	// Items from here to consumer position can't be written
+	int busy_pos;
+	busy_pos = (buf->cons_pos+buf->nitems-buf->held)%buf->nitems;
+	// Once data are spilled, all data go to the spill file until it is
+	// drained, so the order is kept. Termination goes to the buffer.
+	if (buf->spill != NULL && ndata != BUF_KILL &&
+		(buf->spill->pending > 0 || buf->prod_pos == busy_pos)) {
+
+		if (buf->spill->pending == 0)
+			dprint(NOTICE, "Buffer %p spills to %s\n", buf,
+				buf->spill->name);
+		if (spill_append(buf->spill, data, ndata, meta) == -1) {
+			TRACE3(drop, buf, 1, TRACE_DROP_SPILL);
+			if (buf->dropped++ == 0)
+				dprint(WARN, "Spill file %s is full\n",
+					buf->spill->name);
+		}
+		// Buffer was empty, consumer may wait
+		if ((buf->cons_pos+1)%buf->nitems == buf->prod_pos)
+			pthread_cond_broadcast(&buf->empty_cv);
+		pthread_mutex_unlock(&buf->lock);
+		return;
+	}
+	// Buffer is full and items are held, the newest data are discarded
+	// (a marker replaces the newest item)
+	if (buf->held > 0 && buf->prod_pos == busy_pos) {
+		int last;
+		last = (buf->prod_pos+buf->nitems-1)%buf->nitems;
+		buf->dropped++;
+		TRACE3(drop, buf, 1, TRACE_DROP_HELD);
+		if (ndata >= 0 || last == buf->cons_pos) {
+			dprint(WARN, "Buffer %p overflow\n", buf);
+			pthread_mutex_unlock(&buf->lock);
+			return;
+		}
+		buf->prod_pos = last;
+	}
 	// Buffer is full, discard data
 	if ((buf->prod_pos+0)%buf->nitems == buf->cons_pos) {
 		buf->prod_pos = (buf->prod_pos+1)%buf->nitems;
+		buf->dropped++;
+		TRACE3(drop, buf, 1, TRACE_DROP_FULL);
 		dprint(WARN, "Buffer %p overflow\n", buf);
 	}
-	if (ndata >= 0) {
+	buf->refs[buf->prod_pos] = NULL;
+	if (ref) {
+		buf->refs[buf->prod_pos] = data;
+	} else if (ndata >= 0) {
 		memcpy(buf->buffer+buf->prod_pos*buf->it_size,
 			data, ndata);
 	}
 	buf->datalens[buf->prod_pos] = ndata;
+	buf->metas[buf->prod_pos] = *meta;
+	if (buf->buf_time > 0 && ndata > 0)
+		rate_update(buf);
 
-	// Buffer was empty, signal a condition variable
-	if ((buf->cons_pos+1)%buf->nitems == buf->prod_pos) {
-		pthread_cond_broadcast(&buf->empty_cv);
+	int was_empty;
+	was_empty = (buf->cons_pos+1)%buf->nitems == buf->prod_pos;
+	if (buf->wake_delay == 0) {
+		// Buffer was empty, signal a condition variable
+		if (was_empty)
+			pthread_cond_broadcast(&buf->empty_cv);
+	} else  {
+		// Consumer is woken by the first chunk to time the batch and
+		// then when enough data or a marker come or half of the buffer
+		// is filled
+		int nwaiting;
+		nwaiting = (buf->prod_pos+buf->nitems-buf->cons_pos)%
+			buf->nitems;
+		if (was_empty) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			buf->pending = 0;
+			buf->pending_since = ts;
+			buf->wake_now = 0;
+			pthread_cond_broadcast(&buf->empty_cv);
+		}
+		if (ndata > 0)
+			buf->pending += ndata;
+		if (!buf->wake_now && (ndata < 0 ||
+			(size_t)nwaiting >= buf->nitems/2 ||
+			(buf->wake_bytes > 0 && buf->pending >= buf->wake_bytes))) {
+
+			buf->wake_now = 1;
+			pthread_cond_broadcast(&buf->empty_cv);
+		}
 	}
 	buf->prod_pos = (buf->prod_pos+1)%buf->nitems;
+	TRACE3(chunk_insert, buf, ndata,
+		(buf->prod_pos+buf->nitems-buf->cons_pos-1)%buf->nitems);
 	pthread_mutex_unlock(&buf->lock);
+}
+
+/*
+ * Insert into buffer buf ndata bytes from address data. If ndata < 0,
+ * nothing is copied and datalens is set to ndata at producers position. This
+ * is used for indicating end of stream and other special cases.
+ *
+ * If next position is position of reader, this position is skipped and data are
+ * copied to the next position.
+ *
+ * Returns 0 always.
+ */
+int buffer_insert(struct buffer * buf, char * data, ssize_t ndata) {
+	struct chunk_meta meta;
+	meta.seq = 0;
+	meta.stamp = 0;
+	buffer_put(buf, data, ndata, &meta, 0);
 	return (0);
 }
 
+/* Like buffer_insert, but the chunk keeps sequence number and time of meta */
+void buffer_insert_meta(struct buffer * buf, char * data, ssize_t ndata,
+	struct chunk_meta * meta) {
+
+	buffer_put(buf, data, ndata, meta, 0);
+}
+
+/*
+ * Insert ndata bytes from data read by input into all nbufs buffers in bufs.
+ * The chunk gets the next sequence number.
+ */
+void buffers_insert(struct buffer ** bufs, int nbufs, char * data,
+	ssize_t ndata) {
+
+	struct chunk_meta meta;
+	meta_stamp(&meta, ndata);
+	for (int i = 0; i < nbufs; i++) {
+		buffer_put(bufs[i], data, ndata, &meta, 0);
+	}
+}
+
+/*
+ * Insert ndata bytes from data into all nbufs buffers in bufs with sequence
+ * number and time of meta, which were received from upstream.
+ */
+void buffers_insert_meta(struct buffer ** bufs, int nbufs, char * data,
+	ssize_t ndata, struct chunk_meta * meta) {
+
+	for (int i = 0; i < nbufs; i++) {
+		buffer_put(bufs[i], data, ndata, meta, 0);
+	}
+}
+
+/* Insert a reference to ndata bytes at data into all nbufs buffers in bufs */
+void buffers_insert_ref(struct buffer ** bufs, int nbufs, char * data,
+	ssize_t ndata) {
+
+	struct chunk_meta meta;
+	meta_stamp(&meta, ndata);
+	for (int i = 0; i < nbufs; i++) {
+		buffer_put(bufs[i], data, ndata, &meta, 1);
+	}
+}
+
 /* Returns pointer to consumer position in buffer */
 char * buffer_cons_data_pointer(struct buffer * buf) {
 	pthread_mutex_lock(&buf->lock);
 	char * result;
-	result = buf->buffer+buf->cons_pos*buf->it_size;
+	result = buf->refs[buf->cons_pos];
+	if (buf->cons_spill != NULL)
+		result = buf->cons_spill;
+	else if (result == NULL)
+		result = buf->buffer+buf->cons_pos*buf->it_size;
 	pthread_mutex_unlock(&buf->lock);
 	return (result);
 
 }
 
+/* Store sequence number and time of the item at consumer position to meta */
+void buffer_cons_meta(struct buffer * buf, struct chunk_meta * meta) {
+	pthread_mutex_lock(&buf->lock);
+	if (buf->cons_spill != NULL)
+		*meta = buf->cons_spill_meta;
+	else
+		*meta = buf->metas[buf->cons_pos];
+	pthread_mutex_unlock(&buf->lock);
+}
+
+/*
+ * Drop the oldest data chunks of buffer buf when more than half of the ring
+ * waits, so that a quarter is left. Markers are kept. Called by the consumer
+ * with the lock held.
+ */
+static void buffer_shed(struct buffer * buf) {
+	size_t nwaiting;
+	size_t ndropped;
+	nwaiting = (buf->prod_pos+buf->nitems-buf->cons_pos-1)%buf->nitems;
+	if (nwaiting <= buf->nitems/2)
+		return;
+	ndropped = 0;
+	while (nwaiting > buf->nitems/4) {
+		int next;
+		next = (buf->cons_pos+1)%buf->nitems;
+		if (buf->datalens[next] < 0)
+			break;
+		buf->cons_pos = next;
+		nwaiting--;
+		ndropped++;
+	}
+	buf->dropped += ndropped;
+	TRACE3(drop, buf, ndropped, TRACE_DROP_SHED);
+	dprint(INFO, "Buffer %p shed %zu chunks\n", buf, ndropped);
+}
+
 /*
  * Move consumer position to next item and if buffer is empty, block until a
- * new item is written into buffer.
+ * new item is written into buffer. Spilled data are consumed when the buffer
+ * is empty, they are always newer than the data in the buffer. With wake
+ * thresholds, a consumer which waited is woken only when wake_bytes are
+ * pending or the oldest pending chunk waits for wake_delay, so it takes the
+ * chunks in a batch.
  *
  * Returns size of the next data item on consumer position.
  */
@@ -64,9 +452,53 @@ int buffer_after_delete(struct buffer * buf) {
 		buf,
 		buf->prod_pos,
 		buf->cons_pos);
+	if (buf->cons_spill != NULL) {
+		spill_release(buf->spill);
+		buf->cons_spill = NULL;
+	}
+	if (buf->hold_cur) {
+		buf->held++;
+		buf->hold_cur = 0;
+	}
+	// The kernel may read held items, they can't move
+	if (buf->want_items > 0 && buf->held == 0)
+		buffer_resize(buf, buf->want_items);
+	if (buf->shed && buf->held == 0)
+		buffer_shed(buf);
 	// Buffer is empty, wait until is filled
-	if ((buf->cons_pos+1)%buf->nitems == buf->prod_pos) {
+	int slept;
+	slept = 0;
+	while ((buf->cons_pos+1)%buf->nitems == buf->prod_pos) {
+		if (buf->spill != NULL && buf->spill->pending > 0) {
+			ssize_t nspill;
+			nspill = spill_take(buf->spill, &buf->cons_spill,
+				&buf->cons_spill_meta);
+			if (buf->spill->pending == 0)
+				dprint(NOTICE, "Spill file %s drained\n",
+					buf->spill->name);
+			pthread_mutex_unlock(&buf->lock);
+			return (nspill);
+		}
 		pthread_cond_wait(&buf->empty_cv, &buf->lock);
+		slept = 1;
+	}
+	if (slept && buf->wake_delay > 0) {
+		struct timespec deadline;
+		deadline = buf->pending_since;
+		deadline.tv_sec += buf->wake_delay/1000000;
+		deadline.tv_nsec += (buf->wake_delay%1000000)*1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!buf->wake_now && pthread_cond_timedwait(&buf->empty_cv,
+			&buf->lock, &deadline) != ETIMEDOUT)
+			;
+	}
+	buf->wakeups += slept;
+	if (slept) {
+		TRACE2(wake, buf,
+			(buf->prod_pos+buf->nitems-buf->cons_pos-1)%buf->nitems);
 	}
 	buf->cons_pos = (buf->cons_pos+1)%buf->nitems;
 	ssize_t ncons_data;
@@ -75,6 +507,267 @@ int buffer_after_delete(struct buffer * buf) {
 	return (ncons_data);
 }
 
+/* Returns number of chunks waiting for the consumer of buffer buf */
+size_t buffer_waiting(struct buffer * buf) {
+	size_t nwaiting;
+	pthread_mutex_lock(&buf->lock);
+	nwaiting = (buf->prod_pos+buf->nitems-buf->cons_pos-1)%buf->nitems;
+	pthread_mutex_unlock(&buf->lock);
+	return (nwaiting);
+}
+
+/*
+ * Keep the item at consumer position after the consumer moves on, its memory
+ * is still read by the kernel. It has to be released by buffer_release.
+ *
+ * Returns 0 on success, -1 if the item can't be kept (it is spilled data).
+ */
+int buffer_hold(struct buffer * buf) {
+	int res;
+	pthread_mutex_lock(&buf->lock);
+	res = -1;
+	if (buf->cons_spill == NULL) {
+		buf->hold_cur = 1;
+		res = 0;
+	}
+	pthread_mutex_unlock(&buf->lock);
+	return (res);
+}
+
+/*
+ * Release n oldest items kept by buffer_hold, the last one may be the item at
+ * consumer position.
+ */
+void buffer_release(struct buffer * buf, size_t n) {
+	pthread_mutex_lock(&buf->lock);
+	size_t nheld;
+	nheld = n < buf->held ? n : buf->held;
+	buf->held -= nheld;
+	if (n > nheld)
+		buf->hold_cur = 0;
+	pthread_mutex_unlock(&buf->lock);
+}
+
+/*
+ * Find the data item with sequence number seq among items kept by
+ * buffer_hold, pointer to its data is stored to data and its meta to meta.
+ * The data stay valid until the item is released.
+ *
+ * Returns length of the item or -1 if it is not kept.
+ */
+ssize_t buffer_held_find(struct buffer * buf, uint64_t seq, char ** data,
+	struct chunk_meta * meta) {
+
+	ssize_t len;
+	size_t nkept;
+	pthread_mutex_lock(&buf->lock);
+	len = -1;
+	nkept = buf->held+buf->hold_cur;
+	// Sequence numbers grow, the newest items are searched first
+	for (size_t i = 0; i < nkept; i++) {
+		int pos;
+		pos = (buf->cons_pos+buf->nitems+buf->hold_cur-1-i)%
+			buf->nitems;
+		if (buf->datalens[pos] <= 0)
+			continue;
+		if (buf->metas[pos].seq < seq)
+			break;
+		if (buf->metas[pos].seq != seq)
+			continue;
+		*data = buf->refs[pos];
+		if (*data == NULL)
+			*data = buf->buffer+pos*buf->it_size;
+		*meta = buf->metas[pos];
+		len = buf->datalens[pos];
+		break;
+	}
+	pthread_mutex_unlock(&buf->lock);
+	return (len);
+}
+
+/* Returns 1 if the ring of buffer buf waits for held items to be resized */
+int buffer_resizing(struct buffer * buf) {
+	int res;
+	pthread_mutex_lock(&buf->lock);
+	res = buf->want_items > 0;
+	pthread_mutex_unlock(&buf->lock);
+	return (res);
+}
+
+/*
+ * Initialize buffer buf with nitems items of it_size bytes.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int buffer_init(struct buffer * buf, size_t nitems, size_t it_size) {
+	char * buffer;
+	ssize_t * datalens;
+	char ** refs;
+	struct chunk_meta * metas;
+	if (mem_take(ITEM_COST(it_size)*nitems, ITEM_COST(it_size)*nitems) ==
+		0) {
+
+		dprint(ERR, "Memory cap does not allow more buffers\n");
+		return (-1);
+	}
+	buffer = malloc(sizeof (char)*it_size*nitems);
+	datalens = calloc(sizeof (ssize_t), nitems);
+	refs = calloc(sizeof (char *), nitems);
+	metas = calloc(sizeof (struct chunk_meta), nitems);
+	if (buffer == NULL || datalens == NULL || refs == NULL ||
+		metas == NULL) {
+
+		dprint(WARN, "Can't allocate memory for buffers\n");
+		free(buffer);
+		free(datalens);
+		free(refs);
+		free(metas);
+		mem_give(ITEM_COST(it_size)*nitems);
+		return (-1);
+	}
+	__atomic_add_fetch(&mem_nbufs, 1, __ATOMIC_RELAXED);
+	buf->buffer = buffer;
+	buf->datalens = datalens;
+	buf->refs = refs;
+	buf->metas = metas;
+	buf->spill = NULL;
+	buf->cons_spill = NULL;
+	buf->dropped = 0;
+	buf->held = 0;
+	buf->hold_cur = 0;
+	buf->wake_bytes = 0;
+	buf->wake_delay = 0;
+	buf->pending = 0;
+	buf->wake_now = 0;
+	buf->wakeups = 0;
+	buf->buf_time = 0;
+	buf->want_items = 0;
+	buf->rate_chunks = 0;
+	buf->chunk_rate = 0;
+	buf->resizes = 0;
+	buf->capped = 0;
+	buf->shed = 0;
+	buf->nitems = nitems;
+	buf->it_size = it_size;
+	buf->prod_pos = 0;
+	buf->cons_pos = buf->nitems-1;
+	if (pthread_mutex_init(&buf->lock, NULL)) {
+		dprint(WARN, "Error in mutex initialization\n");
+		return (-1);
+	}
+	if (pthread_cond_init(&buf->empty_cv, NULL)) {
+		dprint(WARN,
+		"Error in conditional variable initialization\n");
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Attach spill file name of size bytes to buffer buf, which was not used yet.
+ * Data which do not fit into the buffer are written to the file instead of
+ * being discarded.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int buffer_set_spill(struct buffer * buf, char * name, size_t size) {
+	buf->spill = spill_open(name, size);
+	if (buf->spill == NULL)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Set wake thresholds of buffer buf, which was not used yet: the consumer is
+ * woken when bytes are pending or when the oldest pending chunk waits for
+ * delay microseconds. With bytes only, delay is WAKE_DELAY. Zeros wake the
+ * consumer by each chunk.
+ */
+void buffer_set_wake(struct buffer * buf, size_t bytes, int delay) {
+	if (bytes > 0 && delay == 0)
+		delay = WAKE_DELAY;
+	buf->wake_bytes = bytes;
+	buf->wake_delay = delay;
+}
+
+/*
+ * Size the ring of buffer buf, which was not used yet, for ms milliseconds of
+ * the stream by the measured chunk rate. Zero keeps the size.
+ */
+void buffer_set_time(struct buffer * buf, int ms) {
+	buf->buf_time = ms;
+	clock_gettime(CLOCK_MONOTONIC, &buf->rate_since);
+}
+
+/*
+ * Let the consumer of buffer buf, which was not used yet, drop the oldest
+ * chunks when half of the ring waits, if shed is set.
+ */
+void buffer_set_shed(struct buffer * buf, int shed) {
+	buf->shed = shed;
+}
+
+/* Fill st with current statistics of buffer buf */
+void buffer_get_stats(struct buffer * buf, struct buffer_stats * st) {
+	pthread_mutex_lock(&buf->lock);
+	st->items = (buf->prod_pos+buf->nitems-buf->cons_pos-1)%buf->nitems;
+	st->dropped = buf->dropped;
+	st->wakeups = buf->wakeups;
+	st->nitems = buf->nitems;
+	st->lag = 0;
+	if (st->items > 0) {
+		struct chunk_meta * oldest;
+		oldest = &buf->metas[(buf->cons_pos+1)%buf->nitems];
+		if (oldest->stamp > 0) {
+			struct timespec ts;
+			uint64_t now;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			now = (uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+			if (now > oldest->stamp)
+				st->lag = now-oldest->stamp;
+		}
+	}
+	st->resizes = buf->resizes;
+	st->spill_bytes = 0;
+	st->spill_items = 0;
+	if (buf->spill != NULL) {
+		st->spill_bytes = buf->spill->nbytes;
+		st->spill_items = buf->spill->pending;
+	}
+	pthread_mutex_unlock(&buf->lock);
+}
+
+/*
+ * Reallocate storage of a buffer, which was not used yet, for items of
+ * it_size bytes.
+ *
+ * Returns 0 on success, -1 if allocation fails.
+ */
+int buffer_set_item_size(struct buffer * buf, size_t it_size) {
+	char * buffer;
+	size_t more;
+	more = 0;
+	if (it_size > buf->it_size) {
+		more = (it_size-buf->it_size)*buf->nitems;
+		if (mem_take(more, more) == 0) {
+			dprint(ERR, "Memory cap does not allow more "
+				"buffers\n");
+			return (-1);
+		}
+	}
+	buffer = realloc(buf->buffer, sizeof (char)*it_size*buf->nitems);
+	if (buffer == NULL) {
+		dprint(WARN, "Can't allocate memory for buffers\n");
+		mem_give(more);
+		return (-1);
+	}
+	if (it_size < buf->it_size)
+		mem_give((buf->it_size-it_size)*buf->nitems);
+	buf->buffer = buffer;
+	buf->it_size = it_size;
+	return (0);
+}
+
 /*
  * Create and initialize array of buffers.
  *
@@ -88,35 +781,21 @@ struct buffer * create_buffers(int nbuffers) {
 		return (NULL);
 	}
 	for (int i = 0; i < nbuffers; i++) {
-		char * buffer;
-		ssize_t * datalens;
-		buffer = malloc(sizeof (char)*WRITE_BUFFER_BLOCK_SIZE*
-			WRITE_BUFFER_BLOCK_COUNT);
-		datalens = calloc(sizeof (ssize_t), WRITE_BUFFER_BLOCK_COUNT);
-		if (buffer == NULL || datalens == NULL) {
-			dprint(WARN, "Can't allocate memory for buffers\n");
-			free(buffer);
-			free(datalens);
-			while (i >= 0) {
+		if (buffer_init(&buffers[i], WRITE_BUFFER_BLOCK_COUNT,
+			WRITE_BUFFER_BLOCK_SIZE) == -1) {
+
+			while (i > 0) {
 				i--;
 				free(buffers[i].buffer);
 				free(buffers[i].datalens);
+				free(buffers[i].refs);
+				free(buffers[i].metas);
+				mem_give(ITEM_COST(buffers[i].it_size)*
+					buffers[i].nitems);
+				__atomic_sub_fetch(&mem_nbufs, 1,
+					__ATOMIC_RELAXED);
 			}
-			return (NULL);
-		}
-		buffers[i].buffer = buffer;
-		buffers[i].datalens = datalens;
-		buffers[i].nitems = WRITE_BUFFER_BLOCK_COUNT;
-		buffers[i].it_size = WRITE_BUFFER_BLOCK_SIZE;
-		buffers[i].prod_pos = 0;
-		buffers[i].cons_pos = buffers[i].nitems-1;
-		if (pthread_mutex_init(&buffers[i].lock, NULL)) {
-			dprint(WARN, "Error in mutex initialization\n");
-			return (NULL);
-		}
-		if (pthread_cond_init(&buffers[i].empty_cv, NULL)) {
-			dprint(WARN,
-			"Error in conditional variable initialization\n");
+			free(buffers);
 			return (NULL);
 		}
 	}
@@ -131,6 +810,10 @@ void free_buffers(struct buffer * buffers, int nbuffers) {
 		pthread_cond_destroy(&buffers[i].empty_cv);
 		free(buffers[i].buffer);
 		free(buffers[i].datalens);
+		free(buffers[i].refs);
+		free(buffers[i].metas);
+		mem_give(ITEM_COST(buffers[i].it_size)*buffers[i].nitems);
+		__atomic_sub_fetch(&mem_nbufs, 1, __ATOMIC_RELAXED);
 	}
 	free(buffers);
 }
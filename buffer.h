@@ -6,10 +6,53 @@
 
 #define	BUF_END_DATA -1
 #define	BUF_KILL -2
+#define	BUF_HANDOVER -3 	// Stream continues in a new process
+#define	WAKE_DELAY 10000 	// Default wake delay in us with wake bytes
+#define	BUF_RATE_INTERVAL 1000 	// Chunk rate is measured over this many ms
+#define	BUF_MIN_ITEMS 16 	// Minimal size of a ring sized by time
+#define	BUF_MAX_ITEMS (1 << 20) // Maximal size of a ring sized by time
+
+// Statistics of a buffer
+struct buffer_stats {
+	size_t items; 		// Items waiting in buffer
+	unsigned long dropped; 	// Chunks dropped on overflow
+	unsigned long wakeups; 	// Wakeups of consumer
+	size_t nitems; 		// Size of the ring
+	uint64_t lag; 		// Age of the oldest waiting chunk in ns
+	unsigned long resizes; 	// Resizes of the ring
+	size_t spill_bytes; 	// Data bytes waiting in spill file
+	int spill_items; 	// Chunks waiting in spill file
+};
 
 int buffer_insert(struct buffer * buf, char * data, ssize_t ndata);
+void buffer_insert_meta(struct buffer * buf, char * data, ssize_t ndata,
+	struct chunk_meta * meta);
+void buffers_insert(struct buffer ** bufs, int nbufs, char * data,
+	ssize_t ndata);
+void buffers_insert_meta(struct buffer ** bufs, int nbufs, char * data,
+	ssize_t ndata, struct chunk_meta * meta);
+void buffers_insert_ref(struct buffer ** bufs, int nbufs, char * data,
+	ssize_t ndata);
 char * buffer_cons_data_pointer(struct buffer * buf);
+void buffer_cons_meta(struct buffer * buf, struct chunk_meta * meta);
 int buffer_after_delete(struct buffer * buf);
+size_t buffer_waiting(struct buffer * buf);
+int buffer_hold(struct buffer * buf);
+void buffer_release(struct buffer * buf, size_t n);
+ssize_t buffer_held_find(struct buffer * buf, uint64_t seq, char ** data,
+	struct chunk_meta * meta);
+int buffer_resizing(struct buffer * buf);
+int buffer_init(struct buffer * buf, size_t nitems, size_t it_size);
+int buffer_set_item_size(struct buffer * buf, size_t it_size);
+int buffer_set_spill(struct buffer * buf, char * name, size_t size);
+void buffer_set_wake(struct buffer * buf, size_t bytes, int delay);
+void buffer_set_time(struct buffer * buf, int ms);
+void buffer_set_shed(struct buffer * buf, int shed);
+void buffer_set_mem_cap(size_t cap);
+size_t buffer_mem_used(void);
+void buffer_get_stats(struct buffer * buf, struct buffer_stats * st);
+uint64_t buffer_last_seq(void);
+void buffer_set_last_seq(uint64_t seq);
 struct buffer * create_buffers(int nbuffers);
 void free_buffers(struct buffer * buffers, int nbuffers);
 
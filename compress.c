@@ -0,0 +1,376 @@
+#define	_XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "netstream.h"
+#include "buffer.h"
+#include "compress.h"
+
+/* Returns 1 if netstream was compiled with support of codec, 0 otherwise */
+int comp_supported(enum compression codec) {
+	switch (codec) {
+		case C_NONE:
+			return (1);
+		case C_LZ4:
+#ifdef HAVE_LZ4
+			return (1);
+#else
+			return (0);
+#endif
+		case C_ZSTD:
+#ifdef HAVE_ZSTD
+			return (1);
+#else
+			return (0);
+#endif
+	}
+	return (0);
+}
+
+/* Returns maximal size of a frame carrying raw_len bytes of data */
+size_t comp_frame_bound(size_t raw_len) {
+	size_t bound;
+	bound = raw_len;
+#ifdef HAVE_LZ4
+	if (LZ4_COMPRESSBOUND(raw_len) > bound)
+		bound = LZ4_COMPRESSBOUND(raw_len);
+#endif
+#ifdef HAVE_ZSTD
+	if (ZSTD_COMPRESSBOUND(raw_len) > bound)
+		bound = ZSTD_COMPRESSBOUND(raw_len);
+#endif
+	return (COMP_HEADER_SIZE + bound);
+}
+
+/*
+ * Initialize compression stage st for codec with given level.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int comp_stage_init(struct comp_stage * st, enum compression codec,
+	int level, int max_outs) {
+
+	st->codec = codec;
+	st->level = level;
+	st->n_outs = 0;
+	st->ctx = NULL;
+	if (buffer_init(&st->in, WRITE_BUFFER_BLOCK_COUNT,
+		WRITE_BUFFER_BLOCK_SIZE) == -1) {
+		return (-1);
+	}
+	st->outs = malloc(sizeof (struct buffer *)*max_outs);
+	st->frame = malloc(comp_frame_bound(WRITE_BUFFER_BLOCK_SIZE));
+	if (st->outs == NULL || st->frame == NULL) {
+		dprint(WARN, "Failed to allocate memory in %s\n", __FUNCTION__);
+		return (-1);
+	}
+#ifdef HAVE_ZSTD
+	if (codec == C_ZSTD) {
+		st->ctx = ZSTD_createCCtx();
+		if (st->ctx == NULL) {
+			dprint(WARN, "Failed to create zstd context\n");
+			return (-1);
+		}
+	}
+#endif
+	return (0);
+}
+
+/*
+ * Set up compression stages and the list of buffers filled by input.
+ * Uncompressed outputs are filled by input directly, compressed outputs are
+ * filled by a stage shared by all outputs with the same codec and level.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int setup_compression(struct io_cfg * cfg) {
+	cfg->n_feeds = 0;
+	cfg->n_stages = 0;
+	cfg->feeds = malloc(sizeof (struct buffer *)*cfg->n_outs);
+	cfg->stages = malloc(sizeof (struct comp_stage)*cfg->n_outs);
+	if (cfg->feeds == NULL || cfg->stages == NULL) {
+		dprint(WARN, "Failed to allocate memory in %s\n", __FUNCTION__);
+		return (-1);
+	}
+	for (int i = 0; i < cfg->n_outs; i++) {
+		struct endpt_cfg * out = &cfg->outs[i];
+		if (out->compression == C_NONE) {
+			cfg->feeds[cfg->n_feeds++] = out->buf;
+			continue;
+		}
+		struct comp_stage * st = NULL;
+		for (int j = 0; j < cfg->n_stages; j++) {
+			if (cfg->stages[j].codec == out->compression &&
+				cfg->stages[j].level == out->comp_level) {
+				st = &cfg->stages[j];
+				break;
+			}
+		}
+		if (st == NULL) {
+			st = &cfg->stages[cfg->n_stages++];
+			if (comp_stage_init(st, out->compression,
+				out->comp_level, cfg->n_outs) == -1) {
+				return (-1);
+			}
+			cfg->feeds[cfg->n_feeds++] = &st->in;
+		}
+		if (buffer_set_item_size(out->buf,
+			comp_frame_bound(WRITE_BUFFER_BLOCK_SIZE)) == -1) {
+			return (-1);
+		}
+		st->outs[st->n_outs++] = out->buf;
+	}
+	dprint(DEBUG, "%d outputs fed by input, %d compression stages\n",
+		cfg->n_feeds, cfg->n_stages);
+	return (0);
+}
+
+/*
+ * Compress nraw bytes from raw into frame of stage st. Data which can't be
+ * compressed are stored.
+ *
+ * Returns size of the frame.
+ */
+static size_t comp_frame(struct comp_stage * st, char * raw, size_t nraw) {
+	char * payload;
+	size_t npayload;
+	int codec;
+	payload = st->frame+COMP_HEADER_SIZE;
+	npayload = 0;
+	codec = st->codec;
+	switch (st->codec) {
+#ifdef HAVE_LZ4
+		case C_LZ4: {
+			int res;
+			if (st->level > 0) {
+				res = LZ4_compress_HC(raw, payload, nraw,
+					LZ4_COMPRESSBOUND(nraw), st->level);
+			} else  {
+				res = LZ4_compress_default(raw, payload, nraw,
+					LZ4_COMPRESSBOUND(nraw));
+			}
+			if (res > 0)
+				npayload = res;
+			break;
+		}
+#endif
+#ifdef HAVE_ZSTD
+		case C_ZSTD: {
+			size_t res;
+			res = ZSTD_compressCCtx(st->ctx, payload,
+				ZSTD_COMPRESSBOUND(nraw), raw, nraw, st->level);
+			if (!ZSTD_isError(res))
+				npayload = res;
+			break;
+		}
+#endif
+		default:
+			break;
+	}
+	if (npayload == 0 || npayload >= nraw) {
+		memcpy(payload, raw, nraw);
+		npayload = nraw;
+		codec = COMP_STORED;
+	}
+	uint32_t len;
+	st->frame[0] = 'N';
+	st->frame[1] = 'Z';
+	st->frame[2] = codec;
+	st->frame[3] = 0;
+	len = htonl(nraw);
+	memcpy(st->frame+4, &len, 4);
+	len = htonl(npayload);
+	memcpy(st->frame+8, &len, 4);
+	return (COMP_HEADER_SIZE+npayload);
+}
+
+/*
+ * Compression stage. Gets pointer to the stage in args, compresses each chunk
+ * once and inserts the frame into all buffers of the stage.
+ */
+void * comp_stage_thread(void * args) {
+	struct comp_stage * st;
+	st = (struct comp_stage *)args;
+
+	// Mask signals
+	sigset_t sigset;
+	if (sigfillset(&sigset) == -1 ||
+		pthread_sigmask(SIG_BLOCK, &sigset, NULL)) {
+		tdprint(args, WARN, "Error in signal setup\n");
+	}
+
+	while (1) {
+		ssize_t nraw;
+		nraw = buffer_after_delete(&st->in);
+		if (nraw == BUF_END_DATA || nraw == BUF_KILL ||
+			nraw == BUF_HANDOVER) {
+
+			for (int i = 0; i < st->n_outs; i++)
+				buffer_insert(st->outs[i], NULL, nraw);
+			tdprint(args, INFO, "Compression stage ended\n");
+			pthread_exit(NULL);
+		}
+		struct chunk_meta meta;
+		size_t nframe;
+		buffer_cons_meta(&st->in, &meta);
+		nframe = 0;
+		if (nraw > 0) {
+			nframe = comp_frame(st,
+				buffer_cons_data_pointer(&st->in),
+				nraw);
+		}
+		for (int i = 0; i < st->n_outs; i++)
+			buffer_insert_meta(st->outs[i], st->frame, nframe,
+				&meta);
+	}
+	// Unreachable
+	return (NULL);
+}
+
+/*
+ * Create decompression state for an input compressed by codec.
+ *
+ * Returns the state or NULL on error.
+ */
+struct decomp * decomp_create(enum compression codec) {
+	struct decomp * dc;
+	dc = malloc(sizeof (struct decomp));
+	if (dc == NULL)
+		return (NULL);
+	dc->codec = codec;
+	dc->len = 0;
+	dc->pos = 0;
+	dc->ctx = NULL;
+	dc->data = malloc(2*comp_frame_bound(WRITE_BUFFER_BLOCK_SIZE));
+	dc->out = malloc(WRITE_BUFFER_BLOCK_SIZE);
+#ifdef HAVE_ZSTD
+	dc->ctx = ZSTD_createDCtx();
+#endif
+	if (dc->data == NULL || dc->out == NULL) {
+		decomp_free(dc);
+		return (NULL);
+	}
+	return (dc);
+}
+
+/* Free decompression state dc */
+void decomp_free(struct decomp * dc) {
+	if (dc == NULL)
+		return;
+#ifdef HAVE_ZSTD
+	ZSTD_freeDCtx(dc->ctx);
+#endif
+	free(dc->data);
+	free(dc->out);
+	free(dc);
+}
+
+/* Discard all data in decompression state dc (after reconnecting) */
+void decomp_reset(struct decomp * dc) {
+	dc->len = 0;
+	dc->pos = 0;
+}
+
+/*
+ * Append ndata bytes from data to the data to be decompressed. At most one
+ * maximal frame can be passed at once and all frames have to be taken by
+ * decomp_next before the next call.
+ *
+ * Returns 0 on success, -1 if data don't fit.
+ */
+int decomp_input(struct decomp * dc, char * data, size_t ndata) {
+	if (dc->pos > 0) {
+		memmove(dc->data, dc->data+dc->pos, dc->len-dc->pos);
+		dc->len -= dc->pos;
+		dc->pos = 0;
+	}
+	if (dc->len+ndata > 2*comp_frame_bound(WRITE_BUFFER_BLOCK_SIZE))
+		return (-1);
+	memcpy(dc->data+dc->len, data, ndata);
+	dc->len += ndata;
+	return (0);
+}
+
+/*
+ * Decompress the next complete frame. Pointer to decompressed data is stored
+ * to out.
+ *
+ * Returns length of decompressed data, DECOMP_AGAIN if more data are needed
+ * or DECOMP_ERR if data are not a valid frame.
+ */
+ssize_t decomp_next(struct decomp * dc, char ** out) {
+	size_t avail;
+	avail = dc->len-dc->pos;
+	if (avail < COMP_HEADER_SIZE)
+		return (DECOMP_AGAIN);
+	char * frame;
+	uint32_t raw_len;
+	uint32_t payload_len;
+	frame = dc->data+dc->pos;
+	if (frame[0] != 'N' || frame[1] != 'Z') {
+		dprint(WARN, "Invalid compressed frame\n");
+		return (DECOMP_ERR);
+	}
+	memcpy(&raw_len, frame+4, 4);
+	memcpy(&payload_len, frame+8, 4);
+	raw_len = ntohl(raw_len);
+	payload_len = ntohl(payload_len);
+	if (raw_len > WRITE_BUFFER_BLOCK_SIZE || payload_len >
+		comp_frame_bound(WRITE_BUFFER_BLOCK_SIZE)-COMP_HEADER_SIZE) {
+		dprint(WARN, "Compressed frame too long\n");
+		return (DECOMP_ERR);
+	}
+	if (avail < COMP_HEADER_SIZE+payload_len)
+		return (DECOMP_AGAIN);
+
+	char * payload;
+	ssize_t res;
+	payload = frame+COMP_HEADER_SIZE;
+	res = -1;
+	switch (frame[2]) {
+		case COMP_STORED:
+			if (payload_len == raw_len) {
+				*out = payload;
+				res = raw_len;
+			}
+			break;
+#ifdef HAVE_LZ4
+		case C_LZ4:
+			res = LZ4_decompress_safe(payload, dc->out, payload_len,
+				WRITE_BUFFER_BLOCK_SIZE);
+			*out = dc->out;
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case C_ZSTD: {
+			size_t zres;
+			zres = ZSTD_decompressDCtx(dc->ctx, dc->out,
+				WRITE_BUFFER_BLOCK_SIZE, payload, payload_len);
+			if (!ZSTD_isError(zres))
+				res = zres;
+			*out = dc->out;
+			break;
+		}
+#endif
+		default:
+			dprint(WARN, "Unsupported codec %d in compressed frame\n",
+				frame[2]);
+			return (DECOMP_ERR);
+	}
+	if (res != raw_len) {
+		dprint(WARN, "Decompression of a frame failed\n");
+		return (DECOMP_ERR);
+	}
+	dc->pos += COMP_HEADER_SIZE+payload_len;
+	return (res);
+}
@@ -0,0 +1,59 @@
+#ifndef COMPRESS_H
+#define	COMPRESS_H
+
+#include <pthread.h>
+#include "netstream.h"
+
+/*
+ * Every compressed chunk is sent as one frame:
+ *
+ *	offset	size	field
+ *	0	2	magic "NZ"
+ *	2	1	codec (0 - stored uncompressed, 1 - LZ4, 2 - zstd)
+ *	3	1	reserved (0)
+ *	4	4	length of uncompressed data (big endian)
+ *	8	4	length of payload (big endian)
+ *	12	...	payload
+ *
+ * Frames are independent, so a dropped frame does not break decompression
+ * of the following ones.
+ */
+#define	COMP_HEADER_SIZE 12
+#define	COMP_STORED 0
+
+#define	DECOMP_AGAIN -1
+#define	DECOMP_ERR -2
+
+// Compression stage shared by outputs with the same codec and level
+struct comp_stage {
+	enum compression codec; // Codec
+	int level; 		// Compression level
+	struct buffer in; 	// Uncompressed data from input
+	int n_outs; 		// Number of fed outputs
+	struct buffer ** outs; 	// Buffers of fed outputs
+	char * frame; 		// Space for one compressed frame
+	void * ctx; 		// Codec context
+	pthread_t thread; 	// Compressing thread
+};
+
+// Decompression state of an input
+struct decomp {
+	enum compression codec; // Expected codec
+	char * data; 		// Received, not yet decompressed data
+	size_t len; 		// Length of data
+	size_t pos; 		// Start of the next frame in data
+	char * out; 		// Decompressed data
+	void * ctx; 		// Codec context
+};
+
+int comp_supported(enum compression codec);
+size_t comp_frame_bound(size_t raw_len);
+int setup_compression(struct io_cfg * cfg);
+void * comp_stage_thread(void * args);
+struct decomp * decomp_create(enum compression codec);
+void decomp_free(struct decomp * dc);
+void decomp_reset(struct decomp * dc);
+int decomp_input(struct decomp * dc, char * data, size_t ndata);
+ssize_t decomp_next(struct decomp * dc, char ** out);
+
+#endif
@@ -1,8 +1,20 @@
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/socket.h>
 #include <yaml.h>
 
 #include "netstream.h"
 #include "conffile.h"
+#include "endpts.h"
+#include "compress.h"
+#include "tls.h"
+#include "record.h"
+#include "shmring.h"
+#include "selector.h"
+#include "spill.h"
+#include "fec.h"
+#include "repack.h"
+#include "arq.h"
 
 /* Initialize endpoint config structure */
 void endpt_config_init(struct endpt_cfg * config) {
@@ -12,31 +24,219 @@ void endpt_config_init(struct endpt_cfg * config) {
 	config->name = NULL;
 	config->port = NULL;
 	config->protocol = -1;
+	config->socktype = SOCK_STREAM;
 	config->keepalive = 0;
+	config->nodelay = 0;
+	config->sndbuf = 0;
+	config->rcvbuf = 0;
+	config->notsent_lowat = 0;
+	config->user_timeout = 0;
+	config->tos = -1;
+	config->max_unsent = 0;
+	config->mcast_ttl = -1;
+	config->mcast_loop = -1;
+	config->mcast_iface = NULL;
+	config->mcast_source = NULL;
+	config->compression = C_NONE;
+	config->comp_level = 0;
+	config->tls = 0;
+	config->tls_cert = NULL;
+	config->tls_key = NULL;
+	config->tls_ca = NULL;
+	config->tls_verify = 1;
+	config->tls_ctx = NULL;
+	config->record = 0;
+	config->rec_write_size = RECORD_WRITE_SIZE;
+	config->rec_direct = 0;
+	config->rec_prealloc = 0;
+	config->rec_rotate_size = 0;
+	config->rec_rotate_time = 0;
+	config->rec_sync_size = 0;
+	config->replay_mmap = 0;
+	config->replay_bitrate = 0;
+	config->replay_pcr = 0;
+	config->replay_loop = 0;
+	config->replay_speed = 1;
+	config->shm_slots = SHM_RING_SLOTS;
+	config->stall_timeout = SEL_STALL_TIMEOUT;
+	config->io = NULL;
+	config->spill = NULL;
+	config->spill_size = SPILL_SIZE;
+	config->framing = 0;
+	config->fec_cols = 0;
+	config->fec_rows = 0;
+	config->arq = 0;
+	config->arq_nacks = 0;
+	config->arq_resent = 0;
+	config->arq_missed = 0;
+	config->zerocopy = 0;
+	config->packet_size = 0;
+	config->packet_sync = 0;
+	config->wake_bytes = 0;
+	config->wake_delay = 0;
+	config->buf_time = 0;
+	config->priority = PRIO_NORMAL;
+	config->egress_wait = 0;
+	config->zc_sent = 0;
+	config->zc_copied = 0;
+	config->packets_sent = 0;
+	config->packet_skipped = 0;
+	config->stream_rate = 0;
+	config->probe_size = 0;
+	config->probe_rtt = -1;
+	config->probe_rate = -1;
+	config->retry_delay = RETRY_DELAY;
+	config->failures = 0;
+	config->recoveries = 0;
+	config->fail_since = 0;
+	config->recover_ns = 0;
+	config->recover_max = 0;
+	config->ho_listenfd = -1;
+	config->ho_fd = -1;
+	config->ho_carry = NULL;
+	config->ho_ncarry = 0;
+	config->ho_addrlen = 0;
+	memset(&config->fstats, 0, sizeof (config->fstats));
+	memset(config->perf, 0, sizeof (config->perf));
+	config->perf_hw = 0;
 	config->exit_status = -255;
 }
 
 /*
- * Initialize I/O config structure with nouts outputs
+ * Initialize I/O config structure with space for nitems outputs. More outputs
+ * can be added by io_config_add.
  *
  * Returns 0 on success, -1 if allocation fails.
  */
 int io_config_init(struct io_cfg * config, int nitems) {
-	config->n_outs = nitems;
+	config->n_outs = 0;
+	config->size_outs = nitems;
 	config->outs = malloc(sizeof (struct endpt_cfg)*nitems);
-	config->input = malloc(sizeof (struct endpt_cfg));
-	if (config->outs == NULL || (config->input == NULL)) {
+	config->n_inputs = 0;
+	config->input = NULL;
+	config->sel = NULL;
+	if (config->outs == NULL) {
 		dprint(WARN, "Failed to allocate memory in %s\n", __FUNCTION__);
-		free(config);
 		return (-1);
 	}
 	return (0);
 }
 
+/*
+ * Add a new endpoint to I/O config, the array of outputs grows as needed.
+ *
+ * Returns pointer to initialized endpoint config or NULL if allocation fails.
+ */
+static struct endpt_cfg * io_config_add(struct io_cfg * config) {
+	if (config->n_outs == config->size_outs) {
+		struct endpt_cfg * outs;
+		outs = realloc(config->outs,
+			sizeof (struct endpt_cfg)*config->size_outs*2);
+		if (outs == NULL) {
+			dprint(WARN, "Failed to allocate memory in %s\n",
+				__FUNCTION__);
+			return (NULL);
+		}
+		config->outs = outs;
+		config->size_outs *= 2;
+	}
+	struct endpt_cfg * endpt;
+	endpt = &config->outs[config->n_outs++];
+	endpt_config_init(endpt);
+	return (endpt);
+}
+
 static void inv_val_warn(char * val, char * key) {
 	dprint(WARN, "Invalid value \"%s\" for key \"%s\"\n", val, key);
 }
 
+/* Returns newly allocated copy of value */
+static char * copy_value(char * value) {
+	char * copy;
+	copy = malloc(sizeof (char)*(strlen(value)+1));
+	if (copy != NULL)
+		strcpy(copy, value);
+	return (copy);
+}
+
+/*
+ * Parse number with optional suffix K, M or G (powers of unit) into result.
+ *
+ * Returns 0 on success, -1 if value is not a valid number.
+ */
+int parse_scaled(char * value, long long unit, long long * result) {
+	char * end;
+	long long size;
+	size = strtoll(value, &end, 10);
+	if (end == value || size < 0)
+		return (-1);
+	switch (*end) {
+		case 'G':
+			size *= unit;
+		case 'M':
+			size *= unit;
+		case 'K':
+			size *= unit;
+			end++;
+		case '\0':
+			break;
+		default:
+			return (-1);
+	}
+	if (*end != '\0')
+		return (-1);
+	*result = size;
+	return (0);
+}
+
+/*
+ * Parse size with optional suffix K, M or G (powers of 1024) into result.
+ *
+ * Returns 0 on success, -1 if value is not a valid size.
+ */
+static int parse_size(char * value, off_t * result) {
+	long long size;
+	if (parse_scaled(value, 1024, &size) == -1)
+		return (-1);
+	*result = size;
+	return (0);
+}
+
+/*
+ * Parse time in milliseconds with suffix ms or s into result.
+ *
+ * Returns 0 on success, -1 if value is not a valid time.
+ */
+static int parse_time_ms(char * value, int * result) {
+	char * end;
+	long t;
+	t = strtol(value, &end, 10);
+	if (end == value || t <= 0)
+		return (-1);
+	if (strcmp(end, "s") == 0 && t <= INT_MAX/1000)
+		t *= 1000;
+	else if (strcmp(end, "ms") != 0 || t > INT_MAX)
+		return (-1);
+	*result = t;
+	return (0);
+}
+
+/*
+ * Parse yes/no value into result.
+ *
+ * Returns 0 on success, -1 if value is neither yes nor no.
+ */
+static int parse_yesno(char * value, int * result) {
+	if (strcmp(value, "yes") == 0) {
+		*result = 1;
+	} else if (strcmp(value, "no") == 0) {
+		*result = 0;
+	} else  {
+		return (-1);
+	}
+	return (0);
+}
+
 /*
  * Set item with name key to value value in endpoint config config.
  *
@@ -61,6 +261,14 @@ int endpt_config_set_item(struct endpt_cfg * config, char * key, char * value) {
 			config->type = T_FILE;
 		} else if (strcmp(value, "std") == 0) {
 			config->type = T_STD;
+		} else if (strcmp(value, "unix") == 0) {
+			config->type = T_UNIX;
+		} else if (strcmp(value, "fifo") == 0) {
+			config->type = T_FIFO;
+		} else if (strcmp(value, "shm") == 0) {
+			config->type = T_SHM;
+		} else if (strcmp(value, "pcap") == 0) {
+			config->type = T_PCAP;
 		} else  {
 			inv_val_warn(value, key);
 			return (-1);
@@ -77,6 +285,17 @@ int endpt_config_set_item(struct endpt_cfg * config, char * key, char * value) {
 			inv_val_warn(value, key);
 			return (-1);
 		}
+	// Delay between tries in ms
+	} else if (strcmp(key, "RetryDelay") == 0) {
+		char * end;
+		long delay = strtol(value, &end, 10);
+		if (*end != '\0' || end == value || delay < 0 ||
+			delay > INT_MAX) {
+
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->retry_delay = delay;
 	// Name
 	} else if (strcmp(key, "Name") == 0) {
 		size_t len = strlen(value)+1;
@@ -97,6 +316,12 @@ int endpt_config_set_item(struct endpt_cfg * config, char * key, char * value) {
 			config->protocol = IPPROTO_TCP;
 		} else if (strcmp(value, "UDP") == 0) {
 			config->protocol = IPPROTO_UDP;
+		} else if (strcmp(value, "stream") == 0) {
+			config->socktype = SOCK_STREAM;
+		} else if (strcmp(value, "dgram") == 0) {
+			config->socktype = SOCK_DGRAM;
+		} else if (strcmp(value, "seqpacket") == 0) {
+			config->socktype = SOCK_SEQPACKET;
 		} else  {
 			inv_val_warn(value, key);
 			return (-1);
@@ -109,7 +334,329 @@ int endpt_config_set_item(struct endpt_cfg * config, char * key, char * value) {
 			return (-1);
 		}
 		config->keepalive = keepalive;
+	// Disable Nagle algorithm
+	} else if (strcmp(key, "NoDelay") == 0) {
+		if (parse_yesno(value, &config->nodelay) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Socket buffer sizes and TCP queue limits
+	} else if (strcmp(key, "SndBuf") == 0 || strcmp(key, "RcvBuf") == 0 ||
+		strcmp(key, "NotSentLowat") == 0 ||
+		strcmp(key, "MaxUnsent") == 0) {
+
+		off_t size;
+		if (parse_size(value, &size) == -1 || size > INT_MAX) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		if (strcmp(key, "SndBuf") == 0)
+			config->sndbuf = size;
+		else if (strcmp(key, "RcvBuf") == 0)
+			config->rcvbuf = size;
+		else if (strcmp(key, "NotSentLowat") == 0)
+			config->notsent_lowat = size;
+		else
+			config->max_unsent = size;
+	// TCP user timeout
+	} else if (strcmp(key, "UserTimeout") == 0) {
+		char * end;
+		long timeout = strtol(value, &end, 10);
+		if (*end != '\0' || timeout < 0 || timeout > INT_MAX) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->user_timeout = timeout;
+	// Type of service
+	} else if (strcmp(key, "TOS") == 0) {
+		char * end;
+		long tos = strtol(value, &end, 0);
+		if (*end != '\0' || tos < 0 || tos > 255) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->tos = tos;
+	// Multicast TTL
+	} else if (strcmp(key, "MulticastTTL") == 0) {
+		char * end;
+		long ttl = strtol(value, &end, 10);
+		if (*end != '\0' || ttl < 0 || ttl > 255) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->mcast_ttl = ttl;
+	// Multicast loopback
+	} else if (strcmp(key, "MulticastLoop") == 0) {
+		if (parse_yesno(value, &config->mcast_loop) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Multicast interface
+	} else if (strcmp(key, "MulticastInterface") == 0) {
+		config->mcast_iface = copy_value(value);
+	// Multicast source
+	} else if (strcmp(key, "MulticastSource") == 0) {
+		config->mcast_source = copy_value(value);
+	// Compression
+	} else if (strcmp(key, "Compression") == 0) {
+		if (strcmp(value, "none") == 0) {
+			config->compression = C_NONE;
+		} else if (strcmp(value, "lz4") == 0) {
+			config->compression = C_LZ4;
+		} else if (strcmp(value, "zstd") == 0) {
+			config->compression = C_ZSTD;
+		} else  {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Compression level
+	} else if (strcmp(key, "CompressionLevel") == 0) {
+		char * end;
+		config->comp_level = strtol(value, &end, 10);
+		if (*end != '\0') {
+			inv_val_warn(value, key);
+			return (-1);
+		}
 
+	// TLS
+	} else if (strcmp(key, "TLS") == 0) {
+		if (parse_yesno(value, &config->tls) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// TLS certificate
+	} else if (strcmp(key, "Certificate") == 0) {
+		config->tls_cert = copy_value(value);
+	// TLS private key
+	} else if (strcmp(key, "PrivateKey") == 0) {
+		config->tls_key = copy_value(value);
+	// TLS CA file
+	} else if (strcmp(key, "CAFile") == 0) {
+		config->tls_ca = copy_value(value);
+	// TLS peer verification
+	} else if (strcmp(key, "TLSVerify") == 0) {
+		if (parse_yesno(value, &config->tls_verify) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Recording mode
+	} else if (strcmp(key, "Record") == 0) {
+		if (parse_yesno(value, &config->record) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Size of recording writes
+	} else if (strcmp(key, "WriteSize") == 0) {
+		off_t size;
+		if (parse_size(value, &size) == -1 || size == 0) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->rec_write_size = size;
+	// Recording with O_DIRECT
+	} else if (strcmp(key, "Direct") == 0) {
+		if (parse_yesno(value, &config->rec_direct) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Preallocation step
+	} else if (strcmp(key, "Preallocate") == 0) {
+		if (parse_size(value, &config->rec_prealloc) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Segment size
+	} else if (strcmp(key, "RotateSize") == 0) {
+		if (parse_size(value, &config->rec_rotate_size) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Segment age
+	} else if (strcmp(key, "RotateTime") == 0) {
+		int rotate_time = strtol(value, NULL, 10);
+		if (rotate_time < 0) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->rec_rotate_time = rotate_time;
+	// Sync policy
+	} else if (strcmp(key, "SyncSize") == 0) {
+		if (parse_size(value, &config->rec_sync_size) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Replay from memory mapping
+	} else if (strcmp(key, "Mmap") == 0) {
+		if (parse_yesno(value, &config->replay_mmap) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Replay bitrate
+	} else if (strcmp(key, "Bitrate") == 0) {
+		if (parse_scaled(value, 1000, &config->replay_bitrate) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Replay pacing
+	} else if (strcmp(key, "Pacing") == 0) {
+		if (strcmp(value, "bitrate") == 0) {
+			config->replay_pcr = 0;
+		} else if (strcmp(value, "pcr") == 0) {
+			config->replay_pcr = 1;
+		} else  {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Replay in a loop
+	} else if (strcmp(key, "Loop") == 0) {
+		if (parse_yesno(value, &config->replay_loop) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Speed of capture replay
+	} else if (strcmp(key, "Speed") == 0) {
+		char * end;
+		double speed = strtod(value, &end);
+		if (*end != '\0' || end == value || !(speed >= 0)) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->replay_speed = speed;
+	// Slots of shared memory ring
+	} else if (strcmp(key, "Slots") == 0) {
+		char * end;
+		long slots = strtol(value, &end, 10);
+		if (*end != '\0' || slots < 2 || slots > 1048576) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->shm_slots = slots;
+	// Spill file of output
+	} else if (strcmp(key, "Spill") == 0) {
+		config->spill = copy_value(value);
+		if (config->spill == NULL)
+			return (-1);
+	// Size of spill file
+	} else if (strcmp(key, "SpillSize") == 0) {
+		off_t size;
+		if (parse_size(value, &size) == -1 || size < SPILL_MIN_SIZE) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->spill_size = size;
+	// Stall timeout of redundant input
+	} else if (strcmp(key, "StallTimeout") == 0) {
+		char * end;
+		long timeout = strtol(value, &end, 10);
+		if (*end != '\0' || timeout <= 0 || timeout > INT_MAX) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->stall_timeout = timeout;
+	// Frames with sequence numbers on the wire
+	} else if (strcmp(key, "Framing") == 0) {
+		if (parse_yesno(value, &config->framing) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// FEC matrix, columns x rows
+	} else if (strcmp(key, "FEC") == 0) {
+		char * end;
+		long cols;
+		long rows;
+		cols = strtol(value, &end, 10);
+		rows = 1;
+		if (*end == 'x')
+			rows = strtol(end+1, &end, 10);
+		if (*end != '\0' || cols < 1 || cols > FEC_MAX_DIM ||
+			rows < 1 || rows > FEC_MAX_DIM ||
+			cols*rows > FEC_MAX_MATRIX || cols*rows == 1) {
+
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->fec_cols = cols;
+		config->fec_rows = rows;
+	// Retransmission of lost frames, window or latency budget in ms
+	} else if (strcmp(key, "ARQ") == 0) {
+		char * end;
+		long ms = strtol(value, &end, 10);
+		if (*end != '\0' || ms <= 0 || ms > ARQ_MAX_TIME) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->arq = ms;
+	// Size of datagrams of UDP output
+	} else if (strcmp(key, "Packet") == 0) {
+		off_t size;
+		if (parse_size(value, &size) == -1 || size == 0 ||
+			size > UDP_MAX_PAYLOAD) {
+
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->packet_size = size;
+	// Start datagrams at sync bytes of transport stream
+	} else if (strcmp(key, "PacketSync") == 0) {
+		if (parse_yesno(value, &config->packet_sync) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Wake output only for this many bytes
+	} else if (strcmp(key, "WakeBytes") == 0) {
+		off_t size;
+		if (parse_size(value, &size) == -1 || size == 0) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->wake_bytes = size;
+	// Wake output when the oldest chunk waits for this time in us
+	} else if (strcmp(key, "WakeDelay") == 0) {
+		char * end;
+		long delay = strtol(value, &end, 10);
+		if (*end != '\0' || delay <= 0 || delay > INT_MAX) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->wake_delay = delay;
+	// Buffer time of stream
+	} else if (strcmp(key, "Buffer") == 0) {
+		if (parse_time_ms(value, &config->buf_time) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Priority class of output
+	} else if (strcmp(key, "Priority") == 0) {
+		if (strcmp(value, "high") == 0) {
+			config->priority = PRIO_HIGH;
+		} else if (strcmp(value, "normal") == 0) {
+			config->priority = PRIO_NORMAL;
+		} else if (strcmp(value, "low") == 0) {
+			config->priority = PRIO_LOW;
+		} else  {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Send with MSG_ZEROCOPY
+	} else if (strcmp(key, "ZeroCopy") == 0) {
+		if (parse_yesno(value, &config->zerocopy) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Expected bitrate of the stream, checked by -t
+	} else if (strcmp(key, "StreamRate") == 0) {
+		if (parse_scaled(value, 1000, &config->stream_rate) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+	// Size of burst measuring throughput in -t
+	} else if (strcmp(key, "Probe") == 0) {
+		off_t size;
+		if (parse_size(value, &size) == -1) {
+			inv_val_warn(value, key);
+			return (-1);
+		}
+		config->probe_size = size;
 	} else  {
 		dprint(NOTICE, "Unknown key \"%s\"\n", key);
 		return (0);
@@ -117,108 +664,494 @@ int endpt_config_set_item(struct endpt_cfg * config, char * key, char * value) {
 	return (0);
 }
 
+// Key-value pairs of one mapping in config file, list values are repeated
+struct cfg_map {
+	int n; 			// Number of pairs
+	int size; 		// Allocated pairs
+	char ** keys; 		// Keys
+	char ** values; 	// Values
+};
+
+// Named set of keys, which endpoints can inherit
+struct cfg_profile {
+	char * name; 		// Name of the profile
+	struct cfg_map map; 	// Keys of the profile
+};
+
+// State of config file parser
+struct cfg_parser {
+	yaml_parser_t parser; 	// Event parser
+	struct io_cfg * config; // Parsed config
+	int n_profiles; 	// Number of profiles
+	int size_profiles; 	// Allocated profiles
+	struct cfg_profile * profiles; // Defined profiles
+};
+
 /*
- * Find the input in config. In config file input is not needed to be first,
- * this function returns pointer to first input defined in config file or NULL
- * if none is defined.
+ * Append key with value to map.
+ *
+ * Returns 0 on success, -1 if allocation fails.
  */
-static struct endpt_cfg * get_read_endpt(struct io_cfg * cfg) {
-	for (int i = 0; i < cfg->n_outs; i++) {
-		if (cfg->outs[i].dir == DIR_INPUT)
-			return (&cfg->outs[i]);
+static int map_add(struct cfg_map * map, char * key, char * value) {
+	if (map->n == map->size) {
+		int size;
+		char ** keys;
+		char ** values;
+		size = map->size == 0 ? 16 : map->size*2;
+		keys = realloc(map->keys, sizeof (char *)*size);
+		if (keys != NULL)
+			map->keys = keys;
+		values = realloc(map->values, sizeof (char *)*size);
+		if (values != NULL)
+			map->values = values;
+		if (keys == NULL || values == NULL)
+			return (-1);
+		map->size = size;
+	}
+	map->keys[map->n] = copy_value(key);
+	map->values[map->n] = copy_value(value);
+	if (map->keys[map->n] == NULL || map->values[map->n] == NULL)
+		return (-1);
+	map->n++;
+	return (0);
+}
+
+/* Free all pairs of map */
+static void map_free(struct cfg_map * map) {
+	for (int i = 0; i < map->n; i++) {
+		free(map->keys[i]);
+		free(map->values[i]);
+	}
+	free(map->keys);
+	free(map->values);
+	map->n = 0;
+	map->size = 0;
+	map->keys = NULL;
+	map->values = NULL;
+}
+
+/* Returns value of the last key in map or NULL if key is not present */
+static char * map_get(struct cfg_map * map, char * key) {
+	for (int i = map->n-1; i >= 0; i--) {
+		if (strcmp(map->keys[i], key) == 0)
+			return (map->values[i]);
 	}
 	return (NULL);
+}
+
+/* Returns 1 if key is not an endpoint key, but a key of templates */
+static int template_key(char * key) {
+	return (strcmp(key, "Profile") == 0 || strcmp(key, "Inherit") == 0 ||
+		strcmp(key, "Names") == 0 || strcmp(key, "Ports") == 0);
+}
+
+/* Print error at position of the last event of parser p */
+static void parse_err(struct cfg_parser * p, yaml_event_t * event,
+	char * msg) {
 
+	dprint(ERR, "Config line %zu: %s\n", event->start_mark.line+1, msg);
 }
 
 /*
- * Parse config file from given filename into given config structure
+ * Parse the rest of a mapping into map. Values are scalars or sequences of
+ * scalars, each item of a sequence is added as a separate pair.
  *
  * Returns 0 on success, -1 on error.
  */
-// TODO dealokace pri nepovedenem cteni konfigurace
-int parse_config_file(struct io_cfg * config, char * filename) {
-	yaml_parser_t parser;
-	yaml_document_t document;
-
-	FILE * cfg_file;
-	cfg_file = fopen(filename, "r");
-	if (cfg_file == NULL) {
-		dprint(CRIT, "Could not open config file \"%s\"\n", filename);
-		return (-1);
+static int parse_mapping(struct cfg_parser * p, struct cfg_map * map) {
+	yaml_event_t event;
+	char * key;
+	int in_seq;
+	key = NULL;
+	in_seq = 0;
+	while (1) {
+		if (!yaml_parser_parse(&p->parser, &event)) {
+			dprint(ERR, "Config line %zu: %s\n",
+				p->parser.problem_mark.line+1,
+				p->parser.problem);
+			free(key);
+			return (-1);
+		}
+		int res;
+		res = 0;
+		switch (event.type) {
+			case YAML_MAPPING_END_EVENT:
+				yaml_event_delete(&event);
+				free(key);
+				return (0);
+			case YAML_SCALAR_EVENT:
+				if (key == NULL) {
+					key = copy_value(
+						(char *)event.data.scalar.value);
+					break;
+				}
+				res = map_add(map, key,
+					(char *)event.data.scalar.value);
+				if (!in_seq) {
+					free(key);
+					key = NULL;
+				}
+				break;
+			case YAML_SEQUENCE_START_EVENT:
+				if (key == NULL || in_seq) {
+					parse_err(p, &event, "Unexpected sequence");
+					res = -1;
+				}
+				in_seq = 1;
+				break;
+			case YAML_SEQUENCE_END_EVENT:
+				in_seq = 0;
+				free(key);
+				key = NULL;
+				break;
+			default:
+				parse_err(p, &event, "Unexpected value");
+				res = -1;
+				break;
+		}
+		yaml_event_delete(&event);
+		if (res == -1) {
+			free(key);
+			return (-1);
+		}
 	}
+}
 
-	yaml_parser_initialize(&parser);
-	yaml_parser_set_input_file(&parser, cfg_file);
-
-	if (!yaml_parser_load(&parser, &document)) {
-		dprint(ERR, "Could not load config file to YAML parser "
-			"(probably syntax error)\n");
-		return (-1);
+/* Returns profile with name or NULL if it is not defined */
+static struct cfg_profile * find_profile(struct cfg_parser * p, char * name) {
+	for (int i = 0; i < p->n_profiles; i++) {
+		if (strcmp(p->profiles[i].name, name) == 0)
+			return (&p->profiles[i]);
 	}
-	fclose(cfg_file);
+	return (NULL);
+}
 
-	yaml_node_t * root;
-	root = yaml_document_get_root_node(&document);
-	if (root->type != YAML_SEQUENCE_NODE) {
-		dprint(ERR, "Wrong type of YAML root node "
-			"(must be sequence)\n");
+/*
+ * Define a profile from map. Keys of the inherited profile are copied first.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int add_profile(struct cfg_parser * p, struct cfg_map * map) {
+	char * name;
+	char * inherit;
+	name = map_get(map, "Profile");
+	inherit = map_get(map, "Inherit");
+	if (find_profile(p, name) != NULL) {
+		dprint(ERR, "Profile %s defined twice\n", name);
 		return (-1);
 	}
-
-	size_t items;
-	items = (root->data.sequence.items.top -
-		root->data.sequence.items.start);
-	if (io_config_init(config, items) == -1) {
-		dprint(CRIT, "Error while initializing config structure\n");
-		return (-1);
+	if (p->n_profiles == p->size_profiles) {
+		struct cfg_profile * profiles;
+		int size;
+		size = p->size_profiles == 0 ? 8 : p->size_profiles*2;
+		profiles = realloc(p->profiles,
+			sizeof (struct cfg_profile)*size);
+		if (profiles == NULL)
+			return (-1);
+		p->profiles = profiles;
+		p->size_profiles = size;
 	}
-	yaml_node_item_t * endpt = root->data.sequence.items.start;
+	struct cfg_profile * prof;
+	prof = &p->profiles[p->n_profiles];
+	memset(prof, 0, sizeof (struct cfg_profile));
+	if (inherit != NULL) {
+		struct cfg_profile * parent;
+		parent = find_profile(p, inherit);
+		if (parent == NULL) {
+			dprint(ERR, "Profile %s not defined before use\n",
+				inherit);
+			return (-1);
+		}
+		for (int i = 0; i < parent->map.n; i++) {
+			if (map_add(&prof->map, parent->map.keys[i],
+				parent->map.values[i]) == -1) {
+				return (-1);
+			}
+		}
+	}
+	for (int i = 0; i < map->n; i++) {
+		if (strcmp(map->keys[i], "Profile") == 0 ||
+			strcmp(map->keys[i], "Inherit") == 0) {
+			continue;
+		}
+		if (map_add(&prof->map, map->keys[i], map->values[i]) == -1)
+			return (-1);
+	}
+	prof->name = copy_value(name);
+	p->n_profiles++;
+	return (0);
+}
+
+/*
+ * Collect values of list key from own map, or from profile if the endpoint
+ * does not have the key. Ports are ranges "first-last" or single ports.
+ *
+ * Returns number of values stored to values (0 if the key is not used) or
+ * -1 on error.
+ */
+static int collect_list(struct cfg_map * own, struct cfg_map * prof,
+	char * key, char *** values) {
 
-	for (int i = 0; i < items; i++) {
-		yaml_node_t * ep_params;
-		ep_params = yaml_document_get_node(&document, *endpt);
-		if (ep_params->type != YAML_MAPPING_NODE) {
-			dprint(ERR, "Wrong type of YAML sequence node "
-				"(must be mapping)\n");
+	struct cfg_map * map;
+	map = own;
+	if (map_get(own, key) == NULL && prof != NULL)
+		map = prof;
+	int n;
+	n = 0;
+	*values = NULL;
+	for (int i = 0; i < map->n; i++) {
+		if (strcmp(map->keys[i], key) != 0)
+			continue;
+		long first;
+		long last;
+		char * end;
+		first = 0;
+		last = 0;
+		if (strcmp(key, "Ports") == 0) {
+			first = strtol(map->values[i], &end, 10);
+			last = first;
+			if (*end == '-')
+				last = strtol(end+1, &end, 10);
+			if (*end != '\0' || first < 0 || last > 65535 ||
+				first > last) {
+				inv_val_warn(map->values[i], key);
+				return (-1);
+			}
+		}
+		char ** new_values;
+		new_values = realloc(*values, sizeof (char *)*(n+last-first+1));
+		if (new_values == NULL)
 			return (-1);
+		*values = new_values;
+		if (strcmp(key, "Ports") != 0) {
+			(*values)[n++] = map->values[i];
+			continue;
+		}
+		for (long port = first; port <= last; port++) {
+			char buf[8];
+			snprintf(buf, sizeof (buf), "%ld", port);
+			(*values)[n++] = copy_value(buf);
 		}
+	}
+	return (n);
+}
 
-		endpt_config_init(&config->outs[i]);
+/*
+ * Apply keys of map to endpoint config endpt, template keys are skipped.
+ *
+ * Returns 0 on success, -1 if a value is invalid.
+ */
+static int apply_map(struct endpt_cfg * endpt, struct cfg_map * map) {
+	for (int i = 0; i < map->n; i++) {
+		if (template_key(map->keys[i]))
+			continue;
+		if (endpt_config_set_item(endpt, map->keys[i],
+			map->values[i]) == -1) {
+			return (-1);
+		}
+	}
+	return (0);
+}
 
-		for (yaml_node_pair_t * ep_par =
-			ep_params->data.mapping.pairs.start;
-			ep_par < ep_params->data.mapping.pairs.top; ep_par++) {
+/*
+ * Add endpoints described by map. The endpoint inherits keys of a profile and
+ * it is expanded into one endpoint for each combination of Names and Ports.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int add_endpoints(struct cfg_parser * p, struct cfg_map * map) {
+	struct cfg_map * prof;
+	char * inherit;
+	prof = NULL;
+	inherit = map_get(map, "Inherit");
+	if (inherit != NULL) {
+		struct cfg_profile * profile;
+		profile = find_profile(p, inherit);
+		if (profile == NULL) {
+			dprint(ERR, "Profile %s not defined before use\n",
+				inherit);
+			return (-1);
+		}
+		prof = &profile->map;
+	}
 
-			yaml_node_t * key;
-			yaml_node_t * value;
-			key = yaml_document_get_node(&document, ep_par->key);
-			value = yaml_document_get_node(&document,
-				ep_par->value);
-			if (endpt_config_set_item(&config->outs[i],
-				(char *)key->data.scalar.value,
-				(char *)value->data.scalar.value) == -1) {
-				dprint(ERR, "Error when parsing config\n");
-				return (-1);
+	char ** names;
+	char ** ports;
+	int n_names;
+	int n_ports;
+	int res;
+	res = -1;
+	ports = NULL;
+	n_names = collect_list(map, prof, "Names", &names);
+	n_ports = collect_list(map, prof, "Ports", &ports);
+	if (n_names == -1 || n_ports == -1)
+		goto add_end;
+	for (int i = 0; i < (n_names > 0 ? n_names : 1); i++) {
+		for (int j = 0; j < (n_ports > 0 ? n_ports : 1); j++) {
+			struct endpt_cfg * endpt;
+			endpt = io_config_add(p->config);
+			if (endpt == NULL)
+				goto add_end;
+			if (prof != NULL && apply_map(endpt, prof) == -1)
+				goto add_end;
+			if (apply_map(endpt, map) == -1)
+				goto add_end;
+			if (n_names > 0 && endpt_config_set_item(endpt, "Name",
+				names[i]) == -1) {
+				goto add_end;
+			}
+			if (n_ports > 0 && endpt_config_set_item(endpt, "Port",
+				ports[j]) == -1) {
+				goto add_end;
 			}
 		}
-		endpt++;
+	}
+	res = 0;
+add_end:
+	for (int j = 0; j < n_ports; j++)
+		free(ports[j]);
+	free(ports);
+	free(names);
+	return (res);
+}
 
+/*
+ * Move inputs from the array of endpoints to the array of inputs of config.
+ * In config file inputs are not needed to be first, their order is kept.
+ *
+ * Returns number of inputs or -1 if allocation fails.
+ */
+static int move_inputs(struct io_cfg * cfg) {
+	int n;
+	n = 0;
+	for (int i = 0; i < cfg->n_outs; i++) {
+		if (cfg->outs[i].dir == DIR_INPUT)
+			n++;
+	}
+	if (n == 0)
+		return (0);
+	cfg->input = malloc(sizeof (struct endpt_cfg)*n);
+	if (cfg->input == NULL) {
+		dprint(WARN, "Failed to allocate memory in %s\n", __FUNCTION__);
+		return (-1);
+	}
+	int n_outs;
+	n_outs = 0;
+	for (int i = 0; i < cfg->n_outs; i++) {
+		if (cfg->outs[i].dir == DIR_INPUT)
+			cfg->input[cfg->n_inputs++] = cfg->outs[i];
+		else
+			cfg->outs[n_outs++] = cfg->outs[i];
 	}
+	cfg->n_outs = n_outs;
+	return (n);
 
-	struct endpt_cfg * read_endpt;
-	read_endpt = get_read_endpt(config);
-	if (read_endpt == NULL) {
-		dprint(CRIT, "No input defined\n");
+}
+
+/*
+ * Parse config file from given filename into given config structure. The
+ * file is parsed as a stream of events, each mapping is turned into endpoints
+ * (or a profile) as soon as it is read.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int parse_config_file(struct io_cfg * config, char * filename) {
+	FILE * cfg_file;
+	cfg_file = fopen(filename, "r");
+	if (cfg_file == NULL) {
+		dprint(CRIT, "Could not open config file \"%s\"\n", filename);
+		return (-1);
+	}
+	if (io_config_init(config, 16) == -1) {
+		dprint(CRIT, "Error while initializing config structure\n");
+		fclose(cfg_file);
 		return (-1);
 	}
-	*(config->input) = *(read_endpt);
-	for (int i = 0; i < config->n_outs-1; i++) {
-		if (config->outs+i >= read_endpt) {
-			config->outs[i] = config->outs[i+1];
+
+	struct cfg_parser p;
+	memset(&p, 0, sizeof (p));
+	p.config = config;
+	yaml_parser_initialize(&p.parser);
+	yaml_parser_set_input_file(&p.parser, cfg_file);
+
+	int res;
+	int depth;
+	res = 0;
+	depth = 0;
+	while (res == 0) {
+		yaml_event_t event;
+		if (!yaml_parser_parse(&p.parser, &event)) {
+			dprint(ERR, "Config line %zu: %s\n",
+				p.parser.problem_mark.line+1,
+				p.parser.problem);
+			res = -1;
+			break;
+		}
+		if (event.type == YAML_STREAM_END_EVENT) {
+			yaml_event_delete(&event);
+			break;
 		}
+		switch (event.type) {
+			case YAML_SEQUENCE_START_EVENT:
+				if (depth++ != 0) {
+					parse_err(&p, &event,
+						"Unexpected sequence");
+					res = -1;
+				}
+				break;
+			case YAML_SEQUENCE_END_EVENT:
+				depth--;
+				break;
+			case YAML_MAPPING_START_EVENT: {
+				if (depth != 1) {
+					parse_err(&p, &event, "Wrong type of "
+						"YAML root node (must be "
+						"sequence)");
+					res = -1;
+					break;
+				}
+				struct cfg_map map;
+				memset(&map, 0, sizeof (map));
+				res = parse_mapping(&p, &map);
+				if (res == 0 && map_get(&map, "Profile") != NULL)
+					res = add_profile(&p, &map);
+				else if (res == 0)
+					res = add_endpoints(&p, &map);
+				if (res == -1)
+					parse_err(&p, &event, "Error when "
+						"parsing endpoint");
+				map_free(&map);
+				break;
+			}
+			case YAML_SCALAR_EVENT:
+				parse_err(&p, &event, "Wrong type of YAML "
+					"sequence node (must be mapping)");
+				res = -1;
+				break;
+			default:
+				break;
+		}
+		yaml_event_delete(&event);
 	}
-	config->n_outs--;
+	yaml_parser_delete(&p.parser);
+	fclose(cfg_file);
+	for (int i = 0; i < p.n_profiles; i++) {
+		free(p.profiles[i].name);
+		map_free(&p.profiles[i].map);
+	}
+	free(p.profiles);
+	if (res == -1)
+		return (-1);
+
+	res = move_inputs(config);
+	if (res == 0) {
+		dprint(CRIT, "No input defined\n");
+		return (-1);
+	} else if (res == -1) {
+		return (-1);
+	}
+	for (int i = 0; i < config->n_inputs; i++)
+		config->input[i].io = config;
 
 	return (0);
 }
@@ -251,6 +1184,18 @@ void print_config(struct io_cfg * cfg) {
 			case T_STD:
 				printf("stdin/stdout\n");
 				break;
+			case T_UNIX:
+				printf("unix\n");
+				break;
+			case T_FIFO:
+				printf("fifo\n");
+				break;
+			case T_SHM:
+				printf("shm\n");
+				break;
+			case T_PCAP:
+				printf("pcap\n");
+				break;
 			case T_INVAL:
 				printf("-\n");
 				break;
@@ -270,6 +1215,7 @@ void print_config(struct io_cfg * cfg) {
 				printf("kill\n");
 				break;
 		}
+		printf("	RetryDelay: %d\n", cfg->outs[i].retry_delay);
 		printf("	Name: %s\n", cfg->outs[i].name);
 		printf("	Port: %s\n", cfg->outs[i].port);
 		printf("	Protocol: ");
@@ -284,74 +1230,172 @@ void print_config(struct io_cfg * cfg) {
 				printf("-\n");
 				break;
 		}
+		printf("	Socket type: %d\n", cfg->outs[i].socktype);
 		printf("	Keepalive: %d\n", cfg->outs[i].keepalive);
+		printf("	NoDelay: %d, SndBuf: %d, RcvBuf: %d, "
+			"NotSentLowat: %d, UserTimeout: %d, TOS: %d, "
+			"MaxUnsent: %d\n",
+			cfg->outs[i].nodelay,
+			cfg->outs[i].sndbuf,
+			cfg->outs[i].rcvbuf,
+			cfg->outs[i].notsent_lowat,
+			cfg->outs[i].user_timeout,
+			cfg->outs[i].tos,
+			cfg->outs[i].max_unsent);
+		printf("	MulticastTTL: %d\n", cfg->outs[i].mcast_ttl);
+		printf("	MulticastLoop: %d\n", cfg->outs[i].mcast_loop);
+		printf("	MulticastInterface: %s\n", cfg->outs[i].mcast_iface);
+		printf("	MulticastSource: %s\n", cfg->outs[i].mcast_source);
+		printf("	Compression: %d (level %d)\n",
+			cfg->outs[i].compression,
+			cfg->outs[i].comp_level);
+		printf("	TLS: %d (verify %d)\n", cfg->outs[i].tls,
+			cfg->outs[i].tls_verify);
+		printf("	Certificate: %s\n", cfg->outs[i].tls_cert);
+		printf("	PrivateKey: %s\n", cfg->outs[i].tls_key);
+		printf("	CAFile: %s\n", cfg->outs[i].tls_ca);
+		printf("	Slots: %d\n", cfg->outs[i].shm_slots);
+		printf("	Spill: %s (size %zu)\n", cfg->outs[i].spill,
+			cfg->outs[i].spill_size);
+		printf("	Framing: %d, FEC: %dx%d, ARQ: %d\n",
+			cfg->outs[i].framing,
+			cfg->outs[i].fec_cols,
+			cfg->outs[i].fec_rows,
+			cfg->outs[i].arq);
+		printf("	ZeroCopy: %d\n", cfg->outs[i].zerocopy);
+		printf("	Packet: %zu, PacketSync: %d\n",
+			cfg->outs[i].packet_size,
+			cfg->outs[i].packet_sync);
+		printf("	WakeBytes: %zu, WakeDelay: %d\n",
+			cfg->outs[i].wake_bytes,
+			cfg->outs[i].wake_delay);
+		printf("	Probe: %zu\n", cfg->outs[i].probe_size);
+		printf("	Buffer: %d ms\n", cfg->outs[i].buf_time);
+		printf("	Priority: %d\n", cfg->outs[i].priority);
+		printf("	Record: %d (write %zu, direct %d, prealloc %lld, "
+			"rotate %lld B/%d s, sync %lld)\n",
+			cfg->outs[i].record,
+			cfg->outs[i].rec_write_size,
+			cfg->outs[i].rec_direct,
+			(long long)cfg->outs[i].rec_prealloc,
+			(long long)cfg->outs[i].rec_rotate_size,
+			cfg->outs[i].rec_rotate_time,
+			(long long)cfg->outs[i].rec_sync_size);
 		printf("\n");
 
 
 	}
-	printf("Input:\n");
-	printf("	Direction: ");
-	switch (cfg->input->dir) {
-		case DIR_INPUT:
-			printf("input\n");
-			break;
-		case DIR_OUTPUT:
-			printf("output\n");
-			break;
-		case DIR_INVAL:
-			printf("-\n");
-			break;
-	}
-	printf("	Type: ");
-	switch (cfg->input->type) {
-		case T_SOCKET:
-			printf("socket\n");
-			break;
-		case T_FILE:
-			printf("file\n");
-			break;
-		case T_STD:
-			printf("stdin/stdout\n");
-			break;
-		case T_INVAL:
-			printf("-\n");
-			break;
-	}
-	printf("	Retry: ");
-	switch (cfg->input->retry) {
-		case YES:
-			printf("yes\n");
-			break;
-		case NO:
-			printf("no\n");
-			break;
-		case IGNORE:
-			printf("ignore\n");
-			break;
-		case KILL:
-			printf("kill\n");
-			break;
-	}
-	printf("	Name: %s\n", cfg->input->name);
-	printf("	Port: %s\n", cfg->input->port);
-	printf("	Protocol: ");
-	switch (cfg->input->protocol) {
-		case IPPROTO_TCP:
-			printf("TCP\n");
-			break;
-		case IPPROTO_UDP:
-			printf("UDP\n");
-			break;
-		case -1:
-			printf("-\n");
-			break;
+	for (int i = 0; i < cfg->n_inputs; i++) {
+		printf("Input %d:\n", i);
+		printf("	Direction: ");
+		switch (cfg->input[i].dir) {
+			case DIR_INPUT:
+				printf("input\n");
+				break;
+			case DIR_OUTPUT:
+				printf("output\n");
+				break;
+			case DIR_INVAL:
+				printf("-\n");
+				break;
+		}
+		printf("	Type: ");
+		switch (cfg->input[i].type) {
+			case T_SOCKET:
+				printf("socket\n");
+				break;
+			case T_FILE:
+				printf("file\n");
+				break;
+			case T_STD:
+				printf("stdin/stdout\n");
+				break;
+			case T_UNIX:
+				printf("unix\n");
+				break;
+			case T_FIFO:
+				printf("fifo\n");
+				break;
+			case T_SHM:
+				printf("shm\n");
+				break;
+			case T_PCAP:
+				printf("pcap\n");
+				break;
+			case T_INVAL:
+				printf("-\n");
+				break;
+		}
+		printf("	Retry: ");
+		switch (cfg->input[i].retry) {
+			case YES:
+				printf("yes\n");
+				break;
+			case NO:
+				printf("no\n");
+				break;
+			case IGNORE:
+				printf("ignore\n");
+				break;
+			case KILL:
+				printf("kill\n");
+				break;
+		}
+		printf("	RetryDelay: %d\n", cfg->input[i].retry_delay);
+		printf("	Name: %s\n", cfg->input[i].name);
+		printf("	Port: %s\n", cfg->input[i].port);
+		printf("	Protocol: ");
+		switch (cfg->input[i].protocol) {
+			case IPPROTO_TCP:
+				printf("TCP\n");
+				break;
+			case IPPROTO_UDP:
+				printf("UDP\n");
+				break;
+			case -1:
+				printf("-\n");
+				break;
+		}
+		printf("	Socket type: %d\n", cfg->input[i].socktype);
+		printf("	Keepalive: %d\n", cfg->input[i].keepalive);
+		printf("	NoDelay: %d, SndBuf: %d, RcvBuf: %d, "
+			"NotSentLowat: %d, UserTimeout: %d, TOS: %d, "
+			"MaxUnsent: %d\n",
+			cfg->input[i].nodelay,
+			cfg->input[i].sndbuf,
+			cfg->input[i].rcvbuf,
+			cfg->input[i].notsent_lowat,
+			cfg->input[i].user_timeout,
+			cfg->input[i].tos,
+			cfg->input[i].max_unsent);
+		printf("	MulticastTTL: %d\n", cfg->input[i].mcast_ttl);
+		printf("	MulticastLoop: %d\n", cfg->input[i].mcast_loop);
+		printf("	MulticastInterface: %s\n", cfg->input[i].mcast_iface);
+		printf("	MulticastSource: %s\n", cfg->input[i].mcast_source);
+		printf("	Compression: %d (level %d)\n",
+			cfg->input[i].compression,
+			cfg->input[i].comp_level);
+		printf("	TLS: %d (verify %d)\n", cfg->input[i].tls,
+			cfg->input[i].tls_verify);
+		printf("	Certificate: %s\n", cfg->input[i].tls_cert);
+		printf("	PrivateKey: %s\n", cfg->input[i].tls_key);
+		printf("	CAFile: %s\n", cfg->input[i].tls_ca);
+		printf("	Mmap: %d (bitrate %lld, pcr %d, loop %d)\n",
+			cfg->input[i].replay_mmap,
+			cfg->input[i].replay_bitrate,
+			cfg->input[i].replay_pcr,
+			cfg->input[i].replay_loop);
+		printf("	Speed: %g\n", cfg->input[i].replay_speed);
+		printf("	StallTimeout: %d\n", cfg->input[i].stall_timeout);
+		printf("	StreamRate: %lld\n", cfg->input[i].stream_rate);
+		printf("	Framing: %d, ARQ: %d\n", cfg->input[i].framing,
+			cfg->input[i].arq);
+		printf("\n");
 	}
-	printf("	Keepalive: %d\n", cfg->input->keepalive);
-	printf("\n");
 }
 
-static void endpt_undef_err(char num, char * name) {
-	dprint(ERR, "Endpoint %d %s not defined\n");
+static void endpt_undef_err(int num, char * name) {
+	dprint(ERR, "Endpoint %d %s not defined\n", num, name);
 }
 
 /*
@@ -360,11 +1404,114 @@ static void endpt_undef_err(char num, char * name) {
  *
  * Returns 1 on success, 0 if there is an error in configuration.
  */
-static int  check_endpt(struct endpt_cfg * cfg, char num) {
+static int  check_endpt(struct endpt_cfg * cfg, int num) {
 	if (cfg->dir == DIR_INVAL) {
 		dprint(ERR, "Endpoint %d dir not defined\n", num);
 		return (0);
 	}
+	if (!comp_supported(cfg->compression)) {
+		dprint(ERR, "Endpoint %d: compression codec not supported "
+			"by this build\n", num);
+		return (0);
+	}
+	if (cfg->tls) {
+		if (!tls_supported()) {
+			dprint(ERR, "Endpoint %d: TLS not supported by this "
+				"build\n", num);
+			return (0);
+		}
+		if (cfg->type != T_SOCKET || cfg->protocol != IPPROTO_TCP) {
+			dprint(ERR, "Endpoint %d: TLS is only supported for "
+				"TCP\n", num);
+			return (0);
+		}
+		if (cfg->dir == DIR_INPUT && cfg->tls_cert == NULL) {
+			endpt_undef_err(num, "certificate");
+			return (0);
+		}
+	}
+	if (cfg->spill != NULL && cfg->dir != DIR_OUTPUT) {
+		dprint(ERR, "Endpoint %d: Spill is only valid for output\n",
+			num);
+		return (0);
+	}
+	if (cfg->framing && cfg->type != T_SOCKET && cfg->type != T_UNIX) {
+		dprint(ERR, "Endpoint %d: Framing is only valid for sockets\n",
+			num);
+		return (0);
+	}
+	if (cfg->fec_cols > 0 && (!cfg->framing || cfg->dir != DIR_OUTPUT ||
+		cfg->type != T_SOCKET || cfg->protocol != IPPROTO_UDP)) {
+		dprint(ERR, "Endpoint %d: FEC is only valid for framed UDP "
+			"output\n", num);
+		return (0);
+	}
+	if (cfg->arq > 0 && (!cfg->framing || cfg->type != T_SOCKET ||
+		cfg->protocol != IPPROTO_UDP || cfg->fec_cols > 0 ||
+		cfg->spill != NULL)) {
+
+		dprint(ERR, "Endpoint %d: ARQ is only valid for framed UDP "
+			"endpoints without FEC and Spill\n", num);
+		return (0);
+	}
+	if ((cfg->wake_bytes > 0 || cfg->wake_delay > 0) &&
+		cfg->dir != DIR_OUTPUT) {
+
+		dprint(ERR, "Endpoint %d: WakeBytes and WakeDelay are only "
+			"valid for output\n", num);
+		return (0);
+	}
+	if (cfg->zerocopy && (cfg->dir != DIR_OUTPUT ||
+		cfg->type != T_SOCKET || cfg->protocol != IPPROTO_TCP ||
+		cfg->tls)) {
+
+		dprint(ERR, "Endpoint %d: ZeroCopy is only valid for TCP "
+			"output without TLS\n", num);
+		return (0);
+	}
+	if (cfg->packet_size > 0 && (cfg->dir != DIR_OUTPUT ||
+		cfg->type != T_SOCKET || cfg->protocol != IPPROTO_UDP ||
+		cfg->framing || cfg->spill != NULL)) {
+
+		dprint(ERR, "Endpoint %d: Packet is only valid for UDP "
+			"output without Framing and Spill\n", num);
+		return (0);
+	}
+	if (cfg->packet_sync && (cfg->packet_size == 0 ||
+		cfg->packet_size%TS_PACKET_SIZE != 0)) {
+
+		dprint(ERR, "Endpoint %d: PacketSync needs Packet of whole "
+			"packets of %d bytes\n", num, TS_PACKET_SIZE);
+		return (0);
+	}
+	if (cfg->probe_size > 0 && (cfg->dir != DIR_OUTPUT ||
+		cfg->type != T_SOCKET || cfg->protocol != IPPROTO_TCP ||
+		cfg->tls)) {
+
+		dprint(ERR, "Endpoint %d: Probe is only valid for TCP "
+			"output without TLS\n", num);
+		return (0);
+	}
+	if (cfg->priority != PRIO_NORMAL && cfg->dir != DIR_OUTPUT) {
+		dprint(ERR, "Endpoint %d: Priority is only valid for "
+			"output\n", num);
+		return (0);
+	}
+	if (cfg->buf_time > 0 && cfg->dir != DIR_OUTPUT) {
+		dprint(ERR, "Endpoint %d: Buffer is only valid for output\n",
+			num);
+		return (0);
+	}
+	if (cfg->replay_speed != 1 && cfg->type != T_PCAP) {
+		dprint(ERR, "Endpoint %d: Speed is only valid for pcap "
+			"input\n", num);
+		return (0);
+	}
+	if (cfg->stream_rate > 0 && cfg->dir != DIR_INPUT) {
+		dprint(ERR, "Endpoint %d: StreamRate is only valid for "
+			"input\n", num);
+		return (0);
+	}
 	switch (cfg->type) {
 		case T_INVAL:
 			endpt_undef_err(num, "type");
@@ -374,6 +1521,22 @@ static int  check_endpt(struct endpt_cfg * cfg, char num) {
 				endpt_undef_err(num, "name");
 				return (0);
 			}
+			if (cfg->record && cfg->dir != DIR_OUTPUT) {
+				dprint(ERR, "Endpoint %d: Record is only valid "
+					"for output\n", num);
+				return (0);
+			}
+			if (cfg->replay_mmap && cfg->dir != DIR_INPUT) {
+				dprint(ERR, "Endpoint %d: Mmap is only valid "
+					"for input\n", num);
+				return (0);
+			}
+			if (!cfg->replay_mmap && (cfg->replay_bitrate > 0 ||
+				cfg->replay_pcr || cfg->replay_loop)) {
+				dprint(ERR, "Endpoint %d: Bitrate, Pacing and "
+					"Loop need Mmap\n", num);
+				return (0);
+			}
 			break;
 		case T_SOCKET:
 			if (cfg->name == NULL) {
@@ -392,6 +1555,85 @@ static int  check_endpt(struct endpt_cfg * cfg, char num) {
 				endpt_undef_err(num, "keepalive");
 				return (0);
 			}
+			if (cfg->protocol != IPPROTO_TCP && (cfg->nodelay ||
+				cfg->notsent_lowat > 0 || cfg->user_timeout > 0 ||
+				cfg->max_unsent > 0)) {
+				dprint(ERR, "Endpoint %d: NoDelay, NotSentLowat, "
+					"UserTimeout and MaxUnsent are only valid "
+					"for TCP\n", num);
+				return (0);
+			}
+			if (cfg->max_unsent > 0 && cfg->dir != DIR_OUTPUT) {
+				dprint(ERR, "Endpoint %d: MaxUnsent is only valid "
+					"for output\n", num);
+				return (0);
+			}
+			if (cfg->max_unsent > 0 && !unsent_supported()) {
+				dprint(ERR, "Endpoint %d: MaxUnsent not "
+					"supported by this build\n", num);
+				return (0);
+			}
+			if (cfg->mcast_source != NULL &&
+				(cfg->dir != DIR_INPUT ||
+				cfg->protocol != IPPROTO_UDP)) {
+				dprint(ERR, "Endpoint %d: MulticastSource is "
+					"only valid for UDP input\n", num);
+				return (0);
+			}
+			break;
+		case T_UNIX:
+			if (cfg->name == NULL) {
+				endpt_undef_err(num, "name");
+				return (0);
+			}
+			if (cfg->protocol != -1) {
+				dprint(ERR, "Endpoint %d: Protocol of unix socket "
+					"is stream, dgram or seqpacket\n", num);
+				return (0);
+			}
+			break;
+		case T_FIFO:
+			if (cfg->name == NULL) {
+				endpt_undef_err(num, "name");
+				return (0);
+			}
+			break;
+		case T_SHM:
+			if (cfg->name == NULL || cfg->name[0] != '/') {
+				dprint(ERR, "Endpoint %d: Name of shared memory has "
+					"to start with /\n", num);
+				return (0);
+			}
+			if (cfg->dir != DIR_OUTPUT) {
+				dprint(ERR, "Endpoint %d: shm is only valid for "
+					"output\n", num);
+				return (0);
+			}
+			break;
+		case T_PCAP:
+			if (cfg->name == NULL) {
+				endpt_undef_err(num, "name");
+				return (0);
+			}
+			if (cfg->dir != DIR_INPUT) {
+				dprint(ERR, "Endpoint %d: pcap is only valid for "
+					"input\n", num);
+				return (0);
+			}
+			if (cfg->protocol != -1 && cfg->protocol != IPPROTO_UDP &&
+				cfg->protocol != IPPROTO_TCP) {
+
+				dprint(ERR, "Endpoint %d: Protocol of pcap is UDP "
+					"or TCP\n", num);
+				return (0);
+			}
+			if (cfg->port != NULL && (atoi(cfg->port) <= 0 ||
+				atoi(cfg->port) > 65535)) {
+
+				dprint(ERR, "Endpoint %d: Port of pcap has to be "
+					"a number\n", num);
+				return (0);
+			}
 			break;
 		case T_STD:
 			break;
@@ -406,17 +1648,18 @@ static int  check_endpt(struct endpt_cfg * cfg, char num) {
  * Returns 1 on success, 0 if there is an error in configuration
  */
 int check_config(struct io_cfg * config) {
-	if (config->n_outs > MAX_OUTPUTS) {
-		dprint(ERR, "Defined more outputs than MAX_OUTPUTS\n");
-		return (0);
-	}
-	if (!check_endpt(config->input, 0))
-		return (0);
-	for (int i = 0; i < config->n_outs; i++) {
-		if (config->outs[i].dir != DIR_OUTPUT) {
-			dprint(ERR, "More inputs defined\n");
+	for (int i = 0; i < config->n_inputs; i++) {
+		if (!check_endpt(&config->input[i], 0))
+			return (0);
+		if (config->n_inputs > 1 && (config->input[i].replay_mmap ||
+			config->input[i].type == T_PCAP)) {
+
+			dprint(ERR, "Mmap and pcap inputs can't have standby "
+				"inputs\n");
 			return (0);
 		}
+	}
+	for (int i = 0; i < config->n_outs; i++) {
 		if (!check_endpt(&config->outs[i], i+1)) {
 			return (0);
 		}
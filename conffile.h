@@ -9,6 +9,7 @@ int endpt_config_set_item(struct endpt_cfg * config, char * key, char * value);
 int parse_config_file(struct io_cfg * config, char * filename);
 void print_config(struct io_cfg * cfg);
 int check_config(struct io_cfg * config);
+int parse_scaled(char * value, long long unit, long long * result);
 
 
 #endif
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+#define	CRC32C_POLY 0x82f63b78 	// Reflected Castagnoli polynomial
+
+static uint32_t crc32c_table[256];
+static int crc32c_hw; 		// Use SSE4.2 instructions
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* Fill table for bytewise computation */
+static void crc32c_init(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc;
+		crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		crc32c_table[i] = crc;
+	}
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	crc32c_hw = __builtin_cpu_supports("sse4.2");
+#else
+	crc32c_hw = 0;
+#endif
+}
+
+/* Returns CRC of len bytes from data computed bytewise */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char * data,
+	size_t len) {
+
+	while (len-- > 0)
+		crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return (crc);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/* Returns CRC of len bytes from data computed by SSE4.2 instructions */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char * data,
+	size_t len) {
+
+	uint64_t crc64;
+	crc64 = crc;
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		len -= 8;
+	}
+	crc = crc64;
+	while (len-- > 0)
+		crc = _mm_crc32_u8(crc, *data++);
+	return (crc);
+}
+#endif
+
+/*
+ * Continue CRC32C (Castagnoli) crc with len bytes from data. Start with crc
+ * 0. SSE4.2 instructions are used when the CPU has them.
+ *
+ * Returns the updated CRC.
+ */
+uint32_t crc32c(uint32_t crc, const void * data, size_t len) {
+	pthread_once(&crc32c_once, crc32c_init);
+	crc = ~crc;
+#if defined(__x86_64__) && defined(__GNUC__)
+	if (crc32c_hw)
+		return (~crc32c_sse42(crc, data, len));
+#endif
+	return (~crc32c_sw(crc, data, len));
+}
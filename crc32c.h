@@ -0,0 +1,9 @@
+#ifndef CRC32C_H
+#define	CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32c(uint32_t crc, const void * data, size_t len);
+
+#endif
@@ -1,4 +1,4 @@
-#define	_XOPEN_SOURCE 700
+#define	_GNU_SOURCE
 #include <stdlib.h>
 
 #include <err.h>
@@ -6,9 +6,19 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/ip.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <ifaddrs.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -20,6 +30,24 @@
 #include "netstream.h"
 #include "buffer.h"
 #include "endpts.h"
+#include "compress.h"
+#include "tls.h"
+#include "record.h"
+#include "replay.h"
+#include "pcap.h"
+#include "perf.h"
+#include "shmout.h"
+#include "selector.h"
+#include "frame.h"
+#include "fec.h"
+#include "zerocopy.h"
+#include "upgrade.h"
+#include "probe.h"
+#include "fault.h"
+#include "prio.h"
+#include "trace.h"
+#include "repack.h"
+#include "arq.h"
 
 char poll_errs(void * id, struct pollfd * pollfds) {
 	char fail = 0;
@@ -50,6 +78,38 @@ char poll_errs(void * id, struct pollfd * pollfds) {
 	return (fail);
 }
 
+/* Sleep for ms milliseconds */
+static void sleep_ms(int ms) {
+	struct timespec ts;
+	ts.tv_sec = ms/1000;
+	ts.tv_nsec = (ms%1000)*1000000L;
+	nanosleep(&ts, NULL);
+}
+
+/* Note a failure of endpoint cfg which is going to be retried */
+static void mark_failure(struct endpt_cfg * cfg) {
+	if (cfg->fail_since != 0)
+		return;
+	cfg->fail_since = now_ns();
+	cfg->failures++;
+}
+
+/*
+ * Note that endpoint cfg moves data again after a failure, the time since
+ * the failure is added to its recovery statistics.
+ */
+static void mark_recovered(struct endpt_cfg * cfg) {
+	uint64_t t;
+	t = now_ns()-cfg->fail_since;
+	cfg->fail_since = 0;
+	cfg->recoveries++;
+	cfg->recover_ns += t;
+	if (t > cfg->recover_max)
+		cfg->recover_max = t;
+	tdprint(cfg, INFO, "Recovered after %llu ms\n",
+		(unsigned long long)(t/1000000));
+}
+
 static void exit_thread(struct endpt_cfg * cfg, int status) {
 	cfg->exit_status = status;
 	struct deadlist * dlist;
@@ -94,46 +154,473 @@ static void set_keepalive(int fd, struct endpt_cfg * args, int keepalive) {
 #endif
 }
 
-#define	WFE_EVT 0
-#define	WFE_SIG_TERM -1
-#define	WFE_POLL_ERR -2
+/*
+ * Set socket buffers, TOS and TCP options of endpoint cfg on IP socket fd.
+ * Failures are only reported.
+ */
+static void set_sock_options(int fd, struct endpt_cfg * cfg) {
+	int optval;
+	if (cfg->sndbuf > 0) {
+		optval = cfg->sndbuf;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &optval,
+			sizeof (optval)) < 0) {
+			tdprint(cfg, WARN, "Could not set send buffer size\n");
+		}
+	}
+	if (cfg->rcvbuf > 0) {
+		optval = cfg->rcvbuf;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &optval,
+			sizeof (optval)) < 0) {
+			tdprint(cfg, WARN, "Could not set receive buffer size\n");
+		}
+	}
+	if (cfg->tos != -1) {
+		struct sockaddr_storage addr;
+		socklen_t addrlen;
+		int res;
+		addrlen = sizeof (addr);
+		optval = cfg->tos;
+		if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) == 0 &&
+			addr.ss_family == AF_INET6) {
+			res = setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &optval,
+				sizeof (optval));
+		} else  {
+			res = setsockopt(fd, IPPROTO_IP, IP_TOS, &optval,
+				sizeof (optval));
+		}
+		if (res < 0)
+			tdprint(cfg, WARN, "Could not set TOS\n");
+	}
+	if (cfg->protocol != IPPROTO_TCP)
+		return;
+	if (cfg->nodelay) {
+		optval = 1;
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval,
+			sizeof (optval)) < 0) {
+			tdprint(cfg, WARN, "Could not set TCP_NODELAY\n");
+		}
+	}
+#ifdef __linux__
+	if (cfg->notsent_lowat > 0) {
+		optval = cfg->notsent_lowat;
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &optval,
+			sizeof (optval)) < 0) {
+			tdprint(cfg, WARN, "Could not set TCP_NOTSENT_LOWAT\n");
+		}
+	}
+	if (cfg->user_timeout > 0) {
+		optval = cfg->user_timeout;
+		if (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &optval,
+			sizeof (optval)) < 0) {
+			tdprint(cfg, WARN, "Could not set TCP_USER_TIMEOUT\n");
+		}
+	}
+#endif
+}
+
+/*
+ * Returns 1 if the kernel can tell how many bytes wait in a TCP socket unsent
+ * (MaxUnsent can be used), 0 otherwise
+ */
+int unsent_supported(void) {
+#ifdef SIOCOUTQNSD
+	return (1);
+#else
+	return (0);
+#endif
+}
 
 /*
- * Wait for an event or a signal on listening socket.
+ * Returns number of bytes which can be written to TCP socket fd of output cfg
+ * before more than MaxUnsent bytes wait in the socket unsent. If the kernel
+ * can't tell, the whole limit is returned and it is reported once, warned is
+ * set then.
  */
-static int wait_for_event(void * id, char * name, int listenfd, int signalfd) {
+static ssize_t unsent_budget(int fd, struct endpt_cfg * cfg, int * warned) {
+	int unsent;
+	unsent = 0;
+#ifdef SIOCOUTQNSD
+	if (ioctl(fd, SIOCOUTQNSD, &unsent) == -1) {
+		if (!*warned) {
+			tdprint(cfg, WARN, "Could not get unsent bytes, "
+				"MaxUnsent is not applied: %s\n",
+				strerror(errno));
+			*warned = 1;
+		}
+		unsent = 0;
+	}
+#endif
+	return ((ssize_t)cfg->max_unsent-unsent);
+}
+
+/* Returns 1 if addr is a multicast address, 0 otherwise */
+static int is_multicast(struct sockaddr * addr) {
+	if (addr->sa_family == AF_INET) {
+		struct sockaddr_in * sin = (struct sockaddr_in *)addr;
+		return (IN_MULTICAST(ntohl(sin->sin_addr.s_addr)));
+	} else if (addr->sa_family == AF_INET6) {
+		struct sockaddr_in6 * sin6 = (struct sockaddr_in6 *)addr;
+		return (IN6_IS_ADDR_MULTICAST(&sin6->sin6_addr));
+	}
+	return (0);
+}
+
+/* Returns 1 if name is a numeric multicast address, 0 otherwise */
+static int name_is_multicast(char * name) {
+	struct in_addr in4;
+	struct in6_addr in6;
+	if (name == NULL)
+		return (0);
+	if (inet_pton(AF_INET, name, &in4) == 1)
+		return (IN_MULTICAST(ntohl(in4.s_addr)));
+	if (inet_pton(AF_INET6, name, &in6) == 1)
+		return (IN6_IS_ADDR_MULTICAST(&in6));
+	return (0);
+}
+
+/*
+ * Resolve multicast interface given by name or IPv4 address into an
+ * interface index and an IPv4 address. If name is NULL, the kernel chooses
+ * the interface.
+ *
+ * Returns 0 on success, -1 if the interface does not exist.
+ */
+static int mcast_iface(char * name, unsigned int * ifindex,
+	struct in_addr * ifaddr) {
+
+	*ifindex = 0;
+	ifaddr->s_addr = htonl(INADDR_ANY);
+	if (name == NULL)
+		return (0);
+	if (inet_pton(AF_INET, name, ifaddr) == 1)
+		return (0);
+	*ifindex = if_nametoindex(name);
+	if (*ifindex == 0)
+		return (-1);
+	struct ifaddrs * ifa_list;
+	if (getifaddrs(&ifa_list) == -1)
+		return (0);
+	for (struct ifaddrs * ifa = ifa_list; ifa != NULL;
+		ifa = ifa->ifa_next) {
+
+		if (ifa->ifa_addr != NULL &&
+			ifa->ifa_addr->sa_family == AF_INET &&
+			strcmp(ifa->ifa_name, name) == 0) {
+
+			*ifaddr = ((struct sockaddr_in *)ifa->ifa_addr)->
+				sin_addr;
+			break;
+		}
+	}
+	freeifaddrs(ifa_list);
+	return (0);
+}
+
+/*
+ * Set multicast TTL, loopback and interface of an output socket fd sending to
+ * group addr.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int set_mcast_output(int fd, struct sockaddr * addr,
+	struct endpt_cfg * cfg) {
+
+	unsigned int ifindex;
+	struct in_addr ifaddr;
+	if (mcast_iface(cfg->mcast_iface, &ifindex, &ifaddr) == -1) {
+		tdprint(cfg, ERR, "Unknown multicast interface %s\n",
+			cfg->mcast_iface);
+		return (-1);
+	}
+	if (addr->sa_family == AF_INET) {
+		unsigned char optval;
+		if (cfg->mcast_ttl != -1) {
+			optval = cfg->mcast_ttl;
+			if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL,
+				&optval, sizeof (optval)) < 0) {
+				warn("Could not set multicast TTL");
+				return (-1);
+			}
+		}
+		if (cfg->mcast_loop != -1) {
+			optval = cfg->mcast_loop;
+			if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+				&optval, sizeof (optval)) < 0) {
+				warn("Could not set multicast loopback");
+				return (-1);
+			}
+		}
+		if (cfg->mcast_iface != NULL) {
+			struct ip_mreqn mreqn;
+			memset(&mreqn, 0, sizeof (mreqn));
+			mreqn.imr_address = ifaddr;
+			mreqn.imr_ifindex = ifindex;
+			if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF,
+				&mreqn, sizeof (mreqn)) < 0) {
+				warn("Could not set multicast interface");
+				return (-1);
+			}
+		}
+	} else if (addr->sa_family == AF_INET6) {
+		int optval;
+		if (cfg->mcast_ttl != -1) {
+			optval = cfg->mcast_ttl;
+			if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+				&optval, sizeof (optval)) < 0) {
+				warn("Could not set multicast hop limit");
+				return (-1);
+			}
+		}
+		if (cfg->mcast_loop != -1) {
+			optval = cfg->mcast_loop;
+			if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
+				&optval, sizeof (optval)) < 0) {
+				warn("Could not set multicast loopback");
+				return (-1);
+			}
+		}
+		if (ifindex != 0) {
+			if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+				&ifindex, sizeof (ifindex)) < 0) {
+				warn("Could not set multicast interface");
+				return (-1);
+			}
+		}
+	}
+	return (0);
+}
+
+/*
+ * Join multicast group addr on an input socket fd. If a source is configured,
+ * only datagrams from this source are received (source-specific multicast).
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int join_mcast_group(int fd, struct sockaddr * addr,
+	struct endpt_cfg * cfg) {
+
+	unsigned int ifindex;
+	struct in_addr ifaddr;
+	if (mcast_iface(cfg->mcast_iface, &ifindex, &ifaddr) == -1) {
+		tdprint(cfg, ERR, "Unknown multicast interface %s\n",
+			cfg->mcast_iface);
+		return (-1);
+	}
+	if (addr->sa_family == AF_INET) {
+		struct in_addr group = ((struct sockaddr_in *)addr)->sin_addr;
+		if (cfg->mcast_source != NULL) {
+			struct ip_mreq_source mreqs;
+			memset(&mreqs, 0, sizeof (mreqs));
+			mreqs.imr_multiaddr = group;
+			mreqs.imr_interface = ifaddr;
+			if (inet_pton(AF_INET, cfg->mcast_source,
+				&mreqs.imr_sourceaddr) != 1) {
+				tdprint(cfg, ERR, "Invalid multicast source %s\n",
+					cfg->mcast_source);
+				return (-1);
+			}
+			if (setsockopt(fd, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP,
+				&mreqs, sizeof (mreqs)) < 0) {
+				warn("Could not join source-specific group");
+				return (-1);
+			}
+		} else  {
+			struct ip_mreqn mreqn;
+			memset(&mreqn, 0, sizeof (mreqn));
+			mreqn.imr_multiaddr = group;
+			mreqn.imr_address = ifaddr;
+			mreqn.imr_ifindex = ifindex;
+			if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				&mreqn, sizeof (mreqn)) < 0) {
+				warn("Could not join multicast group");
+				return (-1);
+			}
+		}
+	} else if (addr->sa_family == AF_INET6) {
+		if (cfg->mcast_source != NULL) {
+			struct group_source_req gsr;
+			struct sockaddr_in6 * src;
+			memset(&gsr, 0, sizeof (gsr));
+			gsr.gsr_interface = ifindex;
+			memcpy(&gsr.gsr_group, addr,
+				sizeof (struct sockaddr_in6));
+			src = (struct sockaddr_in6 *)&gsr.gsr_source;
+			src->sin6_family = AF_INET6;
+			if (inet_pton(AF_INET6, cfg->mcast_source,
+				&src->sin6_addr) != 1) {
+				tdprint(cfg, ERR, "Invalid multicast source %s\n",
+					cfg->mcast_source);
+				return (-1);
+			}
+			if (setsockopt(fd, IPPROTO_IPV6, MCAST_JOIN_SOURCE_GROUP,
+				&gsr, sizeof (gsr)) < 0) {
+				warn("Could not join source-specific group");
+				return (-1);
+			}
+		} else  {
+			struct ipv6_mreq mreq6;
+			memset(&mreq6, 0, sizeof (mreq6));
+			mreq6.ipv6mr_multiaddr =
+				((struct sockaddr_in6 *)addr)->sin6_addr;
+			mreq6.ipv6mr_interface = ifindex;
+			if (setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+				&mreq6, sizeof (mreq6)) < 0) {
+				warn("Could not join multicast group");
+				return (-1);
+			}
+		}
+	}
+	return (0);
+}
+
+/*
+ * Create Unix domain socket of endpoint cfg. Input socket is bound to the path
+ * given by name (a stale socket is removed) and listens if it is a stream or
+ * seqpacket socket. Output socket is connected to the path.
+ *
+ * Returns the socket or -1 on error.
+ */
+static int unix_socket(struct endpt_cfg * cfg) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(cfg->name) >= sizeof (addr.sun_path)) {
+		tdprint(cfg, ERR, "Too long socket path %s\n", cfg->name);
+		return (-1);
+	}
+	strcpy(addr.sun_path, cfg->name);
+
+	int fd;
+	fd = socket(AF_UNIX, cfg->socktype, 0);
+	if (fd == -1) {
+		warn("Could not create socket %s", cfg->name);
+		return (-1);
+	}
+	if (cfg->dir == DIR_INPUT) {
+		struct stat st;
+		// Socket left by a previous run would block bind
+		if (lstat(cfg->name, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(cfg->name);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) == -1 ||
+			(cfg->socktype != SOCK_DGRAM &&
+			listen(fd, LISTEN_BACKLOG) == -1)) {
+
+			warn("Could not bind to %s", cfg->name);
+			close(fd);
+			return (-1);
+		}
+	} else  {
+		if (connect(fd, (struct sockaddr *)&addr, sizeof (addr)) == -1) {
+			warn("Could not connect to %s", cfg->name);
+			close(fd);
+			return (-1);
+		}
+	}
+	return (fd);
+}
+
+/*
+ * Open named pipe of endpoint cfg, the pipe is created if it does not exist.
+ * Input does not wait for a writer, output fails if there is no reader. Reads
+ * and writes on the returned descriptor block as on other endpoints.
+ *
+ * Returns the file descriptor or -1 on error.
+ */
+static int fifo_open(struct endpt_cfg * cfg) {
+	if (mkfifo(cfg->name, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1 &&
+		errno != EEXIST) {
+
+		warn("Could not create pipe %s", cfg->name);
+		return (-1);
+	}
+	struct stat st;
+	if (stat(cfg->name, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+		tdprint(cfg, ERR, "%s is not a named pipe\n", cfg->name);
+		return (-1);
+	}
+
+	int fd;
+	if (cfg->dir == DIR_INPUT)
+		fd = open(cfg->name, O_RDONLY | O_NONBLOCK);
+	else
+		fd = open(cfg->name, O_WRONLY | O_NONBLOCK);
+	if (fd == -1) {
+		if (errno == ENXIO)
+			tdprint(cfg, INFO, "No reader on pipe %s\n", cfg->name);
+		else
+			warn("Could not open pipe %s", cfg->name);
+		return (-1);
+	}
+	int flags;
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+		warn("Could not set flags of pipe %s", cfg->name);
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * Wait for an event on listening socket or a signal. If timeout is not NULL,
+ * wait at most this time. If listenfd is -1, only signals are waited for.
+ * Termination signal is written back to the signal pipe, so that all threads
+ * waiting for it are interrupted.
+ *
+ * Handover is passed on in the same way.
+ *
+ * Returns WFE_EVT on event, WFE_TIMEOUT after timeout, WFE_SIG_TERM on
+ * termination signal, WFE_HANDOVER on handover and WFE_POLL_ERR on error.
+ */
+int wait_for_event(void * id, char * name, int listenfd, int signalfd,
+	struct timespec * timeout) {
+
 	struct pollfd pollfds[2];
 	pollfds[1].fd = signal_fds[0];
 	pollfds[1].events = POLLIN;
 	do  {
 		pollfds[0].fd = listenfd;
 		pollfds[0].events = POLLIN;
-		if (poll(pollfds, 2, -1) == -1) {
+		int res;
+		res = ppoll(pollfds, 2, timeout, NULL);
+		if (res == -1) {
 			warn("Error when polling on %s", name);
 			return (WFE_POLL_ERR);
 		}
+		if (res == 0)
+			return (WFE_TIMEOUT);
 		poll_errs(id, pollfds);
 		if (pollfds[1].revents & POLLIN) {
-			tdprint(id,
-				INFO,
-				"Signal received, interrupting %s\n",
-				name);
-			// Handle signals
+			// Handle signals, other thread may have taken it
 			int8_t signum;
 			int ret;
 			errno = 0;
 			ret = read(signalfd, &signum, 1);
-			if (ret == -1) {
+			if (ret == -1 && errno != EAGAIN) {
 				warn("Error occured when"
 				"reading from signal pipe");
 			}
-			switch (signum) {
+			if (ret == 1) {
+				tdprint(id,
+					INFO,
+					"Signal received, interrupting %s\n",
+					name);
+			}
+			switch (ret == 1 ? signum : 0) {
+				case 0:
+					break;
 				case SIGINT:
 				case SIGTERM:
 					tdprint(id,
 						INFO,
 						"Received SIGINT\n");
+					if (write(signal_fds[1], &signum, 1)) {
+					}
 					return (WFE_SIG_TERM);
+				case SIG_HANDOVER:
+					if (write(signal_fds[1], &signum, 1)) {
+					}
+					return (WFE_HANDOVER);
 				default:
 					tdprint(id,
 						INFO,
@@ -143,21 +630,180 @@ static int wait_for_event(void * id, char * name, int listenfd, int signalfd) {
 			}
 
 		}
-		if (!(pollfds[0].revents & POLLIN)) {
-			continue;
-		}
-	} while (0);
+	} while (pollfds[0].revents == 0);
 	return (WFE_EVT);
 
 }
 
 
-/* Endpoint for input. Gets pointer to I/O config in args */
-void * read_endpt(void * args) {
+/*
+ * Insert ndata bytes from data read by input in into all buffers filled by
+ * input. If meta is not NULL, the chunk keeps its sequence number from
+ * upstream. Data of redundant inputs go through the selector, which numbers
+ * them again.
+ */
+static void publish(struct endpt_cfg * in, char * data, ssize_t ndata,
+	struct chunk_meta * meta) {
+
+	struct io_cfg * cfg;
+	cfg = in->io;
+	if (cfg->sel != NULL)
+		selector_input(cfg->sel, in-cfg->input, data, ndata);
+	else if (meta != NULL)
+		buffers_insert_meta(cfg->feeds, cfg->n_feeds, data, ndata, meta);
+	else
+		buffers_insert(cfg->feeds, cfg->n_feeds, data, ndata);
+}
+
+/*
+ * Publish end of stream of input in, ndata is BUF_END_DATA or BUF_KILL.
+ *
+ * Returns the number of other inputs still running.
+ */
+static int publish_end(struct endpt_cfg * in, ssize_t ndata) {
 	struct io_cfg * cfg;
-	cfg = (struct io_cfg *) args;
+	cfg = in->io;
+	if (cfg->sel != NULL)
+		return (selector_end(cfg->sel, in-cfg->input, ndata));
+	buffers_insert(cfg->feeds, cfg->n_feeds, NULL, ndata);
+	return (0);
+}
+
+/*
+ * Publish ndata bytes of input in with meta (NULL - new chunk). If the input
+ * is compressed (dc is not NULL), all complete frames are decompressed and
+ * published.
+ *
+ * Returns 0 on success, -1 if compressed data are corrupted.
+ */
+static int publish_chunk(struct endpt_cfg * in, struct decomp * dc,
+	char * data, size_t ndata, struct chunk_meta * meta) {
+
+	if (dc == NULL || ndata == 0) {
+		publish(in, data, ndata, meta);
+		return (0);
+	}
+	if (decomp_input(dc, data, ndata) == -1)
+		return (-1);
+	char * out;
+	ssize_t nout;
+	while ((nout = decomp_next(dc, &out)) >= 0) {
+		publish(in, out, nout, meta);
+	}
+	if (nout == DECOMP_ERR)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Publish ndata bytes read from input in. If the input is framed (df is not
+ * NULL), payloads of all complete frames are published with their sequence
+ * numbers.
+ *
+ * Returns 0 on success, -1 if data are corrupted.
+ */
+static int publish_read(struct endpt_cfg * in, struct deframe * df,
+	struct decomp * dc, char * data, size_t ndata) {
+
+	if (df == NULL)
+		return (publish_chunk(in, dc, data, ndata, NULL));
+	if (deframe_input(df, data, ndata) == -1)
+		return (-1);
+	char * payload;
+	ssize_t npayload;
+	struct chunk_meta meta;
+	while ((npayload = deframe_next(df, &payload, &meta)) >= 0) {
+		if (publish_chunk(in, dc, payload, npayload, &meta) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Write all len bytes from data to fd, preceded by frame header hdr if it is
+ * not NULL. Partial writes are continued.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int write_all(int fd, char * hdr, char * data, size_t len) {
+	struct iovec iov[2];
+	struct iovec * cur;
+	int iovcnt;
+	iovcnt = 0;
+	if (hdr != NULL) {
+		iov[iovcnt].iov_base = hdr;
+		iov[iovcnt++].iov_len = FRAME_HEADER_SIZE;
+	}
+	iov[iovcnt].iov_base = data;
+	iov[iovcnt++].iov_len = len;
+	cur = iov;
+	while (iovcnt > 0) {
+		ssize_t res;
+		res = writev(fd, cur, iovcnt);
+		if (res < 0)
+			return (-1);
+		while (iovcnt > 0 && (size_t)res >= cur->iov_len) {
+			res -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			cur->iov_base = (char *)cur->iov_base+res;
+			cur->iov_len -= res;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Keep sockets of input in for the process taking the stream over: listening
+ * socket listenfd and connection, other socket or file readfd (-1 - none).
+ * Data read, but not parsed yet by deframing df or decompression dc are kept
+ * with the connection. TLS connections and stdin are not handed over.
+ */
+static void input_handover(struct endpt_cfg * in, int listenfd, int readfd,
+	struct deframe * df, struct decomp * dc) {
+
+	in->ho_listenfd = listenfd;
+	in->ho_fd = -1;
+	if (readfd == -1 || in->type == T_STD)
+		return;
+	if (in->tls) {
+		close(readfd);
+		return;
+	}
+	in->ho_fd = readfd;
+	char * pending;
+	size_t npending;
+	pending = NULL;
+	npending = 0;
+	if (df != NULL) {
+		pending = df->data+df->pos;
+		npending = df->len-df->pos;
+	} else if (dc != NULL) {
+		pending = dc->data+dc->pos;
+		npending = dc->len-dc->pos;
+	}
+	if (npending == 0)
+		return;
+	in->ho_carry = malloc(npending);
+	if (in->ho_carry == NULL) {
+		tdprint(in, WARN, "Unparsed data are not handed over\n");
+		return;
+	}
+	memcpy(in->ho_carry, pending, npending);
+	in->ho_ncarry = npending;
+}
+
+/*
+ * Endpoint for input. Gets pointer to input config in args, each of redundant
+ * inputs runs in its own thread.
+ */
+void * read_endpt(void * args) {
 	struct endpt_cfg * read_cfg;
-	read_cfg = cfg->input;
+	read_cfg = (struct endpt_cfg *)args;
+	struct io_cfg * cfg;
+	cfg = read_cfg->io;
 	read_cfg->exit_status = 0;
 
 	// Mask signals
@@ -171,15 +817,88 @@ void * read_endpt(void * args) {
 		tdprint((void *)read_cfg, WARN, "Error in signal setup\n");
 		exit_thread(read_cfg, -1);
 	}
+	struct perf_thread pt;
+	perf_thread_open(&pt, read_cfg);
+
+
+	// Compressed input is read in frames
+	size_t readsize;
+	struct decomp * dc;
+	readsize = READ_BUFFER_BLOCK_SIZE;
+	dc = NULL;
+	if (read_cfg->compression != C_NONE) {
+		readsize = comp_frame_bound(WRITE_BUFFER_BLOCK_SIZE);
+		dc = decomp_create(read_cfg->compression);
+		if (dc == NULL) {
+			tdprint((void *)read_cfg, ERR,
+				"Failed to initialize decompression\n");
+			exit_thread(read_cfg, -1);
+		}
+	}
+	// Framed input carries whole chunks of the sender in frames
+	struct deframe * df;
+	df = NULL;
+	if (read_cfg->framing) {
+		if (dc == NULL)
+			readsize = WRITE_BUFFER_BLOCK_SIZE;
+		df = deframe_create((void *)read_cfg, &read_cfg->fstats,
+			readsize);
+		// Space for a FEC frame, which is longer
+		readsize += FEC_MAX_OVERHEAD;
+		if (df == NULL) {
+			tdprint((void *)read_cfg, ERR,
+				"Failed to initialize framing\n");
+			exit_thread(read_cfg, -1);
+		}
+	}
+	// Lost frames are requested from the sender
+	struct timespec arq_tick;
+	arq_tick.tv_sec = 0;
+	arq_tick.tv_nsec = ARQ_TICK*1000000L;
+	if (df != NULL && read_cfg->arq > 0) {
+		df->arq = arq_rx_create((void *)read_cfg, &read_cfg->fstats,
+			FRAME_HEADER_SIZE+df->max_payload, read_cfg->arq);
+		if (df->arq == NULL) {
+			tdprint((void *)read_cfg, ERR,
+				"Failed to initialize ARQ\n");
+			exit_thread(read_cfg, -1);
+		}
+	}
 
+	// Mapped file input
+	struct replay rp;
+	replay_init(&rp, read_cfg);
+	// Capture file input
+	struct pcap_replay pc;
+	pcap_init(&pc, read_cfg);
 
+	// Listening socket can be taken over or inherited
 	int listenfd;
-	listenfd = -1;
+	listenfd = read_cfg->ho_listenfd;
+	read_cfg->ho_listenfd = -1;
 	int readfd;
 	readfd = -1;
 	do  {
+		if (dc != NULL)
+			decomp_reset(dc);
+		if (df != NULL)
+			deframe_reset(df);
 		tdprint((void *)read_cfg, INFO, "Start reading\n");
-		if (read_cfg->type == T_FILE) {
+		if (read_cfg->ho_fd != -1) {
+			tdprint((void *)read_cfg, INFO,
+				"Continuing with socket taken over\n");
+			readfd = read_cfg->ho_fd;
+			read_cfg->ho_fd = -1;
+			if (publish_read(read_cfg, df, dc, read_cfg->ho_carry,
+				read_cfg->ho_ncarry) == -1) {
+
+				tdprint((void *)read_cfg, ERR,
+					"Corrupted data taken over\n");
+			}
+			free(read_cfg->ho_carry);
+			read_cfg->ho_carry = NULL;
+			read_cfg->ho_ncarry = 0;
+		} else if (read_cfg->type == T_FILE) {
 			tdprint((void *)read_cfg, DEBUG, "File\n");
 			readfd = open(read_cfg->name, O_RDONLY);
 			if (readfd == -1) {
@@ -191,11 +910,62 @@ void * read_endpt(void * args) {
 				close(readfd);
 				exit_thread(read_cfg, 0);
 			}
-		} else if (read_cfg->type == T_SOCKET &&
-			read_cfg->protocol == IPPROTO_TCP) {
+			if (read_cfg->replay_mmap) {
+				switch (replay_file(cfg, &rp, readfd)) {
+					case REPLAY_KILL:
+						read_cfg->retry = KILL;
+						break;
+					case REPLAY_ERR:
+						read_cfg->exit_status = -1;
+						break;
+					case REPLAY_END:
+						read_cfg->exit_status = 0;
+						break;
+					case REPLAY_HANDOVER:
+						readfd = -1;
+						goto read_handover;
+				}
+				goto read_repeat;
+			}
+		} else if (read_cfg->type == T_PCAP) {
+			readfd = open(read_cfg->name, O_RDONLY);
+			if (readfd == -1) {
+				warn("Error while opening %s for reading: ",
+					read_cfg->name);
+				read_cfg->exit_status = -1;
+				goto read_repeat;
+			} else if (read_cfg->test_only) {
+				close(readfd);
+				exit_thread(read_cfg, 0);
+			}
+			switch (pcap_replay(cfg, &pc, readfd)) {
+				case REPLAY_KILL:
+					read_cfg->retry = KILL;
+					break;
+				case REPLAY_ERR:
+					read_cfg->exit_status = -1;
+					break;
+				case REPLAY_END:
+					read_cfg->exit_status = 0;
+					break;
+				case REPLAY_HANDOVER:
+					readfd = -1;
+					goto read_handover;
+			}
+			goto read_repeat;
+		} else if ((read_cfg->type == T_SOCKET &&
+			read_cfg->protocol == IPPROTO_TCP) ||
+			(read_cfg->type == T_UNIX &&
+			read_cfg->socktype != SOCK_DGRAM)) {
 
 			tdprint((void *)read_cfg, DEBUG, "Socket\n");
-			if (listenfd == -1) {
+			if (listenfd == -1 && read_cfg->type == T_UNIX) {
+				listenfd = unix_socket(read_cfg);
+				if (listenfd == -1) {
+					read_cfg->exit_status = -1;
+					goto read_repeat;
+				}
+			} else if (listenfd == -1) {
 				struct addrinfo hints;
 				memset(&hints, 0, sizeof (struct addrinfo));
 				hints.ai_family = AF_UNSPEC;
@@ -205,10 +975,12 @@ void * read_endpt(void * args) {
 
 				int res;
 				struct addrinfo * addrinfo;
-				res = getaddrinfo(NULL,
-					read_cfg->port,
-					&hints,
-					&addrinfo);
+				if (!FAULT(read_cfg, FOP_RESOLVE, &res)) {
+					res = getaddrinfo(NULL,
+						read_cfg->port,
+						&hints,
+						&addrinfo);
+				}
 				if (res) {
 					tdprint((void *)read_cfg,
 						ERR,
@@ -227,6 +999,7 @@ void * read_endpt(void * args) {
 						aiptr->ai_protocol);
 					if (listenfd == -1)
 						continue;
+					set_sock_options(listenfd, read_cfg);
 					tdprint((void *)read_cfg,
 						DEBUG,
 						"Binding\n");
@@ -247,7 +1020,7 @@ void * read_endpt(void * args) {
 					goto read_repeat;
 				}
 				tdprint((void *)read_cfg, DEBUG, "Listening\n");
-				if (listen(listenfd, 1)) {
+				if (listen(listenfd, LISTEN_BACKLOG)) {
 					warn("Could not listen on port %s\n",
 						read_cfg->port);
 					read_cfg->exit_status = -1;
@@ -257,6 +1030,8 @@ void * read_endpt(void * args) {
 
 			if (read_cfg->test_only) {
 				close(listenfd);
+				if (read_cfg->type == T_UNIX)
+					unlink(read_cfg->name);
 				exit_thread(read_cfg, 0);
 			}
 
@@ -264,7 +1039,8 @@ void * read_endpt(void * args) {
 			int res = wait_for_event((void *) read_cfg,
 				"accept",
 				listenfd,
-				signal_fds[0]);
+				signal_fds[0],
+				NULL);
 			switch (res) {
 				case WFE_POLL_ERR:
 					close(listenfd);
@@ -276,6 +1052,9 @@ void * read_endpt(void * args) {
 					read_cfg->retry = KILL;
 					goto read_repeat;
 					break;
+				case WFE_HANDOVER:
+					readfd = -1;
+					goto read_handover;
 				case WFE_EVT:
 					break;
 			}
@@ -286,11 +1065,18 @@ void * read_endpt(void * args) {
 				read_cfg->exit_status = -1;
 				goto read_repeat;
 			}
+			if (read_cfg->type == T_SOCKET)
+				set_sock_options(readfd, read_cfg);
 			if (read_cfg->keepalive != 0) {
 				set_keepalive(readfd,
 					read_cfg,
 					read_cfg->keepalive);
 			}
+			if (read_cfg->tls && tls_start(read_cfg, readfd) == -1) {
+				close(readfd);
+				read_cfg->exit_status = -1;
+				goto read_repeat;
+			}
 			tdprint((void *)read_cfg, DEBUG, "Reading\n");
 
 		} else if (read_cfg->type == T_SOCKET &&
@@ -304,12 +1090,21 @@ void * read_endpt(void * args) {
 			hints.ai_flags = AI_PASSIVE;
 			hints.ai_protocol = 0;
 
+			// Multicast group is bound directly, so that only
+			// datagrams for the group are received
+			int mcast;
+			mcast = name_is_multicast(read_cfg->name);
+			if (mcast)
+				hints.ai_flags |= AI_NUMERICHOST;
+
 			int res;
 			struct addrinfo * addrinfo;
-			res = getaddrinfo(NULL,
-				read_cfg->port,
-				&hints,
-				&addrinfo);
+			if (!FAULT(read_cfg, FOP_RESOLVE, &res)) {
+				res = getaddrinfo(mcast ? read_cfg->name : NULL,
+					read_cfg->port,
+					&hints,
+					&addrinfo);
+			}
 			if (res) {
 				tdprint((void *)read_cfg,
 					ERR,
@@ -328,13 +1123,40 @@ void * read_endpt(void * args) {
 					aiptr->ai_protocol);
 				if (readfd == -1)
 					continue;
+				set_sock_options(readfd, read_cfg);
+				if (mcast) {
+					int optval = 1;
+					if (setsockopt(readfd,
+						SOL_SOCKET,
+						SO_REUSEADDR,
+						&optval,
+						sizeof (optval)) < 0) {
+
+						tdprint((void *)read_cfg,
+							WARN,
+							"Could not set "
+							"SO_REUSEADDR\n");
+					}
+				}
 				tdprint((void *)read_cfg, DEBUG, "Binding\n");
 				if (bind(readfd,
 					aiptr->ai_addr,
-					aiptr->ai_addrlen) == 0)
+					aiptr->ai_addrlen) == 0) {
 
-					break;
+					if (!mcast)
+						break;
+					tdprint((void *)read_cfg,
+						DEBUG,
+						"Joining group %s\n",
+						read_cfg->name);
+					if (join_mcast_group(readfd,
+						aiptr->ai_addr,
+						read_cfg) == 0)
+
+						break;
+				}
 				close(readfd);
+				readfd = -1;
 			}
 			freeaddrinfo(addrinfo);
 			if (readfd == -1) {
@@ -352,6 +1174,31 @@ void * read_endpt(void * args) {
 				exit_thread(read_cfg, 0);
 			}
 
+		} else if (read_cfg->type == T_UNIX) {
+			tdprint((void *)read_cfg, DEBUG, "Unix socket\n");
+			readfd = unix_socket(read_cfg);
+			if (readfd == -1) {
+				read_cfg->exit_status = -1;
+				goto read_repeat;
+			}
+			if (read_cfg->test_only) {
+				close(readfd);
+				unlink(read_cfg->name);
+				exit_thread(read_cfg, 0);
+			}
+
+		} else if (read_cfg->type == T_FIFO) {
+			tdprint((void *)read_cfg, DEBUG, "Pipe\n");
+			readfd = fifo_open(read_cfg);
+			if (readfd == -1) {
+				read_cfg->exit_status = -1;
+				goto read_repeat;
+			}
+			if (read_cfg->test_only) {
+				close(readfd);
+				exit_thread(read_cfg, 0);
+			}
+
 		} else if (read_cfg->type == T_STD) {
 			tdprint((void *)read_cfg, DEBUG, "Stdin\n");
 			readfd = 0;
@@ -361,19 +1208,29 @@ void * read_endpt(void * args) {
 
 		}
 
+		// Each read of a datagram socket returns one message
+		int msgs;
+		msgs = (read_cfg->type == T_SOCKET &&
+			read_cfg->protocol == IPPROTO_UDP) ||
+			(read_cfg->type == T_UNIX &&
+			read_cfg->socktype != SOCK_STREAM);
 		char * readbuf;
-		readbuf = malloc(sizeof (char)*READ_BUFFER_BLOCK_SIZE);
+		readbuf = malloc(sizeof (char)*readsize);
 		while (1) {
 			tdprint((void *)read_cfg, DEBUG, "Rereading\n");
 			size_t toread;
 			size_t nread;
-			toread = READ_BUFFER_BLOCK_SIZE;
+			toread = readsize;
 			nread = 0;
 			while (nread < toread) {
+				// Missing frames are given up also when
+				// nothing comes
 				int res = wait_for_event((void *) read_cfg,
 					"read",
 					readfd,
-					signal_fds[0]);
+					signal_fds[0],
+					df != NULL && df->arq != NULL ?
+					&arq_tick : NULL);
 				switch (res) {
 					case WFE_POLL_ERR:
 						close(readfd);
@@ -385,24 +1242,42 @@ void * read_endpt(void * args) {
 						read_cfg->retry = KILL;
 						goto read_repeat;
 						break;
+					case WFE_HANDOVER:
+						// Data read so far go on
+						publish_read(read_cfg, df, dc,
+							readbuf, nread);
+						free(readbuf);
+						goto read_handover;
+					case WFE_TIMEOUT:
+						publish_read(read_cfg, df, dc,
+							readbuf, 0);
+						continue;
 					case WFE_EVT:
 						break;
 				}
 
-				if (read_cfg->type == T_SOCKET &&
+				perf_begin(&pt);
+				if (FAULT(read_cfg, FOP_READ, &res)) {
+					// Injected fault replaces the read
+				} else if (read_cfg->type == T_SOCKET &&
 					read_cfg->protocol == IPPROTO_UDP) {
 
-					struct sockaddr from_addr;
+					struct sockaddr_storage from_addr;
 					socklen_t from_addrlen;
-					// From sys/socket.h, does
-					// exist more correct system?
-					from_addrlen = 14;
+					from_addrlen = sizeof (from_addr);
 					res = recvfrom(readfd,
 						(void *)readbuf,
-						READ_BUFFER_BLOCK_SIZE,
+						readsize,
 						0,
-						&from_addr,
+						(struct sockaddr *)&from_addr,
 						&from_addrlen);
+					// NACKs go to the sender
+					if (res > 0 && df != NULL &&
+						df->arq != NULL)
+						arq_rx_peer(df->arq, readfd,
+							(struct sockaddr *)
+							&from_addr,
+							from_addrlen);
 
 					tdprint((void *)read_cfg,
 						INFO,
@@ -413,12 +1288,18 @@ void * read_endpt(void * args) {
 						(void *)(readbuf+nread),
 						(toread-nread));
 				}
+				perf_end(&pt, PS_READ, res > 0 ? res : 0);
 				if (res == 0) { // EOF
+					int published;
 					close(readfd);
-					for (int i = 0; i < cfg->n_outs; i++) {
-						buffer_insert(cfg->outs[i].buf,
-							readbuf,
-							nread);
+					perf_begin(&pt);
+					published = publish_read(read_cfg, df,
+						dc, readbuf, nread);
+					perf_end(&pt, PS_INSERT, nread);
+					if (published == -1) {
+						tdprint((void *)read_cfg, ERR,
+							"Corrupted compressed "
+							"stream\n");
 					}
 					free(readbuf);
 					read_cfg->exit_status = 0;
@@ -432,15 +1313,35 @@ void * read_endpt(void * args) {
 					goto read_repeat;
 				}
 				nread += res;
-				if (read_cfg->type == T_SOCKET &&
-					read_cfg->protocol == IPPROTO_UDP) {
+				TRACE2(chunk_read, read_cfg->name, res);
+				if (read_cfg->fail_since != 0)
+					mark_recovered(read_cfg);
+				if (msgs)
 					break;
-				}
 			}
-			for (int i = 0; i < cfg->n_outs; i++) {
-				buffer_insert(cfg->outs[i].buf, readbuf, nread);
+			int published;
+			perf_begin(&pt);
+			published = publish_read(read_cfg, df, dc, readbuf,
+				nread);
+			perf_end(&pt, PS_INSERT, nread);
+			if (published == -1) {
+				tdprint((void *)read_cfg, ERR,
+					"Corrupted compressed stream\n");
+				close(readfd);
+				free(readbuf);
+				read_cfg->exit_status = -1;
+				goto read_repeat;
 			}
+			// Each datagram carries whole frames
+			if (df != NULL && msgs)
+				deframe_reset(df);
 		}
+	read_handover:
+		// Sockets stay open for the new process
+		input_handover(read_cfg, listenfd, readfd, df, dc);
+		tdprint((void *)read_cfg, INFO, "Input handed over\n");
+		publish_end(read_cfg, BUF_HANDOVER);
+		exit_thread(read_cfg, 0);
 	read_repeat:
 		if (read_cfg->test_only) {
 			exit_thread(read_cfg, read_cfg->exit_status);
@@ -450,33 +1351,44 @@ void * read_endpt(void * args) {
 				tdprint((void *)read_cfg,
 					INFO,
 					"Retrying read\n");
+				mark_failure(read_cfg);
+				TRACE2(reconnect, read_cfg->name,
+					read_cfg->failures);
+				if (cfg->sel != NULL) {
+					selector_down(cfg->sel,
+						read_cfg-cfg->input);
+				}
 				break;
 			case KILL:
 				close(listenfd);
+				if (read_cfg->type == T_UNIX)
+					unlink(read_cfg->name);
 				tdprint((void *)read_cfg,
 					INFO,
 					"Ending read\n");
-				for (int i = 0; i < cfg->n_outs; i++) {
-					buffer_insert(cfg->outs[i].buf,
-						NULL,
-						BUF_KILL);
-				}
+				publish_end(read_cfg, BUF_KILL);
 				exit_thread(read_cfg, -2);
 			case NO:
 			case IGNORE:
 				close(listenfd);
+				if (read_cfg->type == T_UNIX)
+					unlink(read_cfg->name);
 				tdprint((void *)read_cfg,
 					INFO,
 					"Ending read\n");
-				for (int i = 0; i < cfg->n_outs; i++) {
-					buffer_insert(cfg->outs[i].buf,
-						NULL,
-						BUF_END_DATA);
+				// Other inputs continue the stream
+				int running;
+				running = publish_end(read_cfg, BUF_END_DATA);
+				if (running > 0) {
+					tdprint((void *)read_cfg, WARN,
+						"Input ended, %d inputs left\n",
+						running);
+					exit_thread(read_cfg, 0);
 				}
 				exit_thread(read_cfg, read_cfg->exit_status);
 
 		}
-		sleep(RETRY_DELAY);
+		sleep_ms(read_cfg->retry_delay);
 	} while (1);
 	// Should be unreachable
 	exit_thread(read_cfg, read_cfg->exit_status);
@@ -499,14 +1411,64 @@ void * write_endpt(void * args) {
 		tdprint(args, WARN, "Error in signal setup\n");
 		exit_thread(cfg, -1);
 	}
+	prio_thread(cfg);
+	struct perf_thread pt;
+	perf_thread_open(&pt, cfg);
 
 	int writefd = -1;
+	// FEC of framed UDP output
+	struct fec_enc * fec;
+	fec = NULL;
+	if (cfg->fec_cols > 0) {
+		fec = fec_enc_create(cfg->fec_cols, cfg->fec_rows,
+			FRAME_HEADER_SIZE+cfg->buf->it_size);
+		if (fec == NULL) {
+			tdprint(args, ERR, "Failed to initialize FEC\n");
+			exit_thread(cfg, -1);
+		}
+	}
+	// Sent chunks kept for retransmission by ARQ
+	struct arq_tx arq;
+	arq.running = 0;
+	if (cfg->arq > 0 && arq_tx_init(&arq, cfg) == -1) {
+		tdprint(args, ERR, "Failed to initialize ARQ\n");
+		exit_thread(cfg, -1);
+	}
+	// Zero copy state of TCP output
+	struct zerocopy zc;
+	zc.count = 0;
+	zc.on = 0;
+	// Repacketizer of UDP output
+	struct repack rp;
+	struct recorder rec;
+	rec.segment = 0;
+	struct shm_out shm;
 	do  {
 		tdprint(args, INFO, "Start writing\n", args);
+		// Chunks of the previous connection are not sent anymore
+		buffer_release(cfg->buf, zc.count);
+		zc.count = 0;
+		zc.on = 0;
 		// For use in sendto
-		struct sockaddr * addr = NULL;
+		struct sockaddr_storage addr;
 		socklen_t addrlen = 0;
-		if (cfg->type == T_FILE) {
+		if (cfg->ho_fd != -1) {
+			tdprint(args, INFO, "Continuing with socket taken over\n");
+			writefd = cfg->ho_fd;
+			cfg->ho_fd = -1;
+			memcpy(&addr, &cfg->ho_addr, cfg->ho_addrlen);
+			addrlen = cfg->ho_addrlen;
+		} else if (cfg->type == T_FILE && cfg->record) {
+			if (rec_open(&rec, cfg) == -1) {
+				cfg->exit_status = -1;
+				goto write_repeat;
+			}
+			writefd = rec.fd;
+			if (cfg->test_only) {
+				rec_close(&rec);
+				exit_thread(cfg, 0);
+			}
+		} else if (cfg->type == T_FILE) {
 			writefd = open(cfg->name, O_WRONLY | O_CREAT | O_TRUNC,
 				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 			if (writefd == -1) {
@@ -534,10 +1496,12 @@ void * write_endpt(void * args) {
 
 			int res;
 			struct addrinfo * addrinfo;
-			res = getaddrinfo(cfg->name,
-				cfg->port,
-				&hints,
-				&addrinfo);
+			if (!FAULT(cfg, FOP_RESOLVE, &res)) {
+				res = getaddrinfo(cfg->name,
+					cfg->port,
+					&hints,
+					&addrinfo);
+			}
 			if (res) {
 				tdprint(args,
 					ERR,
@@ -551,21 +1515,41 @@ void * write_endpt(void * args) {
 				aiptr != NULL;
 				aiptr = aiptr->ai_next) {
 
-				addr = aiptr->ai_addr;
+				memcpy(&addr, aiptr->ai_addr, aiptr->ai_addrlen);
 				addrlen = aiptr->ai_addrlen;
 				writefd = socket(aiptr->ai_family,
 					aiptr->ai_socktype,
 					aiptr->ai_protocol);
 				if (writefd == -1)
 					continue;
-				if (cfg->protocol == IPPROTO_UDP)
-					break;
+				set_sock_options(writefd, cfg);
+				if (cfg->protocol == IPPROTO_UDP) {
+					if (!is_multicast(aiptr->ai_addr) ||
+						set_mcast_output(writefd,
+						aiptr->ai_addr,
+						cfg) == 0)
+
+						break;
+					close(writefd);
+					writefd = -1;
+					continue;
+				}
 				if (cfg->keepalive != 0) {
 					set_keepalive(writefd,
 						args,
 						cfg->keepalive);
 				}
-				if (connect(writefd, addr, addrlen) != -1)
+				// Probe does not wait for unreachable outputs
+				if (cfg->test_only && probe_connect(cfg,
+					writefd,
+					aiptr->ai_addr,
+					aiptr->ai_addrlen) != -1)
+					break;
+				if (!cfg->test_only &&
+					!FAULT(cfg, FOP_CONNECT, &res) &&
+					connect(writefd,
+					aiptr->ai_addr,
+					aiptr->ai_addrlen) != -1)
 					break;
 				close(writefd);
 				writefd = -1;
@@ -579,11 +1563,52 @@ void * write_endpt(void * args) {
 				cfg->exit_status = -1;
 				goto write_repeat;
 			}
+			if (cfg->tls && tls_start(cfg, writefd) == -1) {
+				close(writefd);
+				cfg->exit_status = -1;
+				goto write_repeat;
+			}
+			if (cfg->test_only) {
+				if (cfg->probe_size > 0 &&
+					probe_burst(cfg, writefd) == -1) {
+
+					tdprint(args, ERR, "Probe burst "
+						"failed: %s\n",
+						strerror(errno));
+					cfg->exit_status = -1;
+				} else  {
+					cfg->exit_status = 0;
+				}
+				close(writefd);
+				exit_thread(cfg, cfg->exit_status);
+			}
+			if (cfg->zerocopy)
+				zc_start(&zc, cfg, writefd);
+
+		} else if (cfg->type == T_UNIX || cfg->type == T_FIFO) {
+			if (cfg->type == T_UNIX)
+				writefd = unix_socket(cfg);
+			else
+				writefd = fifo_open(cfg);
+			if (writefd == -1) {
+				cfg->exit_status = -1;
+				goto write_repeat;
+			}
 			if (cfg->test_only) {
 				close(writefd);
 				exit_thread(cfg, 0);
 			}
 
+		} else if (cfg->type == T_SHM) {
+			if (shm_out_open(&shm, cfg) == -1) {
+				cfg->exit_status = -1;
+				goto write_repeat;
+			}
+			if (cfg->test_only) {
+				shm_out_close(&shm);
+				exit_thread(cfg, 0);
+			}
+
 		} else if (cfg->type == T_STD) {
 			writefd = 1;
 			if (cfg->test_only) {
@@ -591,60 +1616,233 @@ void * write_endpt(void * args) {
 			}
 		}
 
+		// Bytes which can be written before unsent data are checked
+		ssize_t budget;
+		unsigned long dropped;
+		int unsent_warned;
+		budget = 0;
+		dropped = 0;
+		unsent_warned = 0;
 		char * writebuf;
+		char hdrbuf[FRAME_HEADER_SIZE];
+		char * hdr;
+		hdr = cfg->framing ? hdrbuf : NULL;
+		if (cfg->packet_size > 0)
+			repack_start(&rp, cfg, (struct sockaddr *)&addr, addrlen);
+		if (cfg->arq > 0 && arq_tx_start(&arq, writefd,
+			(struct sockaddr *)&addr, addrlen) == -1) {
+
+			tdprint(args, ERR, "Failed to start ARQ\n");
+			close(writefd);
+			cfg->exit_status = -1;
+			goto write_repeat;
+		}
 		while (1)  {
 			size_t towrite;
+			perf_begin(&pt);
 			towrite = buffer_after_delete(cfg->buf);
+			perf_end(&pt, PS_DRAIN,
+				(ssize_t)towrite > 0 ? towrite : 0);
+			// The rest of the stream is sent in a short datagram
+			if ((towrite == BUF_END_DATA || towrite == BUF_HANDOVER) &&
+				cfg->packet_size > 0 &&
+				repack_flush(&rp, writefd, 1) == -1)
+				warn("Error in sending data\n");
 			if (towrite == BUF_END_DATA) {
 				cfg->exit_status = 0;
 				tdprint(args, INFO, "End of data\n", args);
-				close(writefd);
+				// The last frames may still be requested
+				arq_tx_stop(&arq, 1);
+				if (cfg->type == T_SHM) {
+					shm_out_close(&shm);
+				} else if (cfg->record && rec_close(&rec) == -1) {
+					warn("Error in closing recording");
+					cfg->exit_status = -1;
+				} else if (!cfg->record) {
+					close(writefd);
+				}
 				exit_thread(cfg, cfg->exit_status);
 			}
+			if (towrite == BUF_HANDOVER) {
+				tdprint(args, INFO, "Output handed over\n");
+				arq_tx_stop(&arq, 0);
+				if (cfg->type == T_SHM) {
+					shm_out_close(&shm);
+				} else if (cfg->record) {
+					rec_close(&rec);
+				} else if (cfg->tls) {
+					close(writefd);
+				} else if (cfg->type != T_STD) {
+					// Kept open for the new process
+					cfg->ho_fd = writefd;
+					memcpy(&cfg->ho_addr, &addr, addrlen);
+					cfg->ho_addrlen = addrlen;
+				}
+				exit_thread(cfg, 0);
+			}
 			if (towrite == BUF_KILL) {
 				cfg->exit_status = -2;
+				arq_tx_stop(&arq, 0);
 				tdprint(args,
 					INFO,
 					"End required by signal\n",
 					args);
-				close(writefd);
+				if (cfg->type == T_SHM)
+					shm_out_close(&shm);
+				else if (cfg->record)
+					rec_close(&rec);
+				else
+					close(writefd);
 				exit_thread(cfg, cfg->exit_status);
 			}
+			if (towrite > 0)
+				egress_take(cfg, towrite);
+			// Each chunk is kept, so that held chunks stay just
+			// before the consumer position
+			if (cfg->arq > 0)
+				arq_tx_keep(&arq);
 			writebuf = buffer_cons_data_pointer(cfg->buf);
-			if (cfg->type == T_SOCKET &&
+			if (hdr != NULL) {
+				// Empty chunks are not sent in frames
+				if (towrite == 0)
+					continue;
+				struct chunk_meta meta;
+				buffer_cons_meta(cfg->buf, &meta);
+				frame_header(hdr, FRAME_DATA, &meta, writebuf,
+					towrite);
+			}
+			TRACE3(write_start, cfg->buf, cfg->name, towrite);
+			perf_begin(&pt);
+			if (cfg->packet_size > 0) {
+				// Datagrams are sent in a batch when no more
+				// data wait
+				if (repack_add(&rp, writefd, writebuf,
+					towrite) == -1 ||
+					(buffer_waiting(cfg->buf) == 0 &&
+					repack_flush(&rp, writefd, 0) == -1))
+					warn("Error in sending data\n");
+			} else if (cfg->type == T_SOCKET &&
 				cfg->protocol == IPPROTO_UDP) {
 
-				ssize_t res;
-				res = sendto(writefd,
-					writebuf,
-					towrite,
-					0,
-					addr,
-					addrlen);
-				if (res == -1)
+				struct iovec iov[2];
+				struct msghdr msg;
+				memset(&msg, 0, sizeof (msg));
+				msg.msg_name = &addr;
+				msg.msg_namelen = addrlen;
+				msg.msg_iov = iov;
+				msg.msg_iovlen = 0;
+				if (hdr != NULL) {
+					iov[0].iov_base = hdr;
+					iov[0].iov_len = FRAME_HEADER_SIZE;
+					msg.msg_iovlen++;
+				}
+				iov[msg.msg_iovlen].iov_base = writebuf;
+				iov[msg.msg_iovlen++].iov_len = towrite;
+				int res;
+				if (FAULT(cfg, FOP_WRITE, &res)) {
+					// Injected fault loses the datagram
+				} else if (sendmsg(writefd, &msg, 0) == -1) {
 					warn("Error in sending data\n");
+				}
+				int nfec;
+				nfec = 0;
+				if (fec != NULL)
+					nfec = fec_enc_add(fec, hdr, writebuf,
+						towrite);
+				for (int i = 0; i < nfec; i++) {
+					res = sendto(writefd,
+						fec->ready[i],
+						fec->ready_len[i],
+						0,
+						(struct sockaddr *)&addr,
+						addrlen);
+					if (res == -1)
+						warn("Error in sending FEC\n");
+				}
+			} else if (cfg->type == T_SHM) {
+				shm_out_write(&shm, writebuf, towrite);
+			} else if (cfg->record) {
+				if (rec_write(&rec, writebuf, towrite) == -1) {
+					warn("Error in writing recording");
+					cfg->exit_status = -1;
+					rec_close(&rec);
+					goto write_repeat;
+				}
 			} else  {
-				int nwritten;
-				nwritten = 0;
-				while (nwritten < towrite) {
-					ssize_t res;
-					res = write(writefd,
-						(void *)(writebuf+nwritten),
-						towrite-nwritten);
-					if (res < 0) {
-						warn("Error in sending data");
-						cfg->exit_status = -1;
-						close(writefd);
-						goto write_repeat;
+				size_t nframe;
+				nframe = towrite;
+				if (hdr != NULL)
+					nframe += FRAME_HEADER_SIZE;
+				if (cfg->max_unsent > 0 &&
+					budget < (ssize_t)nframe) {
+
+					budget = unsent_budget(writefd, cfg,
+						&unsent_warned);
+					if (budget < (ssize_t)nframe) {
+						TRACE3(drop, cfg->buf, 1,
+							TRACE_DROP_SLOW);
+						if (dropped++ == 0) {
+							tdprint(args, WARN,
+								"Receiver is slow, "
+								"dropping data\n");
+						}
+						continue;
+					}
+				}
+				if (dropped > 0) {
+					tdprint(args, WARN, "%lu chunks dropped\n",
+						dropped);
+					dropped = 0;
+				}
+				budget -= nframe;
+				// Zero copy sends data from the buffer, which is
+				// kept until the kernel completes the send
+				int res;
+				if (FAULT(cfg, FOP_WRITE, &res)) {
+					// Injected fault replaces the write
+				} else if (zc.on && buffer_hold(cfg->buf) == 0) {
+					res = zc_write(&zc, writefd, hdr, writebuf,
+						towrite);
+					if (res == 0) {
+						int ndone;
+						ndone = zc_reap(&zc, writefd);
+						if (ndone == -1)
+							res = -1;
+						else
+							buffer_release(cfg->buf,
+								ndone);
 					}
-					nwritten += res;
+				} else  {
+					res = write_all(writefd, hdr, writebuf,
+						towrite);
+				}
+				if (res == -1) {
+					warn("Error in sending data");
+					cfg->exit_status = -1;
+					close(writefd);
+					goto write_repeat;
 				}
 			}
+			TRACE3(write_done, cfg->buf, cfg->name, towrite);
+			perf_end(&pt, PS_WRITE, towrite);
+			if (cfg->fail_since != 0)
+				mark_recovered(cfg);
 		}
 	write_repeat:
+		arq_tx_stop(&arq, 0);
+		if (cfg->test_only) {
+			exit_thread(cfg, cfg->exit_status);
+		}
+		// Data left in buffer are handed over
+		if (upgrade_pending()) {
+			tdprint(args, INFO, "Output handed over\n");
+			exit_thread(cfg, 0);
+		}
 		switch (cfg->retry) {
 			case YES:
 				tdprint(args, INFO, "Retrying\n", args);
+				mark_failure(cfg);
+				TRACE2(reconnect, cfg->name, cfg->failures);
 				break;
 			case NO:
 				tdprint(args, INFO, "Terminating\n", args);
@@ -654,7 +1852,7 @@ void * write_endpt(void * args) {
 				tdprint(args, INFO, "Terminating\n", args);
 				exit_thread(cfg, 0);
 		}
-		sleep(RETRY_DELAY);
+		sleep_ms(cfg->retry_delay);
 
 	} while (1);
 
@@ -1,10 +1,23 @@
 #ifndef ENDPTS_H
 #define	ENDPTS_H
 
+#include <time.h>
 #include "netstream.h"
 
+#define	WFE_EVT 0
+#define	WFE_SIG_TERM -1
+#define	WFE_POLL_ERR -2
+#define	WFE_TIMEOUT -3
+#define	WFE_HANDOVER -4
+
+// Not a signal, written to the signal pipe to stop endpoints for handover
+#define	SIG_HANDOVER 127
+
 void * read_endpt(void * args);
 void * write_endpt(void * args);
+int unsent_supported(void);
+int wait_for_event(void * id, char * name, int listenfd, int signalfd,
+	struct timespec * timeout);
 extern int * signal_fds;
 
 #endif
@@ -0,0 +1,222 @@
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <time.h>
+
+#include "netstream.h"
+#include "fault.h"
+
+#ifdef FAULTS
+
+// Kinds of faults
+enum fault_kind {
+	FK_READ, 		// Read error
+	FK_EOF, 		// End of stream
+	FK_STALL, 		// Delayed read or write
+	FK_WRITE, 		// Write error
+	FK_CONNECT, 		// Connection refused
+	FK_RESOLVE 		// Resolver failure
+};
+
+static const char * kind_names[] = {
+	"read", "eof", "stall", "write", "connect", "resolve"
+};
+#define	N_KINDS (int)(sizeof (kind_names)/sizeof (kind_names[0]))
+
+// Rule of fault injection
+struct fault_rule {
+	enum fault_kind kind; 	// Kind of fault
+	enum endpt_dir dir; 	// Direction of endpoints
+	int index; 		// Index of endpoint (-1 - all)
+	unsigned long first; 	// First failing call
+	unsigned long count; 	// Number of failing calls
+};
+
+static struct io_cfg * fault_cfg;
+static struct fault_rule * rules;
+static int n_rules;
+// Calls of operations, FOP_COUNT counters for each input, then each output
+static unsigned long * calls;
+
+/* Returns operation failed by fault of kind on endpoint of direction dir */
+static enum fault_op kind_op(enum fault_kind kind, enum endpt_dir dir) {
+	switch (kind) {
+		case FK_READ:
+		case FK_EOF:
+			return (FOP_READ);
+		case FK_STALL:
+			return (dir == DIR_INPUT ? FOP_READ : FOP_WRITE);
+		case FK_WRITE:
+			return (FOP_WRITE);
+		case FK_CONNECT:
+			return (FOP_CONNECT);
+		case FK_RESOLVE:
+			break;
+	}
+	return (FOP_RESOLVE);
+}
+
+/*
+ * Parse rule `kind@endpoint:n[xcount]` from str into r.
+ *
+ * Returns 0 on success, -1 if the rule is not valid.
+ */
+static int parse_rule(char * str, struct fault_rule * r) {
+	char kind[16];
+	char ep[16];
+	char * num;
+	int len;
+	int k;
+	len = 0;
+	if (sscanf(str, "%15[a-z]@%15[a-z0-9]:%lu%n", kind, ep, &r->first,
+		&len) != 3 || r->first == 0)
+		return (-1);
+	r->count = 1;
+	if (str[len] == 'x') {
+		char * end;
+		r->count = strtoul(str+len+1, &end, 10);
+		if (end == str+len+1 || *end != '\0' || r->count == 0)
+			return (-1);
+	} else if (str[len] != '\0') {
+		return (-1);
+	}
+	k = -1;
+	for (int i = 0; i < N_KINDS; i++) {
+		if (strcmp(kind, kind_names[i]) == 0)
+			k = i;
+	}
+	if (k == -1)
+		return (-1);
+	r->kind = k;
+	if (strncmp(ep, "in", 2) == 0) {
+		r->dir = DIR_INPUT;
+		num = ep+2;
+	} else if (strncmp(ep, "out", 3) == 0) {
+		r->dir = DIR_OUTPUT;
+		num = ep+3;
+	} else  {
+		return (-1);
+	}
+	r->index = -1;
+	if (*num != '\0') {
+		char * end;
+		r->index = strtol(num, &end, 10);
+		if (*end != '\0')
+			return (-1);
+	}
+	if ((r->kind == FK_READ || r->kind == FK_EOF) && r->dir != DIR_INPUT)
+		return (-1);
+	if ((r->kind == FK_WRITE || r->kind == FK_CONNECT) &&
+		r->dir != DIR_OUTPUT)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Load fault rules for endpoints of cfg from NETSTREAM_FAULTS.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int fault_init(struct io_cfg * cfg) {
+	char * env;
+	char * spec;
+	char * saveptr;
+	env = getenv("NETSTREAM_FAULTS");
+	if (env == NULL)
+		return (0);
+	fault_cfg = cfg;
+	calls = calloc((size_t)(cfg->n_inputs+cfg->n_outs)*FOP_COUNT,
+		sizeof (unsigned long));
+	spec = strdup(env);
+	if (calls == NULL || spec == NULL)
+		return (-1);
+	for (char * tok = strtok_r(spec, ",", &saveptr); tok != NULL;
+		tok = strtok_r(NULL, ",", &saveptr)) {
+
+		struct fault_rule * tmp;
+		tmp = realloc(rules, sizeof (struct fault_rule)*(n_rules+1));
+		if (tmp == NULL) {
+			free(spec);
+			return (-1);
+		}
+		rules = tmp;
+		if (parse_rule(tok, &rules[n_rules]) == -1) {
+			dprint(ERR, "Invalid fault rule \"%s\"\n", tok);
+			free(spec);
+			return (-1);
+		}
+		n_rules++;
+	}
+	free(spec);
+	dprint(WARN, "Injecting faults: %s\n", env);
+	return (0);
+}
+
+/*
+ * Count a call of operation op of endpoint cfg and decide if it fails. A
+ * stalled call is delayed here and then done.
+ *
+ * Returns 1 if the call must not be done, its result is stored to res
+ * (errno is set), 0 if the call is done.
+ */
+int fault_check(struct endpt_cfg * cfg, enum fault_op op, int * res) {
+	enum endpt_dir dir;
+	int index;
+	unsigned long n;
+	if (calls == NULL)
+		return (0);
+	if (cfg >= fault_cfg->input &&
+		cfg < fault_cfg->input+fault_cfg->n_inputs) {
+
+		dir = DIR_INPUT;
+		index = cfg-fault_cfg->input;
+		n = ++calls[index*FOP_COUNT+op];
+	} else  {
+		dir = DIR_OUTPUT;
+		index = cfg-fault_cfg->outs;
+		n = ++calls[(fault_cfg->n_inputs+index)*FOP_COUNT+op];
+	}
+	for (int i = 0; i < n_rules; i++) {
+		struct fault_rule * r;
+		r = &rules[i];
+		if (r->dir != dir || (r->index != -1 && r->index != index) ||
+			kind_op(r->kind, dir) != op || n < r->first ||
+			n >= r->first+r->count)
+			continue;
+		tdprint(cfg, WARN, "Injected %s fault (call %lu)\n",
+			kind_names[r->kind], n);
+		switch (r->kind) {
+			case FK_READ:
+				errno = EIO;
+				*res = -1;
+				return (1);
+			case FK_EOF:
+				*res = 0;
+				return (1);
+			case FK_STALL: {
+				struct timespec ts;
+				ts.tv_sec = FAULT_STALL/1000;
+				ts.tv_nsec = (FAULT_STALL%1000)*1000000L;
+				nanosleep(&ts, NULL);
+				return (0);
+			}
+			case FK_WRITE:
+				errno = EPIPE;
+				*res = -1;
+				return (1);
+			case FK_CONNECT:
+				errno = ECONNREFUSED;
+				*res = -1;
+				return (1);
+			case FK_RESOLVE:
+				*res = EAI_AGAIN;
+				return (1);
+		}
+	}
+	return (0);
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FAULT_H
+#define	FAULT_H
+
+#include "netstream.h"
+
+/*
+ * Deterministic fault injection for failure-recovery benchmarks, built only
+ * with `make FAULTS=1`. Faults are read from the NETSTREAM_FAULTS environment
+ * variable, a comma separated list of rules `kind@endpoint:n[xcount]`: the
+ * n-th call (from 1) of the operation of the endpoint and count following
+ * ones (default 1) fail. Endpoint is `inN` or `outN`, `in` or `out` for all
+ * of them. Calls are counted per endpoint since start, so a run with the
+ * same input always fails at the same places.
+ *
+ * Kinds: `read` (read error), `eof` (end of stream), `stall` (read or write
+ * is delayed by FAULT_STALL ms), `write` (write error), `connect` (connection
+ * refused) and `resolve` (resolver failure).
+ */
+#define	FAULT_STALL 1000 	// Delay of a stalled call in ms
+
+// Operations which can fail
+enum fault_op {
+	FOP_READ, 		// Read of input
+	FOP_WRITE, 		// Write of output (loss of UDP datagram)
+	FOP_CONNECT, 		// Connect of TCP output
+	FOP_RESOLVE, 		// getaddrinfo of socket endpoint
+	FOP_COUNT
+};
+
+#ifdef FAULTS
+int fault_init(struct io_cfg * cfg);
+int fault_check(struct endpt_cfg * cfg, enum fault_op op, int * res);
+#define	FAULT(cfg, op, res) fault_check(cfg, op, res)
+#else
+#define	fault_init(cfg) 0
+#define	FAULT(cfg, op, res) 0
+#endif
+
+#endif
@@ -0,0 +1,388 @@
+#define	_DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "netstream.h"
+#include "frame.h"
+#include "fec.h"
+
+// XOR is done in vectors of this type
+typedef unsigned char fec_vec __attribute__((vector_size(32)));
+
+/*
+ * XOR len bytes from src into dst. On x86-64 a variant for AVX2 is chosen at
+ * run time, otherwise the vectors are split to what the CPU has.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+static void fec_xor(char * dst, const char * src, size_t len) {
+	size_t i;
+	for (i = 0; i+sizeof (fec_vec) <= len; i += sizeof (fec_vec)) {
+		fec_vec a;
+		fec_vec b;
+		memcpy(&a, dst+i, sizeof (fec_vec));
+		memcpy(&b, src+i, sizeof (fec_vec));
+		a ^= b;
+		memcpy(dst+i, &a, sizeof (fec_vec));
+	}
+	for (; i < len; i++)
+		dst[i] ^= src[i];
+}
+
+/* Returns offset of XOR block in a FEC frame protecting n frames */
+static size_t fec_block_off(int n) {
+	return (FRAME_HEADER_SIZE+FEC_HEADER_SIZE+8*n);
+}
+
+/*
+ * Create FEC encoder for a matrix of cols x rows data frames of at most
+ * max_frame bytes. Row FEC is sent only if cols > 1, column FEC only if
+ * rows > 1.
+ *
+ * Returns the encoder or NULL if allocation fails.
+ */
+struct fec_enc * fec_enc_create(int cols, int rows, size_t max_frame) {
+	struct fec_enc * enc;
+	enc = calloc(1, sizeof (struct fec_enc));
+	if (enc == NULL)
+		return (NULL);
+	enc->cols = cols;
+	enc->rows = rows;
+	enc->max_frame = max_frame;
+	enc->row.frame = calloc(1, fec_block_off(cols)+max_frame);
+	enc->col = calloc(cols, sizeof (struct fec_acc));
+	if (enc->row.frame == NULL || enc->col == NULL) {
+		free(enc->row.frame);
+		free(enc->col);
+		free(enc);
+		return (NULL);
+	}
+	for (int i = 0; i < cols; i++) {
+		enc->col[i].frame = calloc(1, fec_block_off(rows)+max_frame);
+		if (enc->col[i].frame == NULL) {
+			while (i-- > 0)
+				free(enc->col[i].frame);
+			free(enc->row.frame);
+			free(enc->col);
+			free(enc);
+			return (NULL);
+		}
+	}
+	return (enc);
+}
+
+/*
+ * Add data frame with header hdr and len bytes of payload to accumulator acc
+ * of a group of n frames. When the group is complete, its FEC frame is made
+ * ready to send.
+ */
+static void fec_acc_add(struct fec_enc * enc, struct fec_acc * acc, int kind,
+	int n, char * hdr, char * payload, size_t len) {
+
+	char * block;
+	uint64_t seq;
+	block = acc->frame+fec_block_off(n);
+	if (acc->n == 0)
+		memset(block, 0, enc->max_frame);
+	memcpy(&seq, hdr+8, 8);
+	memcpy(acc->frame+FRAME_HEADER_SIZE+FEC_HEADER_SIZE+8*acc->n, &seq, 8);
+	fec_xor(block, hdr, FRAME_HEADER_SIZE);
+	fec_xor(block+FRAME_HEADER_SIZE, payload, len);
+	if (FRAME_HEADER_SIZE+len > acc->len)
+		acc->len = FRAME_HEADER_SIZE+len;
+	acc->n++;
+	if (acc->n < n)
+		return;
+
+	char * fec;
+	uint32_t len32;
+	struct chunk_meta meta;
+	fec = acc->frame+FRAME_HEADER_SIZE;
+	fec[0] = kind;
+	fec[1] = n;
+	fec[2] = 0;
+	fec[3] = 0;
+	len32 = htobe32(acc->len);
+	memcpy(fec+4, &len32, 4);
+	meta.seq = 0;
+	meta.stamp = 0;
+	frame_header(acc->frame, FRAME_FEC, &meta, fec,
+		FEC_HEADER_SIZE+8*n+acc->len);
+	enc->ready[enc->nready] = acc->frame;
+	enc->ready_len[enc->nready] = fec_block_off(n)+acc->len;
+	enc->nready++;
+	acc->n = 0;
+	acc->len = 0;
+}
+
+/*
+ * Add sent data frame with header hdr and len bytes of payload to the
+ * encoder. FEC frames which became complete are stored in ready, they are
+ * valid until the next call.
+ *
+ * Returns the number of FEC frames ready to send.
+ */
+int fec_enc_add(struct fec_enc * enc, char * hdr, char * payload, size_t len) {
+	enc->nready = 0;
+	if (enc->cols > 1) {
+		fec_acc_add(enc, &enc->row, FEC_ROW, enc->cols, hdr, payload,
+			len);
+	}
+	if (enc->rows > 1) {
+		fec_acc_add(enc, &enc->col[enc->pos%enc->cols], FEC_COLUMN,
+			enc->rows, hdr, payload, len);
+	}
+	enc->pos = (enc->pos+1)%(enc->cols*enc->rows);
+	return (enc->nready);
+}
+
+/*
+ * Create FEC decoder of input id for data frames of at most max_frame bytes.
+ * Recovered frames are counted in st.
+ *
+ * Returns the decoder or NULL if allocation fails.
+ */
+struct fec_dec * fec_dec_create(void * id, struct frame_stats * st,
+	size_t max_frame) {
+
+	struct fec_dec * dec;
+	dec = calloc(1, sizeof (struct fec_dec));
+	if (dec == NULL)
+		return (NULL);
+	dec->id = id;
+	dec->st = st;
+	dec->max_frame = max_frame;
+	for (int i = 0; i < FEC_WINDOW; i++) {
+		dec->slots[i].data = malloc(max_frame);
+		if (dec->slots[i].data == NULL) {
+			fec_dec_free(dec);
+			return (NULL);
+		}
+	}
+	for (int i = 0; i < FEC_PACKETS; i++) {
+		dec->pkts[i].data = malloc(max_frame);
+		if (dec->pkts[i].data == NULL) {
+			fec_dec_free(dec);
+			return (NULL);
+		}
+	}
+	return (dec);
+}
+
+/* Free FEC decoder dec */
+void fec_dec_free(struct fec_dec * dec) {
+	if (dec == NULL)
+		return;
+	for (int i = 0; i < FEC_WINDOW; i++)
+		free(dec->slots[i].data);
+	for (int i = 0; i < FEC_PACKETS; i++)
+		free(dec->pkts[i].data);
+	free(dec);
+}
+
+/* Returns slot of frame seq if the frame is here, NULL otherwise */
+static struct fec_slot * fec_have(struct fec_dec * dec, uint64_t seq) {
+	struct fec_slot * slot;
+	slot = &dec->slots[seq%FEC_WINDOW];
+	if (!slot->have || slot->seq != seq)
+		return (NULL);
+	return (slot);
+}
+
+/* Forget all frames, the sequence starts again at seq */
+static void fec_dec_restart(struct fec_dec * dec, uint64_t seq) {
+	for (int i = 0; i < FEC_WINDOW; i++)
+		dec->slots[i].have = 0;
+	for (int i = 0; i < FEC_PACKETS; i++)
+		dec->pkts[i].used = 0;
+	dec->next = seq;
+	dec->high = seq;
+}
+
+/* Add received data frame of len bytes (header and payload) */
+void fec_dec_add(struct fec_dec * dec, char * frame, size_t len) {
+	uint64_t seq;
+	memcpy(&seq, frame+8, 8);
+	seq = be64toh(seq);
+	if (!dec->started || seq+FEC_WINDOW < dec->next) {
+		fec_dec_restart(dec, seq);
+		dec->started = 1;
+	}
+	if (seq < dec->next || fec_have(dec, seq) != NULL) {
+		dec->st->dups++;
+		return;
+	}
+	struct fec_slot * slot;
+	slot = &dec->slots[seq%FEC_WINDOW];
+	memcpy(slot->data, frame, len);
+	slot->len = len;
+	slot->seq = seq;
+	slot->have = 1;
+	if (seq > dec->high)
+		dec->high = seq;
+}
+
+/* Add payload of a received FEC frame of len bytes */
+void fec_dec_add_fec(struct fec_dec * dec, char * payload, size_t len) {
+	if (len < FEC_HEADER_SIZE)
+		return;
+	int n;
+	uint32_t block;
+	n = (unsigned char)payload[1];
+	memcpy(&block, payload+4, 4);
+	block = be32toh(block);
+	if (n < 1 || n > FEC_MAX_DIM || block > dec->max_frame ||
+		len != FEC_HEADER_SIZE+8*n+block) {
+
+		tdprint(dec->id, WARN, "Invalid FEC frame\n");
+		return;
+	}
+	struct fec_pkt * pkt;
+	pkt = &dec->pkts[dec->next_pkt];
+	dec->next_pkt = (dec->next_pkt+1)%FEC_PACKETS;
+	pkt->used = 1;
+	pkt->kind = payload[0];
+	pkt->n = n;
+	for (int i = 0; i < n; i++) {
+		memcpy(&pkt->seqs[i], payload+FEC_HEADER_SIZE+8*i, 8);
+		pkt->seqs[i] = be64toh(pkt->seqs[i]);
+	}
+	pkt->len = block;
+	memcpy(pkt->data, payload+FEC_HEADER_SIZE+8*n, block);
+	// Frames of a group are waited for twice as long as the group spans
+	uint64_t span;
+	span = 2*(pkt->seqs[n-1]-pkt->seqs[0]+1);
+	if (span > dec->span)
+		dec->span = span < FEC_WINDOW/2 ? span : FEC_WINDOW/2;
+}
+
+/*
+ * Reconstruct the only missing frame protected by FEC frame pkt, the
+ * missing frame is missing-th in pkt.
+ *
+ * Returns 0 on success, -1 if the result is not a valid frame.
+ */
+static int fec_rebuild(struct fec_dec * dec, struct fec_pkt * pkt,
+	int missing) {
+
+	struct fec_slot * slot;
+	uint64_t seq;
+	seq = pkt->seqs[missing];
+	slot = &dec->slots[seq%FEC_WINDOW];
+	slot->have = 0;
+	memcpy(slot->data, pkt->data, pkt->len);
+	for (int i = 0; i < pkt->n; i++) {
+		struct fec_slot * other;
+		if (i == missing)
+			continue;
+		other = fec_have(dec, pkt->seqs[i]);
+		fec_xor(slot->data, other->data, other->len);
+	}
+	ssize_t npayload;
+	uint64_t rseq;
+	npayload = frame_check(slot->data, pkt->len);
+	if (npayload < 0)
+		return (-1);
+	memcpy(&rseq, slot->data+8, 8);
+	if (be64toh(rseq) != seq)
+		return (-1);
+	slot->seq = seq;
+	slot->len = FRAME_HEADER_SIZE+npayload;
+	slot->have = 1;
+	return (0);
+}
+
+/*
+ * Try to reconstruct missing frames from all kept FEC frames. Each
+ * reconstructed frame may complete another row or column, so the FEC frames
+ * are tried until nothing changes.
+ */
+static void fec_recover(struct fec_dec * dec) {
+	int progress;
+	do  {
+		progress = 0;
+		for (int i = 0; i < FEC_PACKETS; i++) {
+			struct fec_pkt * pkt;
+			int missing;
+			int nmissing;
+			pkt = &dec->pkts[i];
+			if (!pkt->used)
+				continue;
+			if (pkt->seqs[pkt->n-1] < dec->next) {
+				pkt->used = 0;
+				continue;
+			}
+			missing = -1;
+			nmissing = 0;
+			for (int j = 0; j < pkt->n; j++) {
+				if (fec_have(dec, pkt->seqs[j]) == NULL) {
+					missing = j;
+					nmissing++;
+				}
+			}
+			if (nmissing > 1)
+				continue;
+			pkt->used = 0;
+			if (nmissing == 0 || pkt->seqs[missing] < dec->next)
+				continue;
+			if (fec_rebuild(dec, pkt, missing) == -1) {
+				tdprint(dec->id, WARN, "FEC recovery of frame "
+					"%llu failed\n",
+					(unsigned long long)pkt->seqs[missing]);
+				continue;
+			}
+			dec->st->recovered++;
+			progress = 1;
+		}
+	} while (progress);
+}
+
+/*
+ * Check if frame seq was not sent at all (it was dropped by the sender), so
+ * it is not worth waiting for. A row FEC frame protects consecutive sent
+ * frames, so a sequence number between two of them was not sent.
+ */
+static int fec_unsent(struct fec_dec * dec, uint64_t seq) {
+	for (int i = 0; i < FEC_PACKETS; i++) {
+		struct fec_pkt * pkt;
+		pkt = &dec->pkts[i];
+		if (!pkt->used || pkt->kind != FEC_ROW)
+			continue;
+		for (int j = 0; j+1 < pkt->n; j++) {
+			if (pkt->seqs[j] < seq && seq < pkt->seqs[j+1])
+				return (1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Get the next data frame in order of sequence numbers, pointer to it is
+ * stored to frame and it is valid until the next frame is added. A missing
+ * frame is waited for until it can't be reconstructed anymore, then it is
+ * skipped.
+ *
+ * Returns length of the frame or -1 if there is none now.
+ */
+ssize_t fec_dec_next(struct fec_dec * dec, char ** frame) {
+	while (dec->started && dec->next <= dec->high) {
+		struct fec_slot * slot;
+		slot = fec_have(dec, dec->next);
+		if (slot == NULL) {
+			fec_recover(dec);
+			slot = fec_have(dec, dec->next);
+		}
+		if (slot != NULL) {
+			dec->next++;
+			*frame = slot->data;
+			return (slot->len);
+		}
+		if (dec->high-dec->next < dec->span &&
+			!fec_unsent(dec, dec->next))
+			return (-1);
+		dec->next++;
+	}
+	return (-1);
+}
@@ -0,0 +1,95 @@
+#ifndef FEC_H
+#define	FEC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "netstream.h"
+#include "frame.h"
+
+/*
+ * Forward error correction of framed datagrams. Sent data frames are laid
+ * row by row into a matrix of L columns and D rows. For each row and each
+ * column a FEC frame carries XOR of the protected frames (header and payload,
+ * each padded with zeros), so one lost frame in a row or in a column can be
+ * reconstructed. Payload of a FEC frame:
+ *
+ *	offset	size	field
+ *	0	1	kind (0 - row, 1 - column)
+ *	1	1	number of protected frames n
+ *	2	2	reserved (0)
+ *	4	4	length of XOR block (big endian)
+ *	8	8*n	sequence numbers of protected frames (big endian)
+ *	8+8*n	...	XOR block
+ */
+#define	FEC_HEADER_SIZE 8
+#define	FEC_MAX_DIM 20 			// Maximal number of columns or rows
+#define	FEC_MAX_MATRIX 100 		// Maximal number of frames in matrix
+#define	FEC_ROW 0
+#define	FEC_COLUMN 1
+// FEC frame can be longer than a data frame by this
+#define	FEC_MAX_OVERHEAD (FEC_HEADER_SIZE+8*FEC_MAX_DIM+FRAME_HEADER_SIZE)
+#define	FEC_WINDOW 512 			// Frames kept by receiver for recovery
+#define	FEC_PACKETS 64 			// FEC frames kept by receiver
+
+// Accumulated XOR of one row or column
+struct fec_acc {
+	int n; 			// Number of frames added
+	size_t len; 		// Length of the longest frame added
+	char * frame; 		// FEC frame, XOR block is filled in place
+};
+
+// FEC encoder of an output
+struct fec_enc {
+	int cols; 		// Number of columns (frames in a row)
+	int rows; 		// Number of rows (frames in a column)
+	size_t max_frame; 	// Longest data frame
+	struct fec_acc row; 	// Current row
+	struct fec_acc * col; 	// Columns of the current matrix
+	int pos; 		// Position of the next frame in the matrix
+	int nready; 		// Number of FEC frames ready to send
+	char * ready[2]; 	// FEC frames ready to send
+	size_t ready_len[2]; 	// Lengths of ready FEC frames
+};
+
+// Received data frame kept for recovery
+struct fec_slot {
+	uint64_t seq; 		// Sequence number
+	int have; 		// Is the frame here?
+	size_t len; 		// Length of the frame
+	char * data; 		// The frame
+};
+
+// Received FEC frame
+struct fec_pkt {
+	int used; 		// Is the slot used?
+	int kind; 		// Row or column
+	int n; 			// Number of protected frames
+	uint64_t seqs[FEC_MAX_DIM]; // Sequence numbers of protected frames
+	size_t len; 		// Length of XOR block
+	char * data; 		// XOR block
+};
+
+// FEC decoder of an input, it gives frames back in order of sequence numbers
+struct fec_dec {
+	void * id; 		// Input, used in messages
+	struct frame_stats * st; // Counters of the input
+	size_t max_frame; 	// Longest data frame
+	struct fec_slot slots[FEC_WINDOW]; // Data frames by sequence number
+	struct fec_pkt pkts[FEC_PACKETS]; // FEC frames
+	int next_pkt; 		// Slot for the next FEC frame
+	int started; 		// Was any data frame received?
+	uint64_t next; 		// Sequence number of the next frame to give
+	uint64_t high; 		// Highest sequence number received
+	uint64_t span; 		// How long a missing frame is waited for
+};
+
+struct fec_enc * fec_enc_create(int cols, int rows, size_t max_frame);
+int fec_enc_add(struct fec_enc * enc, char * hdr, char * payload, size_t len);
+struct fec_dec * fec_dec_create(void * id, struct frame_stats * st,
+	size_t max_frame);
+void fec_dec_free(struct fec_dec * dec);
+void fec_dec_add(struct fec_dec * dec, char * frame, size_t len);
+void fec_dec_add_fec(struct fec_dec * dec, char * payload, size_t len);
+ssize_t fec_dec_next(struct fec_dec * dec, char ** frame);
+
+#endif
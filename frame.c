@@ -0,0 +1,316 @@
+#define	_DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <endian.h>
+
+#include "netstream.h"
+#include "crc32c.h"
+#include "frame.h"
+#include "fec.h"
+#include "arq.h"
+
+/* Returns CRC32C of frame header hdr with its CRC field zeroed and payload */
+static uint32_t frame_crc(char * hdr, char * payload, size_t len) {
+	char tmp[FRAME_HEADER_SIZE];
+	uint32_t crc;
+	memcpy(tmp, hdr, FRAME_HEADER_SIZE);
+	memset(tmp+24, 0, 4);
+	crc = crc32c(0, tmp, FRAME_HEADER_SIZE);
+	return (crc32c(crc, payload, len));
+}
+
+/*
+ * Fill FRAME_HEADER_SIZE bytes at hdr with header of a frame of type carrying
+ * len bytes of payload with sequence number and time from meta.
+ */
+void frame_header(char * hdr, int type, struct chunk_meta * meta,
+	char * payload, size_t len) {
+
+	uint32_t len32;
+	uint64_t val;
+	hdr[0] = 'N';
+	hdr[1] = 'F';
+	hdr[2] = FRAME_VERSION;
+	hdr[3] = type;
+	len32 = htobe32(len);
+	memcpy(hdr+4, &len32, 4);
+	val = htobe64(meta->seq);
+	memcpy(hdr+8, &val, 8);
+	val = htobe64(meta->stamp);
+	memcpy(hdr+16, &val, 8);
+	memset(hdr+24, 0, 8);
+	len32 = htobe32(frame_crc(hdr, payload, len));
+	memcpy(hdr+24, &len32, 4);
+}
+
+/*
+ * Check frame in n bytes at frame (with padding after the frame allowed).
+ *
+ * Returns length of payload or -1 if it is not a valid frame.
+ */
+ssize_t frame_check(char * frame, size_t n) {
+	uint32_t len;
+	uint32_t crc;
+	if (n < FRAME_HEADER_SIZE || frame[0] != 'N' || frame[1] != 'F' ||
+		frame[2] != FRAME_VERSION)
+		return (-1);
+	memcpy(&len, frame+4, 4);
+	len = be32toh(len);
+	if (len > n-FRAME_HEADER_SIZE)
+		return (-1);
+	memcpy(&crc, frame+24, 4);
+	if (be32toh(crc) != frame_crc(frame, frame+FRAME_HEADER_SIZE, len))
+		return (-1);
+	return (len);
+}
+
+/*
+ * Create receiving state of framed input id, which accepts payloads up to
+ * max_payload bytes and counts frames in st.
+ *
+ * Returns the state or NULL on error.
+ */
+struct deframe * deframe_create(void * id, struct frame_stats * st,
+	size_t max_payload) {
+
+	struct deframe * df;
+	df = malloc(sizeof (struct deframe));
+	if (df == NULL)
+		return (NULL);
+	df->data = malloc(2*(FEC_MAX_OVERHEAD+max_payload));
+	if (df->data == NULL) {
+		free(df);
+		return (NULL);
+	}
+	df->id = id;
+	df->st = st;
+	df->max_payload = max_payload;
+	df->len = 0;
+	df->pos = 0;
+	df->last_seq = 0;
+	df->synced = 1;
+	df->fec = NULL;
+	df->arq = NULL;
+	return (df);
+}
+
+/* Free receiving state df */
+void deframe_free(struct deframe * df) {
+	if (df == NULL)
+		return;
+	fec_dec_free(df->fec);
+	arq_rx_free(df->arq);
+	free(df->data);
+	free(df);
+}
+
+/*
+ * Discard all data in receiving state df (after reconnecting or after
+ * a datagram). The last sequence number is kept, so frames lost while
+ * reconnecting are reported.
+ */
+void deframe_reset(struct deframe * df) {
+	df->len = 0;
+	df->pos = 0;
+	df->synced = 1;
+}
+
+/*
+ * Append ndata bytes from data to the data to be parsed. At most one maximal
+ * frame can be passed at once and all frames have to be taken by deframe_next
+ * before the next call.
+ *
+ * Returns 0 on success, -1 if data don't fit.
+ */
+int deframe_input(struct deframe * df, char * data, size_t ndata) {
+	if (df->pos > 0) {
+		memmove(df->data, df->data+df->pos, df->len-df->pos);
+		df->len -= df->pos;
+		df->pos = 0;
+	}
+	if (df->len+ndata > 2*(FEC_MAX_OVERHEAD+df->max_payload))
+		return (-1);
+	memcpy(df->data+df->len, data, ndata);
+	df->len += ndata;
+	return (0);
+}
+
+/*
+ * Skip the byte at the start of data and everything up to the next possible
+ * start of a frame. Loss of synchronization is reported once.
+ */
+static void deframe_skip(struct deframe * df) {
+	char * next;
+	if (df->synced) {
+		tdprint(df->id, WARN, "Lost frame synchronization\n");
+		df->synced = 0;
+	}
+	next = memchr(df->data+df->pos+1, 'N', df->len-df->pos-1);
+	df->pos = next != NULL ? (size_t)(next-df->data) : df->len;
+}
+
+/* Check sequence number seq of a received frame, returns 0 if it is a copy */
+static int deframe_seq(struct deframe * df, uint64_t seq) {
+	uint64_t last;
+	last = df->last_seq;
+	df->last_seq = seq;
+	if (last == 0 || seq == last+1)
+		return (1);
+	if (seq == last) {
+		df->st->dups++;
+		return (0);
+	}
+	if (seq < last) {
+		tdprint(df->id, NOTICE, "Sequence restarted at %llu\n",
+			(unsigned long long)seq);
+		return (1);
+	}
+	tdprint(df->id, WARN, "Lost %llu frames (%llu to %llu)\n",
+		(unsigned long long)(seq-last-1),
+		(unsigned long long)(last+1),
+		(unsigned long long)(seq-1));
+	df->st->lost += seq-last-1;
+	return (1);
+}
+
+/*
+ * Find the next valid frame in received data, the length of its payload is
+ * stored to len. Frames with a wrong checksum are skipped.
+ *
+ * Returns pointer to the frame or NULL if more data are needed.
+ */
+static char * deframe_parse(struct deframe * df, uint32_t * len) {
+	while (df->len-df->pos >= FRAME_HEADER_SIZE) {
+		char * frame;
+		uint32_t crc;
+		size_t max;
+		frame = df->data+df->pos;
+		if (frame[0] != 'N' || frame[1] != 'F' ||
+			frame[2] != FRAME_VERSION) {
+
+			deframe_skip(df);
+			continue;
+		}
+		memcpy(len, frame+4, 4);
+		*len = be32toh(*len);
+		max = df->max_payload;
+		if (frame[3] == FRAME_FEC)
+			max += FEC_MAX_OVERHEAD;
+		if (*len > max) {
+			deframe_skip(df);
+			continue;
+		}
+		if (df->len-df->pos < FRAME_HEADER_SIZE+*len)
+			return (NULL);
+		memcpy(&crc, frame+24, 4);
+		if (be32toh(crc) != frame_crc(frame,
+			frame+FRAME_HEADER_SIZE, *len)) {
+
+			df->st->bad++;
+			tdprint(df->id, WARN, "Frame with wrong checksum\n");
+			deframe_skip(df);
+			continue;
+		}
+		if (!df->synced) {
+			tdprint(df->id, NOTICE, "Frame synchronization "
+				"regained\n");
+			df->synced = 1;
+		}
+		df->pos += FRAME_HEADER_SIZE+*len;
+		return (frame);
+	}
+	return (NULL);
+}
+
+/*
+ * Give data frame with len bytes of payload to the reader, pointer to its
+ * payload is stored to out and its sequence number and time to meta.
+ *
+ * Returns length of payload or DEFRAME_AGAIN if the frame is a copy.
+ */
+static ssize_t deframe_give(struct deframe * df, char * frame, uint32_t len,
+	char ** out, struct chunk_meta * meta) {
+
+	uint64_t val;
+	memcpy(&val, frame+8, 8);
+	meta->seq = be64toh(val);
+	memcpy(&val, frame+16, 8);
+	meta->stamp = be64toh(val);
+	if (!deframe_seq(df, meta->seq))
+		return (DEFRAME_AGAIN);
+	df->st->frames++;
+	if (meta->stamp != 0) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		df->st->latency = (int64_t)((uint64_t)ts.tv_sec*
+			1000000000ULL+ts.tv_nsec-meta->stamp);
+	}
+	*out = frame+FRAME_HEADER_SIZE;
+	return (len);
+}
+
+/*
+ * Get the next data frame. Pointer to its payload is stored to out and its
+ * sequence number and time to meta. Frames with a wrong checksum and repeated
+ * frames are skipped, gaps in sequence numbers are reported. When the sender
+ * sends FEC frames, data frames go through the FEC decoder, which gives them
+ * in order with lost frames reconstructed if possible. With ARQ, data frames
+ * are given in order with lost frames requested again and FEC is ignored.
+ *
+ * Returns length of payload or DEFRAME_AGAIN if more data are needed.
+ */
+ssize_t deframe_next(struct deframe * df, char ** out,
+	struct chunk_meta * meta) {
+
+	while (1) {
+		char * frame;
+		uint32_t len;
+		ssize_t res;
+		if (df->fec != NULL || df->arq != NULL) {
+			ssize_t nframe;
+			if (df->arq != NULL)
+				nframe = arq_rx_next(df->arq, &frame);
+			else
+				nframe = fec_dec_next(df->fec, &frame);
+			if (nframe >= 0) {
+				res = deframe_give(df, frame,
+					nframe-FRAME_HEADER_SIZE, out, meta);
+				if (res != DEFRAME_AGAIN)
+					return (res);
+				continue;
+			}
+		}
+		frame = deframe_parse(df, &len);
+		if (frame == NULL)
+			return (DEFRAME_AGAIN);
+		if (frame[3] == FRAME_FEC && df->fec == NULL &&
+			df->arq == NULL) {
+
+			tdprint(df->id, INFO, "Receiving FEC\n");
+			df->fec = fec_dec_create(df->id, df->st,
+				FRAME_HEADER_SIZE+df->max_payload);
+			if (df->fec == NULL) {
+				tdprint(df->id, WARN, "Can't allocate memory "
+					"for FEC\n");
+			}
+		}
+		if (frame[3] == FRAME_FEC && df->fec != NULL) {
+			fec_dec_add_fec(df->fec, frame+FRAME_HEADER_SIZE, len);
+			continue;
+		}
+		if (frame[3] != FRAME_DATA)
+			continue;
+		if (df->arq != NULL) {
+			arq_rx_add(df->arq, frame, FRAME_HEADER_SIZE+len);
+			continue;
+		}
+		if (df->fec != NULL) {
+			fec_dec_add(df->fec, frame, FRAME_HEADER_SIZE+len);
+			continue;
+		}
+		res = deframe_give(df, frame, len, out, meta);
+		if (res != DEFRAME_AGAIN)
+			return (res);
+	}
+}
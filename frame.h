@@ -0,0 +1,58 @@
+#ifndef FRAME_H
+#define	FRAME_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "netstream.h"
+
+/*
+ * With framing, every chunk is sent as one frame:
+ *
+ *	offset	size	field
+ *	0	2	magic "NF"
+ *	2	1	version (1)
+ *	3	1	type (0 - data, 1 - FEC, see fec.h, 2 - NACK, see arq.h)
+ *	4	4	length of payload (big endian)
+ *	8	8	sequence number (big endian)
+ *	16	8	time of reading, ns since the epoch (big endian)
+ *	24	4	CRC32C of header with this field zeroed and payload
+ *	28	4	reserved (0)
+ *	32	...	payload
+ *
+ * Payload is the chunk as it is in the buffer of the output (a compressed
+ * frame for compressed outputs). A datagram carries exactly one frame.
+ */
+#define	FRAME_HEADER_SIZE 32
+#define	FRAME_VERSION 1
+#define	FRAME_DATA 0
+#define	FRAME_FEC 1
+#define	FRAME_NACK 2
+
+#define	DEFRAME_AGAIN -1
+
+// Receiving state of a framed input
+struct deframe {
+	void * id; 		// Input, used in messages
+	struct frame_stats * st; // Counters of the input
+	size_t max_payload; 	// Longest accepted payload
+	char * data; 		// Received, not yet parsed data
+	size_t len; 		// Length of data
+	size_t pos; 		// Start of the next frame in data
+	uint64_t last_seq; 	// Sequence number of the last frame (0 - none)
+	int synced; 		// Is the start of a frame at pos?
+	struct fec_dec * fec; 	// FEC decoder (NULL - no FEC received yet)
+	struct arq_rx * arq; 	// Requesting of lost frames (NULL - no ARQ)
+};
+
+void frame_header(char * hdr, int type, struct chunk_meta * meta,
+	char * payload, size_t len);
+ssize_t frame_check(char * frame, size_t n);
+struct deframe * deframe_create(void * id, struct frame_stats * st,
+	size_t max_payload);
+void deframe_free(struct deframe * df);
+void deframe_reset(struct deframe * df);
+int deframe_input(struct deframe * df, char * data, size_t ndata);
+ssize_t deframe_next(struct deframe * df, char ** out,
+	struct chunk_meta * meta);
+
+#endif
@@ -11,6 +11,13 @@
 #include "buffer.h"
 #include "conffile.h"
 #include "endpts.h"
+#include "compress.h"
+#include "selector.h"
+#include "upgrade.h"
+#include "probe.h"
+#include "fault.h"
+#include "prio.h"
+#include "perf.h"
 
 
 struct cmd_args cmd_args;
@@ -48,10 +55,18 @@ int tdprint(void * id, enum verbosity verb, const char * format, ...) {
 	return (0);
 }
 
+/* Returns monotonic time in nanoseconds */
+uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec);
+}
+
 
 /* Prints short usage */
 void usage(char * name) {
-	printf("Usage: %s [-c < config_file>] [-d] [-v [level]] [-t]\n", name);
+	printf("Usage: %s [-c < config_file>] [-d] [-v [level]] [-t] "
+		"[-u < socket>] [-m < size>] [-e < bitrate>] [-p]\n", name);
 }
 
 /* Prints long usage help */
@@ -64,7 +79,18 @@ void help(void) {
 	printf(
 "	-v [level]	- set verbosity (0 quiet, 7 maximum)\n");
 	printf(
-"	-t		- only load config and test neigbours reachability\n");
+"	-t		- only load config, probe neighbours and print\n"
+"			  a JSON summary\n");
+	printf(
+"	-u < socket>	- take over the stream from a process running with\n"
+"			  the same socket, then wait for a new process on it\n");
+	printf(
+"	-m < size>	- limit memory of all buffers (suffix K, M or G)\n");
+	printf(
+"	-e < bitrate>	- limit bitrate sent by all outputs (suffix K, M or G)\n");
+	printf(
+"	-p		- measure CPU costs of stages of endpoints, print\n"
+"			  them with statistics and at exit\n");
 }
 
 /*
@@ -87,13 +113,17 @@ void handle_signal(int signum) {
  * Returns 0 on success, -1 if unrecognized switch is found
  */
 int parse_args(int argc, char ** argv, struct cmd_args * cfg) {
-	char * optstring = "c:dv::t";
+	char * optstring = "c:dv::tu:m:e:p";
 	int opt;
 
 	cfg->cfg_file = "netstream.conf";
 	cfg->verbosity = 3;
 	cfg->daemonize = 0;
 	cfg->testonly = 0;
+	cfg->upgrade_path = NULL;
+	cfg->mem_cap = 0;
+	cfg->egress_rate = 0;
+	cfg->perf = 0;
 
 	while ((opt = getopt(argc, argv, optstring)) != -1) {
 		switch (opt) {
@@ -115,6 +145,30 @@ int parse_args(int argc, char ** argv, struct cmd_args * cfg) {
 			case 't':
 				cfg->testonly = 1;
 				break;
+			case 'u':
+				cfg->upgrade_path = optarg;
+				break;
+			case 'm':
+				if (parse_scaled(optarg, 1024,
+					&cfg->mem_cap) == -1) {
+
+					dprint(ERR, "Invalid memory limit %s\n",
+						optarg);
+					return (-1);
+				}
+				break;
+			case 'e':
+				if (parse_scaled(optarg, 1000,
+					&cfg->egress_rate) == -1) {
+
+					dprint(ERR, "Invalid egress bitrate %s\n",
+						optarg);
+					return (-1);
+				}
+				break;
+			case 'p':
+				cfg->perf = 1;
+				break;
 			default:
 				dprint(ERR, "Unrecognized switch %c\n", optopt);
 				return (-1);
@@ -131,6 +185,186 @@ void print_args(struct cmd_args * cfg) {
 	fprintf(stderr, "	daemonize:	%d\n", cfg->daemonize);
 	fprintf(stderr, "	verbosity: %d\n", cfg->verbosity);
 	fprintf(stderr, "	only test: %d\n", cfg->testonly);
+	fprintf(stderr, "	upgrade socket: %s\n", cfg->upgrade_path);
+	fprintf(stderr, "	memory limit: %lld\n", cfg->mem_cap);
+	fprintf(stderr, "	egress bitrate: %lld\n", cfg->egress_rate);
+	fprintf(stderr, "	measure stages: %d\n", cfg->perf);
+}
+
+/*
+ * Print costs of stage of endpoint cfg (kind and index i) to stderr: runs,
+ * bytes, cycles, instructions and cache misses per byte (if hardware counters
+ * are available), CPU time per byte and context switches.
+ */
+static void print_perf(const char * kind, int i, struct endpt_cfg * cfg,
+	enum perf_stage stage) {
+
+	static const char * names[] = {"read", "insert", "drain", "write"};
+	struct perf_stats * st;
+	double bytes;
+	st = &cfg->perf[stage];
+	bytes = st->bytes > 0 ? (double)st->bytes : 1.0;
+	fprintf(stderr, "	%s %d: %s runs %lu, %llu B", kind, i,
+		names[stage], st->calls, (unsigned long long)st->bytes);
+	if (cfg->perf_hw) {
+		fprintf(stderr, ", cycles/B %.2f, instructions/B %.2f, "
+			"cache misses/KB %.2f",
+			st->counts[PC_CYCLES]/bytes,
+			st->counts[PC_INSTRUCTIONS]/bytes,
+			st->counts[PC_CACHE_MISSES]*1024/bytes);
+	}
+	fprintf(stderr, ", CPU %.2f ns/B, switches %ld voluntary, "
+		"%ld involuntary\n",
+		st->cpu_ns/bytes,
+		st->nvcsw,
+		st->nivcsw);
+}
+
+/*
+ * Print statistics of all outputs to stderr: memory of buffers, chunks
+ * waiting in buffer and its size, chunks dropped, data waiting in spill file,
+ * wakeups, datagrams of repacketized outputs, retransmissions and zero copy
+ * sends. Drops, the highest lag and the time throttled by the egress bitrate
+ * of each priority class, failures and recovery times of endpoints, counters
+ * of framed inputs and costs of stages measured by -p follow.
+ */
+static void print_stats(void) {
+	fprintf(stderr, "Statistics:\n");
+	fprintf(stderr, "	memory of buffers %zu B\n", buffer_mem_used());
+	for (int i = 0; i < config.n_outs; i++) {
+		struct endpt_cfg * out;
+		struct buffer_stats st;
+		out = &config.outs[i];
+		buffer_get_stats(out->buf, &st);
+		fprintf(stderr, "	output %d (%s): buffered %zu of %zu "
+			"(resized %lu), dropped %lu, spilled %zu B in %d chunks, "
+			"wakeups %lu\n",
+			i,
+			out->name != NULL ? out->name : "-",
+			st.items,
+			st.nitems,
+			st.resizes,
+			st.dropped,
+			st.spill_bytes,
+			st.spill_items,
+			st.wakeups);
+		if (out->packet_size > 0) {
+			fprintf(stderr, "	output %d: datagrams of %zu B sent "
+				"%lu, skipped %lu B before sync\n",
+				i,
+				out->packet_size,
+				out->packets_sent,
+				out->packet_skipped);
+		}
+		if (out->arq > 0) {
+			fprintf(stderr, "	output %d: ARQ NACKs %lu, "
+				"frames sent again %lu, not kept %lu\n",
+				i,
+				out->arq_nacks,
+				out->arq_resent,
+				out->arq_missed);
+		}
+		if (out->zerocopy) {
+			fprintf(stderr, "	output %d: zero copy sent %lu, "
+				"copied by kernel %lu\n",
+				i,
+				out->zc_sent,
+				out->zc_copied);
+		}
+	}
+	for (int c = 0; c < PRIO_CLASSES; c++) {
+		static const char * names[] = {"high", "normal", "low"};
+		unsigned long dropped;
+		uint64_t lag;
+		uint64_t wait;
+		int n;
+		n = 0;
+		dropped = 0;
+		lag = 0;
+		wait = 0;
+		for (int i = 0; i < config.n_outs; i++) {
+			struct buffer_stats st;
+			if (config.outs[i].priority != (enum out_prio)c)
+				continue;
+			buffer_get_stats(config.outs[i].buf, &st);
+			n++;
+			dropped += st.dropped;
+			if (st.lag > lag)
+				lag = st.lag;
+			wait += config.outs[i].egress_wait;
+		}
+		if (n == 0)
+			continue;
+		fprintf(stderr, "	class %s: outputs %d, dropped %lu, "
+			"max lag %.1f ms, throttled %.1f ms\n",
+			names[c],
+			n,
+			dropped,
+			lag/1e6,
+			wait/1e6);
+	}
+	for (int i = 0; i < config.n_outs+config.n_inputs; i++) {
+		struct endpt_cfg * cfg;
+		cfg = i < config.n_outs ? &config.outs[i] :
+			&config.input[i-config.n_outs];
+		if (cfg->failures == 0)
+			continue;
+		fprintf(stderr, "	%s %d: failures %lu, recovered %lu, "
+			"recovery avg %.1f ms, max %.1f ms\n",
+			i < config.n_outs ? "output" : "input",
+			i < config.n_outs ? i : i-config.n_outs,
+			cfg->failures,
+			cfg->recoveries,
+			cfg->recoveries > 0 ?
+			cfg->recover_ns/1e6/cfg->recoveries : 0.0,
+			cfg->recover_max/1e6);
+	}
+	for (int i = 0; i < config.n_inputs; i++) {
+		struct endpt_cfg * in;
+		in = &config.input[i];
+		if (!in->framing)
+			continue;
+		fprintf(stderr, "	input %d (%s): frames %lu, lost %lu, "
+			"bad %lu, repeated %lu, recovered %lu, latency %lld us\n",
+			i,
+			in->name != NULL ? in->name : "-",
+			in->fstats.frames,
+			in->fstats.lost,
+			in->fstats.bad,
+			in->fstats.dups,
+			in->fstats.recovered,
+			(long long)(in->fstats.latency/1000));
+		if (in->arq > 0) {
+			fprintf(stderr, "	input %d: ARQ requested %lu, "
+				"received again %lu\n",
+				i,
+				in->fstats.requested,
+				in->fstats.resent);
+		}
+	}
+	for (int i = 0; i < config.n_outs+config.n_inputs; i++) {
+		struct endpt_cfg * cfg;
+		cfg = i < config.n_outs ? &config.outs[i] :
+			&config.input[i-config.n_outs];
+		for (int s = 0; s < PS_STAGES; s++) {
+			if (cfg->perf[s].calls == 0)
+				continue;
+			print_perf(i < config.n_outs ? "output" : "input",
+				i < config.n_outs ? i : i-config.n_outs, cfg, s);
+		}
+	}
+}
+
+/* Thread printing statistics on SIGUSR1, the signal is blocked elsewhere */
+static void * stats_thread(void * args) {
+	sigset_t * sigset;
+	sigset = (sigset_t *)args;
+	while (1) {
+		int signum;
+		if (sigwait(sigset, &signum) == 0)
+			print_stats();
+	}
+	return (NULL);
 }
 
 
@@ -187,15 +421,26 @@ int main(int argc, char ** argv) {
 		dprint(CRIT, "Error when setting signal handler\n");
 		return (1);
 	}
+	// Statistics are printed by own thread, all others block SIGUSR1
+	static sigset_t usr_set;
+	sigemptyset(&usr_set);
+	sigaddset(&usr_set, SIGUSR1);
+	if (pthread_sigmask(SIG_BLOCK, &usr_set, NULL)) {
+		dprint(CRIT, "Error in signal setup\n");
+		return (1);
+	}
 
 	for (int i = 0; i < config.n_outs; i++) {
 		config.outs[i].test_only = !!cmd_args.testonly;
 	}
-	config.input->test_only = !!cmd_args.testonly;
+	for (int i = 0; i < config.n_inputs; i++) {
+		config.input[i].test_only = !!cmd_args.testonly;
+	}
 
 
 
 	struct buffer * buffers;
+	buffer_set_mem_cap(cmd_args.mem_cap);
 	buffers = create_buffers(config.n_outs);
 	if (buffers == NULL)
 	{
@@ -204,6 +449,45 @@ int main(int argc, char ** argv) {
 	}
 	for (int i = 0; i < config.n_outs; i++) {
 		config.outs[i].buf = &buffers[i];
+		buffer_set_wake(&buffers[i], config.outs[i].wake_bytes,
+			config.outs[i].wake_delay);
+		buffer_set_time(&buffers[i], config.outs[i].buf_time);
+		buffer_set_shed(&buffers[i], config.outs[i].priority == PRIO_LOW);
+		if (config.outs[i].spill != NULL &&
+			buffer_set_spill(&buffers[i], config.outs[i].spill,
+			config.outs[i].spill_size) == -1) {
+
+			dprint(CRIT, "Error while creating spill file\n");
+			return (1);
+		}
+	}
+	egress_init(cmd_args.egress_rate);
+	if (cmd_args.perf)
+		perf_enable();
+	if (fault_init(&config) == -1) {
+		dprint(CRIT, "Error while loading faults to inject\n");
+		return (1);
+	}
+	if (setup_compression(&config) == -1) {
+		dprint(CRIT, "Error while initializing compression\n");
+		return (1);
+	}
+	if (config.n_inputs > 1) {
+		config.sel = selector_create(&config);
+		if (config.sel == NULL) {
+			dprint(CRIT, "Error while initializing input selector\n");
+			return (1);
+		}
+	}
+	// Sockets of a running process or of socket activation
+	if (!cmd_args.testonly) {
+		if (cmd_args.upgrade_path != NULL &&
+			upgrade_receive(&config, cmd_args.upgrade_path) == -1) {
+
+			dprint(CRIT, "Error while taking over the stream\n");
+			return (1);
+		}
+		upgrade_inherit(&config);
 	}
 
 	if (cmd_args.daemonize) {
@@ -224,7 +508,8 @@ int main(int argc, char ** argv) {
 	}
 	pthread_mutex_init(&(dlist->mtx), NULL);
 	pthread_cond_init(&(dlist->condv), NULL);
-	dlist->cfg_list = calloc(sizeof (struct endpt_cfg *), config.n_outs+1);
+	dlist->cfg_list = calloc(sizeof (struct endpt_cfg *),
+		config.n_outs+config.n_inputs);
 	if (dlist->cfg_list == NULL) {
 		dprint(CRIT, "Failed to allocate space for threads\n");
 		return (1);
@@ -232,10 +517,48 @@ int main(int argc, char ** argv) {
 	dlist->pos = 0;
 	pthread_mutex_lock(&(dlist->mtx));
 
-	pthread_t read_thr;
+	for (int i = 0; i < config.n_stages; i++) {
+		if (pthread_create(&config.stages[i].thread,
+			NULL,
+			comp_stage_thread,
+			(void *)(&config.stages[i]))) {
+			dprint(ERR, "Failed to start thread\n");
+			return (1);
+		}
+		pthread_detach(config.stages[i].thread);
+	}
+
+	pthread_t stats_thr;
+	if (pthread_create(&stats_thr, NULL, stats_thread, (void *)&usr_set)) {
+		dprint(ERR, "Failed to start thread\n");
+		return (1);
+	}
+	pthread_detach(stats_thr);
+	if (cmd_args.upgrade_path != NULL && !cmd_args.testonly &&
+		upgrade_listen(&config, cmd_args.upgrade_path) == -1) {
+
+		dprint(CRIT, "Error while creating upgrade socket\n");
+		return (1);
+	}
+
+	pthread_t * read_thrs;
 	int res;
-	config.input->dlist = dlist;
-	res = pthread_create(&read_thr, NULL, read_endpt, (void *)(&config));
+	read_thrs = malloc(sizeof (pthread_t)*config.n_inputs);
+	if (read_thrs == NULL) {
+		dprint(CRIT, "Failed to allocate space for threads\n");
+		return (1);
+	}
+	for (int i = 0; i < config.n_inputs; i++) {
+		config.input[i].dlist = dlist;
+		res = pthread_create(&read_thrs[i],
+			NULL,
+			read_endpt,
+			(void *)(&config.input[i]));
+		if (res) {
+			dprint(ERR, "Failed to start thread\n");
+			return (1);
+		}
+	}
 
 	pthread_t * threads;
 	threads = malloc(sizeof (pthread_t)*config.n_outs);
@@ -257,18 +580,27 @@ int main(int argc, char ** argv) {
 	}
 
 	int retval;
+	int cancelled;
 	retval = 0;
+	cancelled = 0;
 
-	while (dlist->pos < config.n_outs + 1) {
+	while (dlist->pos < config.n_outs + config.n_inputs) {
 		pthread_cond_wait(&(dlist->condv), &(dlist->mtx));
 		dprint(DEBUG, "Thread died\n");
-		for (int i = 0; i < dlist->pos; i++) {
+		// Probe of neighbours waits for all endpoints
+		for (int i = 0; i < dlist->pos && !cmd_args.testonly; i++) {
 			if (dlist->cfg_list[i]->exit_status != 0) {
 				dprint(WARN, "There was error in thread %p,"
 					" cancelling other threads\n",
 					dlist->cfg_list[i]);
 				retval = 1;
-				pthread_cancel(read_thr);
+				// Cancelled threads may keep locks of buffers
+				if (cmd_args.perf)
+					print_stats();
+				cancelled = 1;
+				for (int i = 0; i < config.n_inputs; i++) {
+					pthread_cancel(read_thrs[i]);
+				}
 				for (int i = 0; i < config.n_outs; i++) {
 					pthread_cancel(threads[i]);
 				}
@@ -281,10 +613,15 @@ int main(int argc, char ** argv) {
 			break;
 		}
 	}
+	// Threads ending now need the lock in exit_thread
+	pthread_mutex_unlock(&(dlist->mtx));
 
-	res = pthread_join(read_thr, NULL);
-	if (res) {
-		dprint(ERR, "Failed to join read thread:%s\n", strerror(res));
+	for (int i = 0; i < config.n_inputs; i++) {
+		res = pthread_join(read_thrs[i], NULL);
+		if (res) {
+			dprint(ERR, "Failed to join read thread:%s\n",
+				strerror(res));
+		}
 	}
 
 	for (int i = 0; i < config.n_outs; i++) {
@@ -297,6 +634,13 @@ int main(int argc, char ** argv) {
 			retval = 1;
 		}
 	}
+	if (cmd_args.testonly && probe_report(&config) == -1)
+		retval = 1;
+	// All endpoints stopped for handover
+	if (upgrade_pending() && upgrade_send(&config) == -1)
+		retval = 1;
+	if (cmd_args.perf && !cancelled)
+		print_stats();
 
 	return (retval);
 }
@@ -2,7 +2,11 @@
 #define	NETSTREAM_H
 
 #include <pthread.h>
+#include <stdint.h>
 #include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
 
 enum verbosity {QUIET = 0,
 	ALERT = 1,
@@ -19,14 +23,26 @@ struct cmd_args {
 	char daemonize; 		// Run as a daemon?
 	enum verbosity verbosity;	// Verbosity
 	char testonly; 			// Only test connections and exit
+	char * upgrade_path; 		// Socket for handover to a new process
+	long long mem_cap; 		// Memory for all buffers (0 - unlimited)
+	long long egress_rate; 		// Bit/s sent by all outputs (0 - unlimited)
+	char perf; 			// Measure CPU costs of stages?
 };
 
 enum endpt_dir {DIR_INPUT, DIR_OUTPUT, DIR_INVAL}; 	// Endpoint direction
-enum endpt_type {T_SOCKET, T_FILE, T_STD, T_INVAL}; 	// Endpoint type
+// Endpoint type
+enum endpt_type {T_SOCKET, T_FILE, T_STD, T_UNIX, T_FIFO, T_SHM, T_PCAP,
+	T_INVAL};
 
 // Retry if read/write failed?
 enum endpt_retry {NO = 0, YES = 1, IGNORE, KILL};
 
+// Compression codec of a stream (values are used in the frame header)
+enum compression {C_NONE = 0, C_LZ4 = 1, C_ZSTD = 2};
+
+// Priority class of output (values index per-class statistics)
+enum out_prio {PRIO_HIGH = 0, PRIO_NORMAL = 1, PRIO_LOW = 2, PRIO_CLASSES};
+
 // Deadlist structure for died threads
 struct deadlist {
 	// List of pointers to config of died threads (guarded by the lock)
@@ -38,6 +54,40 @@ struct deadlist {
 };
 
 
+// Counters of a framed input
+struct frame_stats {
+	unsigned long frames; 	// Frames received
+	unsigned long lost; 	// Frames missing in the sequence
+	unsigned long bad; 	// Frames with wrong checksum
+	unsigned long dups; 	// Repeated frames dropped
+	unsigned long recovered; // Frames reconstructed by FEC
+	unsigned long requested; // Frames requested again by ARQ
+	unsigned long resent; 	// Requested frames received again
+	int64_t latency; 	// Latency of the last frame in ns
+};
+
+// Stages of endpoints measured by -p
+enum perf_stage {
+	PS_READ, 		// Read system calls of input
+	PS_INSERT, 		// Insert into buffers of outputs (fan-out)
+	PS_DRAIN, 		// Taking chunks from the buffer of output
+	PS_WRITE, 		// Write system calls of output
+	PS_STAGES
+};
+
+// Hardware counters measured by -p
+enum perf_counter {PC_CYCLES, PC_INSTRUCTIONS, PC_CACHE_MISSES, PC_COUNTERS};
+
+// Costs of a stage of an endpoint
+struct perf_stats {
+	unsigned long calls; 	// Times the stage was run
+	uint64_t bytes; 	// Bytes processed by the stage
+	uint64_t counts[PC_COUNTERS]; // Hardware counters
+	uint64_t cpu_ns; 	// CPU time in ns
+	long nvcsw; 		// Voluntary context switches
+	long nivcsw; 		// Involuntary context switches
+};
+
 // Configuration of endpoint
 struct endpt_cfg {
 	enum endpt_dir dir; 	// Direction (input/output)
@@ -46,7 +96,82 @@ struct endpt_cfg {
 	char * name; 		// Filename/hostname
 	char * port; 		// Port (only for socket)
 	int protocol; 		// Protocol (TCP/UDP)
+	int socktype; 		// Type of Unix domain socket
 	int keepalive; 		// Keepalive interval in sec (0 - default)
+	int nodelay; 		// Disable Nagle algorithm (TCP_NODELAY)
+	int sndbuf; 		// Socket send buffer size (0 - default)
+	int rcvbuf; 		// Socket receive buffer size (0 - default)
+	int notsent_lowat; 	// TCP_NOTSENT_LOWAT (0 - default)
+	int user_timeout; 	// TCP_USER_TIMEOUT in ms (0 - default)
+	int tos; 		// IP TOS / traffic class (-1 - default)
+	int max_unsent; 	// Drop data if more bytes are unsent (0 - never)
+	int mcast_ttl; 		// Multicast TTL (-1 - default)
+	int mcast_loop; 	// Multicast loopback (-1 - default)
+	char * mcast_iface; 	// Multicast interface name or address
+	char * mcast_source; 	// Source address for source-specific join
+	enum compression compression; 	// Compression of the stream
+	int comp_level; 	// Compression level (0 - codec default)
+	int tls; 		// Use TLS (only for TCP)
+	char * tls_cert; 	// TLS certificate chain file
+	char * tls_key; 	// TLS private key file
+	char * tls_ca; 		// CA file for verification of the peer
+	int tls_verify; 	// Verify certificate of the peer (output)
+	void * tls_ctx; 	// TLS context (created on the first use)
+	int record; 		// Recording mode of file output
+	size_t rec_write_size; 	// Size of coalesced writes
+	int rec_direct; 	// Write with O_DIRECT
+	off_t rec_prealloc; 	// Preallocation step (0 - none)
+	off_t rec_rotate_size; 	// Maximal size of a segment (0 - unlimited)
+	int rec_rotate_time; 	// Maximal age of a segment in sec (0 - unlimited)
+	off_t rec_sync_size; 	// Sync after n bytes written (0 - never)
+	int replay_mmap; 	// Replay file input from memory mapping
+	long long replay_bitrate; // Replay bitrate in bit/s (0 - not paced)
+	int replay_pcr; 	// Pace replay by PCR of MPEG transport stream
+	int replay_loop; 	// Replay file input in a loop
+	double replay_speed; 	// Speed of capture replay (0 - not paced)
+	int shm_slots; 		// Number of slots of shared memory ring
+	int stall_timeout; 	// Input is stalled after this time in ms
+	char * spill; 		// Spill file of output (NULL - none)
+	size_t spill_size; 	// Size of spill file
+	int framing; 		// Send/receive frames with sequence numbers
+	struct frame_stats fstats; // Counters of framed input
+	struct perf_stats perf[PS_STAGES]; // Costs of stages measured by -p
+	int perf_hw; 		// Were hardware counters measured by -p?
+	int fec_cols; 		// Columns of FEC matrix (0 - no FEC)
+	int fec_rows; 		// Rows of FEC matrix
+	int arq; 		// Window or wait of ARQ in ms (0 - no ARQ)
+	unsigned long arq_nacks; // NACKs received by ARQ output
+	unsigned long arq_resent; // Frames sent again by ARQ output
+	unsigned long arq_missed; // Requested frames not kept anymore
+	int zerocopy; 		// Send with MSG_ZEROCOPY (only TCP output)
+	size_t packet_size; 	// Size of datagrams of UDP output (0 - chunks)
+	int packet_sync; 	// Start datagrams at sync bytes of TS
+	size_t wake_bytes; 	// Wake output when this many bytes are pending
+	int wake_delay; 	// Wake output when the oldest chunk waits (us)
+	int buf_time; 		// Buffer this many ms of stream (0 - fixed buffer)
+	enum out_prio priority; // Priority class of output
+	uint64_t egress_wait; 	// Time waited for the egress rate in ns
+	unsigned long zc_sent; 	// Chunks sent with zero copy
+	unsigned long zc_copied; // Zero copy sends copied by the kernel
+	unsigned long packets_sent; // Datagrams sent by repacketizer
+	unsigned long packet_skipped; // Bytes skipped to find sync of TS
+	long long stream_rate; 	// Expected bitrate of input in bit/s (0 - unknown)
+	size_t probe_size; 	// Size of burst sent by -t (0 - none)
+	long probe_rtt; 	// Time of connect in us measured by -t (-1 - none)
+	long long probe_rate; 	// Throughput in bit/s measured by -t (-1 - none)
+	int retry_delay; 	// Delay before retrying in ms
+	unsigned long failures; // Failures followed by retrying
+	unsigned long recoveries; // Failures after which data move again
+	uint64_t fail_since; 	// Time of failure not recovered yet (0 - none)
+	uint64_t recover_ns; 	// Total time of recoveries in ns
+	uint64_t recover_max; 	// Longest recovery in ns
+	int ho_listenfd; 	// Listening socket taken over (-1 - none)
+	int ho_fd; 		// Connection or socket taken over (-1 - none)
+	char * ho_carry; 	// Data read, but not parsed yet by previous process
+	size_t ho_ncarry; 	// Length of ho_carry
+	struct sockaddr_storage ho_addr; // Destination of UDP output taken over
+	socklen_t ho_addrlen; 	// Length of ho_addr
+	struct io_cfg * io; 	// I/O config (only for input)
 	struct buffer * buf; 	// Write buffer (only for output)
 	int exit_status; 	// Did the read/write thread ended normally?
 	char test_only; 	// Only perform a test of connection, then end
@@ -54,12 +179,42 @@ struct endpt_cfg {
 };
 
 
+// Sequence number and timestamp of a chunk of the stream
+struct chunk_meta {
+	uint64_t seq; 		// Sequence number (0 - none)
+	uint64_t stamp; 	// Time of reading, ns since the epoch
+};
+
 // Write buffer for each output
 struct buffer {
 	size_t nitems; 		// Number of items
 	size_t it_size; 	// Size of item
 	char * buffer; 		// Buffer
 	ssize_t * datalens; 	// Length of data in each item
+	char ** refs; 		// Data outside of buffer (NULL - data in item)
+	struct chunk_meta * metas; // Sequence numbers and timestamps of items
+	struct spill * spill; 	// Spill file for overflow (NULL - none)
+	char * cons_spill; 	// Spilled data being consumed (NULL - none)
+	struct chunk_meta cons_spill_meta; // Meta of spilled data being consumed
+	unsigned long dropped; 	// Chunks dropped on overflow
+	// Consumed items before consumer position still read by the kernel
+	// (guarded by the lock)
+	size_t held;
+	int hold_cur; 		// Keep the item at consumer position when moving
+	size_t wake_bytes; 	// Wake consumer when this many bytes are pending
+	int wake_delay; 	// Wake consumer after this time in us (0 - at once)
+	size_t pending; 	// Bytes added since the buffer was empty
+	struct timespec pending_since; // When the buffer stopped being empty
+	int wake_now; 		// Was the waiting consumer woken for the batch?
+	unsigned long wakeups; 	// Consumer wakeups
+	int buf_time; 		// Ring holds this many ms of stream (0 - fixed size)
+	size_t want_items; 	// Ring size wanted for the chunk rate (0 - keep)
+	unsigned long rate_chunks; // Chunks since rate_since
+	struct timespec rate_since; // Start of the chunk rate measurement
+	double chunk_rate; 	// Measured chunks per second
+	unsigned long resizes; 	// Resizes of the ring
+	int capped; 		// Was growth limited by the memory cap?
+	int shed; 		// Drop the oldest chunks when half of ring waits
 	// Producer position in buffer (guarded by the lock)
 	int prod_pos;
 	// Consumer position in buffer (gaurded by the lock)
@@ -72,19 +227,29 @@ struct buffer {
 // Configuration of all endpoints
 struct io_cfg {
 	int n_outs; 			// Number of outputs
+	int size_outs; 			// Allocated outputs
 	struct endpt_cfg * outs; 	// Array of output configurations
-	struct endpt_cfg * input; 	// Pointer to input configuration
+	int n_inputs; 			// Number of inputs
+	// Array of input configurations, the first one is primary
+	struct endpt_cfg * input;
+	struct selector * sel; 		// Selector of redundant inputs
+	int n_feeds; 			// Number of buffers filled by input
+	struct buffer ** feeds; 	// Buffers filled by input
+	int n_stages; 			// Number of compression stages
+	struct comp_stage * stages; 	// Array of compression stages
 };
 
 #define	READ_BUFFER_BLOCK_SIZE 1024
 #define	WRITE_BUFFER_BLOCK_SIZE 1024
 #define	WRITE_BUFFER_BLOCK_COUNT 128
-#define	MAX_OUTPUTS 100		// Maximum number of outputs
-#define	RETRY_DELAY 1		// Delay between retrying to connect/open file
+#define	RETRY_DELAY 1000	// Delay between retrying to connect/open file in ms
+#define	LISTEN_BACKLOG 16	// Connections waiting for accept
 
 // Like printf, but with verbosity level
 int dprint(enum verbosity verb, const char * format, ...);
 int tdprint(void * id, enum verbosity verb, const char * format, ...);
+// Monotonic time in nanoseconds
+uint64_t now_ns(void);
 extern struct cmd_args cmd_args;
 
 #endif
@@ -0,0 +1,488 @@
+#define	_GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "pcap.h"
+
+#define	ETH_IPV4 0x0800 	// Ethertype of IPv4
+#define	ETH_IPV6 0x86dd 	// Ethertype of IPv6
+#define	ETH_VLAN 0x8100 	// Ethertype of VLAN tag
+#define	ETH_QINQ 0x88a8 	// Ethertype of outer VLAN tag
+#define	TCP_SYN 0x02 		// SYN flag of TCP
+
+/* Returns 16 bit value at p in network byte order */
+static uint16_t get16be(const uint8_t * p) {
+	return ((uint16_t)(p[0] << 8 | p[1]));
+}
+
+/* Returns 32 bit value at p in network byte order */
+static uint32_t get32be(const uint8_t * p) {
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3]);
+}
+
+/* Returns 16 bit value at p in byte order of the capture */
+static uint16_t get16(struct pcap_replay * pc, const uint8_t * p) {
+	uint16_t v;
+	memcpy(&v, p, sizeof (v));
+	return (pc->swap ? __builtin_bswap16(v) : v);
+}
+
+/* Returns 32 bit value at p in byte order of the capture */
+static uint32_t get32(struct pcap_replay * pc, const uint8_t * p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof (v));
+	return (pc->swap ? __builtin_bswap32(v) : v);
+}
+
+/* Initialize replay state pc of capture input cfg */
+void pcap_init(struct pcap_replay * pc, struct endpt_cfg * cfg) {
+	replay_init(&pc->rp, cfg);
+}
+
+/*
+ * Read the file header of the mapped capture.
+ *
+ * Returns offset of the first record or block, -1 if the file is not a
+ * capture.
+ */
+static long pcap_header(struct pcap_replay * pc) {
+	uint8_t * map;
+	uint32_t magic;
+	map = (uint8_t *)pc->rp.map;
+	if (pc->rp.len < PCAP_HEADER_SIZE)
+		return (-1);
+	memcpy(&magic, map, sizeof (magic));
+	// Section header block is read as any other block
+	if (magic == PCAPNG_SHB) {
+		pc->ng = 1;
+		pc->n_ifaces = 0;
+		return (0);
+	}
+	pc->ng = 0;
+	for (int swap = 0; swap < 2; swap++) {
+		uint32_t m;
+		m = swap ? __builtin_bswap32(magic) : magic;
+		if (m != PCAP_MAGIC_US && m != PCAP_MAGIC_NS)
+			continue;
+		pc->swap = swap;
+		pc->tick = m == PCAP_MAGIC_US ? 1000 : 1;
+		// Upper bits carry FCS length
+		pc->linktype = get32(pc, map+20) & 0xffff;
+		return (PCAP_HEADER_SIZE);
+	}
+	return (-1);
+}
+
+/*
+ * Read an interface description block with body of length len into the
+ * list of interfaces of the section.
+ */
+static void pcapng_iface(struct pcap_replay * pc, const uint8_t * body,
+	size_t len) {
+
+	uint64_t rate;
+	size_t off;
+	if (len < 8 || pc->n_ifaces == PCAP_MAX_IFACES)
+		return;
+	// Timestamps are in us by default
+	rate = 1000000;
+	off = 8;
+	while (off+4 <= len) {
+		uint16_t code;
+		uint16_t olen;
+		code = get16(pc, body+off);
+		olen = get16(pc, body+off+2);
+		if (code == 0 || off+4+olen > len)
+			break;
+		if (code == PCAPNG_TSRESOL && olen >= 1) {
+			uint8_t v;
+			v = body[off+4];
+			rate = 1;
+			for (int i = 0; i < (v & 0x7f) && i < 63; i++)
+				rate *= v & 0x80 ? 2 : 10;
+		}
+		off += 4+((olen+3) & ~3);
+	}
+	pc->if_link[pc->n_ifaces] = get16(pc, body);
+	pc->if_rate[pc->n_ifaces] = rate;
+	pc->n_ifaces++;
+}
+
+/*
+ * Find the next packet of the capture from offset *pos, which is moved after
+ * it. Captured data of the packet, their length, the link type and time of
+ * capture in ns are stored to data, caplen, link and ts.
+ *
+ * Returns 1 if a packet was found, 0 at the end of the file, -1 if the file is
+ * corrupted.
+ */
+static int pcap_next(struct pcap_replay * pc, size_t * pos,
+	const uint8_t ** data, size_t * caplen, int * link, uint64_t * ts) {
+
+	uint8_t * map;
+	size_t len;
+	map = (uint8_t *)pc->rp.map;
+	len = pc->rp.len;
+	while (!pc->ng) {
+		uint8_t * rec;
+		uint32_t incl;
+		if (*pos+PCAP_RECORD_SIZE > len)
+			return (0);
+		rec = map+*pos;
+		incl = get32(pc, rec+8);
+		// Truncated last record ends the file
+		if (incl > len-*pos-PCAP_RECORD_SIZE)
+			return (0);
+		*data = rec+PCAP_RECORD_SIZE;
+		*caplen = incl;
+		*link = pc->linktype;
+		*ts = get32(pc, rec)*1000000000ULL+get32(pc, rec+4)*pc->tick;
+		*pos += PCAP_RECORD_SIZE+incl;
+		return (1);
+	}
+	while (*pos+12 <= len) {
+		uint8_t * blk;
+		uint32_t type;
+		uint32_t blen;
+		blk = map+*pos;
+		memcpy(&type, blk, sizeof (type));
+		if (type == PCAPNG_SHB) {
+			uint32_t order;
+			memcpy(&order, blk+8, sizeof (order));
+			if (order == PCAPNG_BYTE_ORDER)
+				pc->swap = 0;
+			else if (__builtin_bswap32(order) == PCAPNG_BYTE_ORDER)
+				pc->swap = 1;
+			else
+				return (-1);
+			pc->n_ifaces = 0;
+		}
+		type = get32(pc, blk);
+		blen = get32(pc, blk+4);
+		if (blen < 12 || blen%4 != 0)
+			return (-1);
+		if (blen > len-*pos)
+			return (0);
+		*pos += blen;
+		if (type == PCAPNG_IDB) {
+			pcapng_iface(pc, blk+8, blen-12);
+		} else if (type == PCAPNG_EPB && blen >= 32) {
+			uint32_t iface;
+			uint64_t t;
+			uint64_t rate;
+			iface = get32(pc, blk+8);
+			*caplen = get32(pc, blk+20);
+			if (iface >= (uint32_t)pc->n_ifaces ||
+				*caplen > blen-32)
+				continue;
+			t = (uint64_t)get32(pc, blk+12) << 32 | get32(pc, blk+16);
+			rate = pc->if_rate[iface];
+			*ts = t/rate*1000000000ULL+
+				(uint64_t)((double)(t%rate)*1e9/rate);
+			*data = blk+28;
+			*link = pc->if_link[iface];
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Check if captured frame p of length len and link type link belongs to the
+ * flow of input in, the first matching frame selects the flow. TCP payload
+ * already replayed is cut off.
+ *
+ * Returns 1 if the frame carries payload of the flow, which is stored to
+ * payload and plen, 0 otherwise.
+ */
+static int pcap_payload(struct pcap_replay * pc, struct endpt_cfg * in,
+	const uint8_t * p, size_t len, int link, const uint8_t ** payload,
+	size_t * plen) {
+
+	struct pcap_flow * fl;
+	unsigned int ethertype;
+	int family;
+	int proto;
+	const uint8_t * src;
+	const uint8_t * dst;
+	ethertype = 0;
+	switch (link) {
+		case LINK_NULL:
+			if (len < 4)
+				return (0);
+			p += 4;
+			len -= 4;
+			break;
+		case LINK_ETHERNET:
+			if (len < 14)
+				return (0);
+			ethertype = get16be(p+12);
+			p += 14;
+			len -= 14;
+			while ((ethertype == ETH_VLAN || ethertype == ETH_QINQ) &&
+				len >= 4) {
+
+				ethertype = get16be(p+2);
+				p += 4;
+				len -= 4;
+			}
+			break;
+		case LINK_SLL:
+			if (len < 16)
+				return (0);
+			ethertype = get16be(p+14);
+			p += 16;
+			len -= 16;
+			break;
+		case LINK_SLL2:
+			if (len < 20)
+				return (0);
+			ethertype = get16be(p);
+			p += 20;
+			len -= 20;
+			break;
+		case LINK_RAW:
+		case LINK_IPV4:
+		case LINK_IPV6:
+			break;
+		default:
+			return (0);
+	}
+	if (len < 1 || (ethertype != 0 && ethertype != ETH_IPV4 &&
+		ethertype != ETH_IPV6))
+		return (0);
+	if (p[0] >> 4 == 4) {
+		size_t ihl;
+		size_t total;
+		if (len < 20)
+			return (0);
+		ihl = (p[0] & 0x0f)*4;
+		total = get16be(p+2);
+		// Fragments are not reassembled
+		if (ihl < 20 || total < ihl || (get16be(p+6) & 0x3fff) != 0)
+			return (0);
+		if (total < len)
+			len = total;
+		if (len < ihl)
+			return (0);
+		family = AF_INET;
+		proto = p[9];
+		src = p+12;
+		dst = p+16;
+		p += ihl;
+		len -= ihl;
+	} else if (p[0] >> 4 == 6) {
+		size_t total;
+		if (len < 40)
+			return (0);
+		total = 40+get16be(p+4);
+		if (total < len)
+			len = total;
+		family = AF_INET6;
+		proto = p[6];
+		src = p+8;
+		dst = p+24;
+		p += 40;
+		len -= 40;
+		// Hop-by-hop, routing and destination options
+		while ((proto == 0 || proto == 43 || proto == 60) && len >= 8) {
+			size_t hlen;
+			hlen = (p[1]+1)*8;
+			if (hlen > len)
+				return (0);
+			proto = p[0];
+			p += hlen;
+			len -= hlen;
+		}
+	} else  {
+		return (0);
+	}
+
+	uint16_t sport;
+	uint16_t dport;
+	size_t hlen;
+	uint32_t seq;
+	int syn;
+	seq = 0;
+	syn = 0;
+	if (proto == IPPROTO_UDP) {
+		size_t ulen;
+		if (len < 8)
+			return (0);
+		ulen = get16be(p+4);
+		if (ulen >= 8 && ulen < len)
+			len = ulen;
+		hlen = 8;
+	} else if (proto == IPPROTO_TCP) {
+		if (len < 20)
+			return (0);
+		hlen = (p[12] >> 4)*4;
+		if (hlen < 20 || hlen > len)
+			return (0);
+		seq = get32be(p+4);
+		syn = p[13] & TCP_SYN;
+	} else  {
+		return (0);
+	}
+	sport = get16be(p);
+	dport = get16be(p+2);
+	*payload = p+hlen;
+	*plen = len-hlen;
+	if (*plen == 0)
+		return (0);
+
+	size_t alen;
+	alen = family == AF_INET ? 4 : 16;
+	fl = &pc->flow;
+	if (!fl->found) {
+		if ((in->protocol != -1 && proto != in->protocol) ||
+			(in->port != NULL && dport != atoi(in->port)))
+			return (0);
+		fl->found = 1;
+		fl->proto = proto;
+		fl->family = family;
+		memcpy(fl->src, src, alen);
+		memcpy(fl->dst, dst, alen);
+		fl->sport = sport;
+		fl->dport = dport;
+		fl->have_seq = 0;
+		tdprint(in, INFO, "Replaying %s flow from port %u to port %u\n",
+			proto == IPPROTO_TCP ? "TCP" : "UDP", sport, dport);
+	} else if (proto != fl->proto || family != fl->family ||
+		sport != fl->sport || dport != fl->dport ||
+		memcmp(src, fl->src, alen) != 0 ||
+		memcmp(dst, fl->dst, alen) != 0) {
+
+		return (0);
+	}
+	if (proto != IPPROTO_TCP)
+		return (1);
+	// SYN takes one sequence number before the payload
+	if (syn)
+		seq++;
+	if (!fl->have_seq) {
+		fl->next_seq = seq;
+		fl->have_seq = 1;
+	}
+	int32_t diff;
+	diff = (int32_t)(seq-fl->next_seq);
+	if (diff < 0) {
+		// Retransmitted data
+		if (*plen <= (size_t)-(int64_t)diff)
+			return (0);
+		*payload += -(int64_t)diff;
+		*plen -= -(int64_t)diff;
+		seq = fl->next_seq;
+	} else if (diff > 0) {
+		// Segment was not captured
+		if (pc->gaps++ == 0)
+			tdprint(in, WARN, "TCP segments missing in capture\n");
+	}
+	fl->next_seq = seq+*plen;
+	return (1);
+}
+
+/*
+ * Replay payload of a flow of capture file fd of input pc->rp.cfg into all
+ * buffers filled by input. Packets are published at the times of capture,
+ * scaled by Speed, payload longer than a chunk is split. The file is mapped
+ * into memory and buffers get references to the mapping. fd is closed.
+ *
+ * Returns REPLAY_END at the end of the file, REPLAY_KILL on termination signal,
+ * REPLAY_HANDOVER on handover and REPLAY_ERR on error.
+ */
+int pcap_replay(struct io_cfg * cfg, struct pcap_replay * pc, int fd) {
+	struct endpt_cfg * in;
+	in = pc->rp.cfg;
+	int res;
+	res = replay_map(&pc->rp, fd);
+	close(fd);
+	if (res == -1)
+		return (REPLAY_ERR);
+	long start;
+	start = pcap_header(pc);
+	if (start == -1) {
+		tdprint(in, ERR, "%s is not a pcap or pcapng file\n", in->name);
+		return (REPLAY_ERR);
+	}
+	tdprint(in, INFO, "Replaying capture %s\n", in->name);
+
+	size_t pos;
+	pos = start;
+	memset(&pc->flow, 0, sizeof (struct pcap_flow));
+	pc->have_first = 0;
+	pc->packets = 0;
+	pc->gaps = 0;
+	pc->rp.advised = 0;
+	pc->rp.unchecked = 0;
+	pc->rp.epoch = now_ns();
+	while (1) {
+		const uint8_t * data;
+		size_t caplen;
+		int link;
+		uint64_t ts;
+		res = pcap_next(pc, &pos, &data, &caplen, &link, &ts);
+		if (res == -1) {
+			tdprint(in, ERR, "Capture %s is corrupted\n", in->name);
+			return (REPLAY_ERR);
+		}
+		if (res == 0) {
+			tdprint(in, INFO, "Replayed %lu packets, %lu TCP gaps\n",
+				pc->packets, pc->gaps);
+			if (pc->packets == 0) {
+				tdprint(in, WARN, "No packets of the flow\n");
+				return (REPLAY_END);
+			}
+			if (!in->replay_loop)
+				return (REPLAY_END);
+			pos = start;
+			pc->flow.have_seq = 0;
+			pc->have_first = 0;
+			pc->rp.advised = 0;
+			pc->rp.epoch = now_ns();
+			continue;
+		}
+		replay_readahead(&pc->rp, pos);
+
+		const uint8_t * payload;
+		size_t plen;
+		if (!pcap_payload(pc, in, data, caplen, link, &payload, &plen))
+			continue;
+		pc->packets++;
+		// Packets are not published back in time
+		if (!pc->have_first) {
+			pc->first_ts = ts;
+			pc->last_ts = ts;
+			pc->have_first = 1;
+		}
+		if (ts < pc->last_ts)
+			ts = pc->last_ts;
+		pc->last_ts = ts;
+
+		uint64_t deadline;
+		if (in->replay_speed > 0)
+			deadline = pc->rp.epoch+
+				(uint64_t)((ts-pc->first_ts)/in->replay_speed);
+		else
+			deadline = now_ns();
+		res = replay_wait(&pc->rp, deadline);
+		if (res != 0)
+			return (res);
+		while (plen > 0) {
+			size_t n;
+			n = plen;
+			if (n > READ_BUFFER_BLOCK_SIZE)
+				n = READ_BUFFER_BLOCK_SIZE;
+			buffers_insert_ref(cfg->feeds, cfg->n_feeds,
+				(char *)payload, n);
+			payload += n;
+			plen -= n;
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef PCAP_H
+#define	PCAP_H
+
+#include <stdint.h>
+#include "netstream.h"
+#include "replay.h"
+
+/*
+ * Input of `Type: pcap` replays payload of one UDP or TCP flow of a capture
+ * file (pcap or pcapng) with the original timing. The file is mapped into
+ * memory and buffers get references to the payload in the mapping. Link
+ * types Ethernet (with VLAN tags), Linux cooked (v1 and v2), raw IP and BSD
+ * loopback are understood, IPv4 fragments and other packets are skipped.
+ *
+ * The first packet matching Protocol and Port (if set) selects the flow,
+ * later packets must have its addresses and ports. TCP payload is ordered
+ * by sequence numbers, retransmitted data are skipped.
+ */
+#define	PCAP_MAGIC_US 0xa1b2c3d4 	// pcap with timestamps in us
+#define	PCAP_MAGIC_NS 0xa1b23c4d 	// pcap with timestamps in ns
+#define	PCAP_HEADER_SIZE 24 		// Size of the file header of pcap
+#define	PCAP_RECORD_SIZE 16 		// Size of the record header of pcap
+#define	PCAPNG_SHB 0x0a0d0d0a 		// Section header block
+#define	PCAPNG_IDB 1 			// Interface description block
+#define	PCAPNG_EPB 6 			// Enhanced packet block
+#define	PCAPNG_BYTE_ORDER 0x1a2b3c4d 	// Byte order magic of section
+#define	PCAPNG_TSRESOL 9 		// Option with resolution of timestamps
+#define	PCAP_MAX_IFACES 64 		// Interfaces of a pcapng section
+
+#define	LINK_NULL 0 			// BSD loopback
+#define	LINK_ETHERNET 1 		// Ethernet
+#define	LINK_RAW 101 			// Raw IPv4 or IPv6
+#define	LINK_SLL 113 			// Linux cooked capture
+#define	LINK_IPV4 228 			// Raw IPv4
+#define	LINK_IPV6 229 			// Raw IPv6
+#define	LINK_SLL2 276 			// Linux cooked capture v2
+
+// Flow selected from a capture
+struct pcap_flow {
+	int found; 		// Was the flow selected yet?
+	int proto; 		// IPPROTO_UDP or IPPROTO_TCP
+	int family; 		// AF_INET or AF_INET6
+	uint8_t src[16]; 	// Source address
+	uint8_t dst[16]; 	// Destination address
+	uint16_t sport; 	// Source port
+	uint16_t dport; 	// Destination port
+	int have_seq; 		// Is next_seq valid (TCP)?
+	uint32_t next_seq; 	// Sequence number of the next payload byte (TCP)
+};
+
+// Replay state of a capture file input
+struct pcap_replay {
+	struct replay rp; 	// Mapping of the capture and pacing
+	int ng; 		// Is the file pcapng?
+	int swap; 		// Is the byte order of the file swapped?
+	int linktype; 		// Link type of pcap
+	uint64_t tick; 		// Time of a fraction unit of pcap timestamp (ns)
+	int n_ifaces; 		// Interfaces of the current pcapng section
+	int if_link[PCAP_MAX_IFACES]; // Link types of interfaces
+	uint64_t if_rate[PCAP_MAX_IFACES]; // Timestamp units per second
+	struct pcap_flow flow; 	// Replayed flow
+	int have_first; 	// Is first_ts valid?
+	uint64_t first_ts; 	// Time of the first packet of the flow (ns)
+	uint64_t last_ts; 	// Time of the last packet of the flow (ns)
+	unsigned long packets; 	// Packets of the flow replayed
+	unsigned long gaps; 	// Missing TCP segments
+};
+
+void pcap_init(struct pcap_replay * pc, struct endpt_cfg * cfg);
+int pcap_replay(struct io_cfg * cfg, struct pcap_replay * pc, int fd);
+
+#endif
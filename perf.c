@@ -0,0 +1,139 @@
+#define	_GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "netstream.h"
+#include "perf.h"
+
+static int perf_on;
+
+static const uint64_t perf_configs[PC_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES
+};
+
+/* Measure stages of endpoints started later */
+void perf_enable(void) {
+	perf_on = 1;
+}
+
+/*
+ * Open hardware counter config of the calling thread in group of leader
+ * (-1 - the counter is the leader).
+ *
+ * Returns file descriptor of the counter, -1 on error.
+ */
+static int perf_open(uint64_t config, int leader, int exclude_kernel) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof (attr));
+	attr.size = sizeof (attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = leader == -1;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+}
+
+/* Open counters of all pt->fds, returns 0 on success, -1 on error */
+static int perf_open_group(struct perf_thread * pt, int exclude_kernel) {
+	for (int i = 0; i < PC_COUNTERS; i++) {
+		pt->fds[i] = perf_open(perf_configs[i], pt->fd,
+			exclude_kernel);
+		if (pt->fds[i] == -1) {
+			for (int j = 0; j < i; j++)
+				close(pt->fds[j]);
+			pt->fd = -1;
+			return (-1);
+		}
+		if (i == 0)
+			pt->fd = pt->fds[0];
+	}
+	return (0);
+}
+
+/*
+ * Start measuring stages of endpoint cfg run by the calling thread, if -p is
+ * set. Kernel is counted too if it is allowed.
+ */
+void perf_thread_open(struct perf_thread * pt, struct endpt_cfg * cfg) {
+	pt->cfg = NULL;
+	pt->fd = -1;
+	if (!perf_on)
+		return;
+	pt->cfg = cfg;
+	if (perf_open_group(pt, 0) == -1 &&
+		((errno != EACCES && errno != EPERM) ||
+		perf_open_group(pt, 1) == -1)) {
+
+		tdprint(cfg, NOTICE, "Hardware counters are not available: "
+			"%s\n", strerror(errno));
+		return;
+	}
+	if (ioctl(pt->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) {
+		for (int i = 0; i < PC_COUNTERS; i++)
+			close(pt->fds[i]);
+		pt->fd = -1;
+		return;
+	}
+	cfg->perf_hw = 1;
+}
+
+/* Read counters of pt and resource usage of the calling thread */
+static void perf_read(struct perf_thread * pt, uint64_t * counts,
+	uint64_t * cpu_ns, long * nvcsw, long * nivcsw) {
+
+	struct rusage ru;
+	if (pt->fd != -1) {
+		uint64_t buf[1+PC_COUNTERS];
+		if (read(pt->fd, buf, sizeof (buf)) == sizeof (buf))
+			memcpy(counts, buf+1, sizeof (uint64_t)*PC_COUNTERS);
+	}
+	if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+		*cpu_ns = (ru.ru_utime.tv_sec+ru.ru_stime.tv_sec)*1000000000ULL+
+			(ru.ru_utime.tv_usec+ru.ru_stime.tv_usec)*1000ULL;
+		*nvcsw = ru.ru_nvcsw;
+		*nivcsw = ru.ru_nivcsw;
+	}
+}
+
+/* Start a run of a stage of the calling thread */
+void perf_begin(struct perf_thread * pt) {
+	if (pt->cfg == NULL)
+		return;
+	perf_read(pt, pt->counts, &pt->cpu_ns, &pt->nvcsw, &pt->nivcsw);
+}
+
+/*
+ * End the run of stage started by perf_begin, which processed bytes, and add
+ * its costs to the stage.
+ */
+void perf_end(struct perf_thread * pt, enum perf_stage stage, size_t bytes) {
+	struct perf_stats * st;
+	uint64_t counts[PC_COUNTERS];
+	uint64_t cpu_ns;
+	long nvcsw;
+	long nivcsw;
+	if (pt->cfg == NULL)
+		return;
+	memcpy(counts, pt->counts, sizeof (counts));
+	cpu_ns = pt->cpu_ns;
+	nvcsw = pt->nvcsw;
+	nivcsw = pt->nivcsw;
+	perf_read(pt, counts, &cpu_ns, &nvcsw, &nivcsw);
+	st = &pt->cfg->perf[stage];
+	st->calls++;
+	st->bytes += bytes;
+	for (int i = 0; i < PC_COUNTERS; i++)
+		st->counts[i] += counts[i]-pt->counts[i];
+	st->cpu_ns += cpu_ns-pt->cpu_ns;
+	st->nvcsw += nvcsw-pt->nvcsw;
+	st->nivcsw += nivcsw-pt->nivcsw;
+}
@@ -0,0 +1,34 @@
+#ifndef PERF_H
+#define	PERF_H
+
+#include <stdint.h>
+#include "netstream.h"
+
+/*
+ * Costs of stages of endpoints measured by -p. Each reader and writer thread
+ * opens a group of hardware counters (cycles, instructions and cache misses)
+ * by perf_event_open for itself. The counters and getrusage(RUSAGE_THREAD)
+ * are read at the start and at the end of each run of a stage and the
+ * differences are added to the stage. If hardware counters are not available
+ * (no PMU, perf_event_paranoid), only CPU time and context switches from
+ * getrusage are measured. Kernel time is counted only if the counters can
+ * count it, otherwise cycles are of user space only.
+ */
+
+// Counters of a thread
+struct perf_thread {
+	struct endpt_cfg * cfg; // Endpoint of the thread (NULL - -p not set)
+	int fd; 		// Leader of the group of counters (-1 - none)
+	int fds[PC_COUNTERS]; 	// All counters of the group
+	uint64_t counts[PC_COUNTERS]; // Counters at the start of the stage
+	uint64_t cpu_ns; 	// CPU time at the start of the stage
+	long nvcsw; 		// Voluntary switches at the start
+	long nivcsw; 		// Involuntary switches at the start
+};
+
+void perf_enable(void);
+void perf_thread_open(struct perf_thread * pt, struct endpt_cfg * cfg);
+void perf_begin(struct perf_thread * pt);
+void perf_end(struct perf_thread * pt, enum perf_stage stage, size_t bytes);
+
+#endif
@@ -0,0 +1,85 @@
+#define	_GNU_SOURCE
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include "netstream.h"
+#include "prio.h"
+
+static pthread_mutex_t eg_lock = PTHREAD_MUTEX_INITIALIZER;
+static double eg_rate; 		// Egress rate in bytes per second (0 - none)
+static double eg_burst; 	// Size of the bucket in bytes
+static double eg_tokens; 	// Bytes which can be sent now
+static uint64_t eg_last; 	// Time of the last refill in ns
+
+/*
+ * Set nice value of the calling thread of output cfg by its priority class.
+ * Without privilege, high priority threads keep the default.
+ */
+void prio_thread(struct endpt_cfg * cfg) {
+	int nice;
+	if (cfg->priority == PRIO_NORMAL)
+		return;
+	nice = cfg->priority == PRIO_HIGH ? PRIO_NICE_HIGH : PRIO_NICE_LOW;
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice) == -1)
+		tdprint(cfg, NOTICE, "Can't set nice %d: %s\n", nice,
+			strerror(errno));
+}
+
+/* Limit data sent by all outputs to rate bit/s (0 - unlimited) */
+void egress_init(long long rate) {
+	eg_rate = rate/8.0;
+	eg_burst = eg_rate*EGRESS_BURST/1000;
+	eg_tokens = eg_burst;
+	eg_last = now_ns();
+}
+
+/*
+ * Take bytes from the egress rate for output cfg, wait until they are
+ * available. A class takes only when the bucket is above its floor: high
+ * priority may take a burst in advance, normal priority takes when the bucket
+ * is not empty and low priority only when half of the burst is left.
+ */
+void egress_take(struct endpt_cfg * cfg, size_t bytes) {
+	double floor;
+	if (eg_rate == 0)
+		return;
+	switch (cfg->priority) {
+		case PRIO_HIGH:
+			floor = -eg_burst;
+			break;
+		case PRIO_LOW:
+			floor = eg_burst/2;
+			break;
+		default:
+			floor = 0;
+			break;
+	}
+	pthread_mutex_lock(&eg_lock);
+	while (1) {
+		uint64_t now;
+		double wait;
+		struct timespec ts;
+		now = now_ns();
+		eg_tokens += (now-eg_last)*eg_rate/1e9;
+		if (eg_tokens > eg_burst)
+			eg_tokens = eg_burst;
+		eg_last = now;
+		if (eg_tokens >= floor)
+			break;
+		wait = (floor-eg_tokens)/eg_rate*1e9;
+		pthread_mutex_unlock(&eg_lock);
+		ts.tv_sec = (time_t)(wait/1e9);
+		ts.tv_nsec = (long)(wait-ts.tv_sec*1e9);
+		nanosleep(&ts, NULL);
+		cfg->egress_wait += now_ns()-now;
+		pthread_mutex_lock(&eg_lock);
+	}
+	eg_tokens -= bytes;
+	pthread_mutex_unlock(&eg_lock);
+}
@@ -0,0 +1,21 @@
+#ifndef PRIO_H
+#define	PRIO_H
+
+#include <stddef.h>
+#include "netstream.h"
+
+/*
+ * Priority classes of outputs. When the host is saturated, outputs of a
+ * lower class shed load first: their threads run with a higher nice value,
+ * they wait longer for the shared egress rate (-e) and they drop the oldest
+ * chunks when half of their buffer waits.
+ */
+#define	PRIO_NICE_HIGH -5 	// Nice of high priority threads (needs privilege)
+#define	PRIO_NICE_LOW 10 	// Nice of low priority threads
+#define	EGRESS_BURST 50 	// Burst of the egress rate in ms
+
+void prio_thread(struct endpt_cfg * cfg);
+void egress_init(long long rate);
+void egress_take(struct endpt_cfg * cfg, size_t bytes);
+
+#endif
@@ -0,0 +1,214 @@
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include "netstream.h"
+#include "probe.h"
+
+/* Returns ms left until deadline (monotonic ns), at least 0 */
+static int ms_left(uint64_t deadline) {
+	uint64_t now;
+	now = now_ns();
+	if (now >= deadline)
+		return (0);
+	return ((deadline-now+999999)/1000000);
+}
+
+/*
+ * Connect socket fd of output cfg to addr, at most for PROBE_TIMEOUT ms. The
+ * time of the connect (one round trip for TCP) is stored to cfg->probe_rtt.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int probe_connect(struct endpt_cfg * cfg, int fd, struct sockaddr * addr,
+	socklen_t addrlen) {
+
+	int flags;
+	int err;
+	socklen_t errlen;
+	uint64_t start;
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return (-1);
+	start = now_ns();
+	if (connect(fd, addr, addrlen) == -1) {
+		struct pollfd pfd;
+		int res;
+		if (errno != EINPROGRESS)
+			return (-1);
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		do  {
+			res = poll(&pfd, 1, PROBE_TIMEOUT);
+		} while (res == -1 && errno == EINTR);
+		if (res == 0) {
+			tdprint(cfg, WARN, "Connect timed out\n");
+			errno = ETIMEDOUT;
+			return (-1);
+		}
+		errlen = sizeof (err);
+		if (res == -1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err,
+			&errlen) == -1)
+			return (-1);
+		if (err != 0) {
+			errno = err;
+			return (-1);
+		}
+	}
+	cfg->probe_rtt = (now_ns()-start)/1000;
+	if (fcntl(fd, F_SETFL, flags) == -1)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Send a burst of cfg->probe_size zero bytes to connected TCP socket fd of
+ * output cfg and wait until the receiver acknowledges it, at most for
+ * PROBE_TIMEOUT ms. The throughput of acknowledged data in bit/s is stored
+ * to cfg->probe_rate, so data waiting in the socket buffers do not count.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int probe_burst(struct endpt_cfg * cfg, int fd) {
+	static const char zeros[PROBE_CHUNK];
+	size_t sent;
+	int unacked;
+	uint64_t start;
+	uint64_t deadline;
+	sent = 0;
+	start = now_ns();
+	deadline = start+PROBE_TIMEOUT*1000000ULL;
+	while (sent < cfg->probe_size && ms_left(deadline) > 0) {
+		struct pollfd pfd;
+		ssize_t res;
+		size_t len;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, ms_left(deadline)) <= 0)
+			continue;
+		len = cfg->probe_size-sent;
+		if (len > PROBE_CHUNK)
+			len = PROBE_CHUNK;
+		res = send(fd, zeros, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (res == -1 && errno != EAGAIN && errno != EINTR)
+			return (-1);
+		if (res > 0)
+			sent += res;
+	}
+	// Bytes not acknowledged yet are in the output queue
+	while (1) {
+		struct timespec ts;
+		if (ioctl(fd, SIOCOUTQ, &unacked) == -1)
+			unacked = 0;
+		if (unacked == 0 || ms_left(deadline) == 0)
+			break;
+		ts.tv_sec = 0;
+		ts.tv_nsec = 1000000;
+		nanosleep(&ts, NULL);
+	}
+	if (sent < cfg->probe_size || unacked > 0)
+		tdprint(cfg, WARN, "Burst not delivered in %d ms\n",
+			PROBE_TIMEOUT);
+	cfg->probe_rate = (long long)((double)(sent-unacked)*8e9/
+		(now_ns()-start));
+	return (0);
+}
+
+/* Print string s as a JSON string to stdout (null for NULL) */
+static void print_json_str(const char * s) {
+	if (s == NULL) {
+		printf("null");
+		return;
+	}
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/*
+ * Print the summary of the probe of all endpoints of cfg to stdout as JSON.
+ * The stream bitrate is the highest StreamRate (or Bitrate of replay) of the
+ * inputs, an output overflows if its measured throughput is lower.
+ *
+ * Returns 0 if all endpoints are ready and no output overflows, -1 otherwise.
+ */
+int probe_report(struct io_cfg * cfg) {
+	long long rate;
+	int ret;
+	rate = 0;
+	ret = 0;
+	for (int i = 0; i < cfg->n_inputs; i++) {
+		struct endpt_cfg * in;
+		long long r;
+		in = &cfg->input[i];
+		r = in->stream_rate > 0 ? in->stream_rate : in->replay_bitrate;
+		if (r > rate)
+			rate = r;
+	}
+	printf("{\n	\"stream_rate\": ");
+	if (rate > 0)
+		printf("%lld", rate);
+	else
+		printf("null");
+	printf(",\n	\"inputs\": [");
+	for (int i = 0; i < cfg->n_inputs; i++) {
+		struct endpt_cfg * in;
+		in = &cfg->input[i];
+		if (in->exit_status != 0)
+			ret = -1;
+		printf("%s\n		{\"index\": %d, \"name\": ", i ? "," : "", i);
+		print_json_str(in->name);
+		printf(", \"port\": ");
+		print_json_str(in->port);
+		printf(", \"ok\": %s}", in->exit_status == 0 ? "true" : "false");
+	}
+	printf("\n	],\n	\"outputs\": [");
+	for (int i = 0; i < cfg->n_outs; i++) {
+		struct endpt_cfg * out;
+		out = &cfg->outs[i];
+		if (out->exit_status != 0)
+			ret = -1;
+		printf("%s\n		{\"index\": %d, \"name\": ", i ? "," : "", i);
+		print_json_str(out->name);
+		printf(", \"port\": ");
+		print_json_str(out->port);
+		printf(", \"ok\": %s", out->exit_status == 0 ? "true" : "false");
+		printf(", \"connect_us\": ");
+		if (out->probe_rtt >= 0)
+			printf("%ld", out->probe_rtt);
+		else
+			printf("null");
+		printf(", \"throughput\": ");
+		if (out->probe_rate >= 0)
+			printf("%lld", out->probe_rate);
+		else
+			printf("null");
+		printf(", \"overflow\": ");
+		if (out->probe_rate >= 0 && rate > 0) {
+			printf("%s", out->probe_rate < rate ? "true" : "false");
+			if (out->probe_rate < rate)
+				ret = -1;
+		} else  {
+			printf("null");
+		}
+		printf("}");
+	}
+	printf("\n	]\n}\n");
+	fflush(stdout);
+	return (ret);
+}
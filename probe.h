@@ -0,0 +1,21 @@
+#ifndef PROBE_H
+#define	PROBE_H
+
+#include <sys/socket.h>
+#include "netstream.h"
+
+/*
+ * Probe of neighbours run by -t. All outputs are connected concurrently, each
+ * by its own thread, with a timeout. The round trip time of the TCP handshake
+ * is measured and outputs with Probe set send a synthetic burst to measure
+ * the throughput. A JSON summary is printed to stdout.
+ */
+#define	PROBE_TIMEOUT 3000 	// Timeout of connect and burst in ms
+#define	PROBE_CHUNK 65536 	// Size of writes of the burst
+
+int probe_connect(struct endpt_cfg * cfg, int fd, struct sockaddr * addr,
+	socklen_t addrlen);
+int probe_burst(struct endpt_cfg * cfg, int fd);
+int probe_report(struct io_cfg * cfg);
+
+#endif
@@ -0,0 +1,263 @@
+#define	_GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "netstream.h"
+#include "record.h"
+
+/*
+ * Expand filename template of the recording into name. Template is
+ * a strftime format with %N for the segment number. If segments are rotated
+ * and the template has no conversion, the segment number is appended.
+ *
+ * Returns 0 on success, -1 if the name is too long.
+ */
+static int rec_filename(struct recorder * rec, char * name, size_t namelen) {
+	char format[PATH_MAX];
+	size_t pos;
+	int has_conv;
+	char * tmpl;
+	tmpl = rec->cfg->name;
+	pos = 0;
+	has_conv = 0;
+	for (char * c = tmpl; *c != '\0'; c++) {
+		if (pos+16 >= sizeof (format))
+			return (-1);
+		if (c[0] == '%' && c[1] == 'N') {
+			pos += snprintf(format+pos, sizeof (format)-pos, "%u",
+				rec->segment);
+			has_conv = 1;
+			c++;
+			continue;
+		}
+		if (c[0] == '%' && c[1] != '\0') {
+			format[pos++] = *c++;
+			has_conv = 1;
+		}
+		format[pos++] = *c;
+	}
+	format[pos] = '\0';
+	if (!has_conv && (rec->cfg->rec_rotate_size > 0 ||
+		rec->cfg->rec_rotate_time > 0)) {
+		snprintf(format+pos, sizeof (format)-pos, ".%u", rec->segment);
+	}
+
+	struct tm tm;
+	localtime_r(&rec->seg_start, &tm);
+	if (strftime(name, namelen, format, &tm) == 0)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Open next segment of the recording.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int rec_open_segment(struct recorder * rec) {
+	char name[PATH_MAX];
+	rec->seg_start = time(NULL);
+	if (rec_filename(rec, name, sizeof (name)) == -1) {
+		tdprint(rec->cfg, ERR, "Too long file name %s\n",
+			rec->cfg->name);
+		return (-1);
+	}
+	int flags;
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+	rec->direct = rec->cfg->rec_direct;
+	if (rec->direct)
+		flags |= O_DIRECT;
+	rec->fd = open(name, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (rec->fd == -1 && rec->direct && errno == EINVAL) {
+		tdprint(rec->cfg, WARN, "O_DIRECT not supported for %s\n",
+			name);
+		rec->direct = 0;
+		rec->fd = open(name, flags & ~O_DIRECT,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	}
+	if (rec->fd == -1) {
+		warn("Opening file %s to write failed", name);
+		return (-1);
+	}
+	tdprint(rec->cfg, INFO, "Recording segment %u to %s\n", rec->segment,
+		name);
+	rec->written = 0;
+	rec->allocated = 0;
+	rec->unsynced = 0;
+	rec->synced = 0;
+	return (0);
+}
+
+/*
+ * Write len bytes from the block to the current segment. Space is
+ * preallocated ahead and written data are synced according to the
+ * configuration.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int rec_write_block(struct recorder * rec, size_t len) {
+	struct endpt_cfg * cfg;
+	cfg = rec->cfg;
+	if (cfg->rec_prealloc > 0 && rec->allocated != -1 &&
+		rec->written+(off_t)len > rec->allocated) {
+
+		if (fallocate(rec->fd, FALLOC_FL_KEEP_SIZE, rec->allocated,
+			cfg->rec_prealloc) == 0) {
+			rec->allocated += cfg->rec_prealloc;
+		} else  {
+			tdprint(cfg, WARN, "Preallocation failed: %s\n",
+				strerror(errno));
+			rec->allocated = -1;
+		}
+	}
+	// Tail of the segment is not aligned, it is written without O_DIRECT
+	if (rec->direct && len%RECORD_ALIGN != 0) {
+		int flags;
+		flags = fcntl(rec->fd, F_GETFL);
+		if (flags == -1 ||
+			fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+			return (-1);
+		}
+		rec->direct = 0;
+	}
+	size_t nwritten;
+	nwritten = 0;
+	while (nwritten < len) {
+		ssize_t res;
+		res = write(rec->fd, rec->block+nwritten, len-nwritten);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		nwritten += res;
+	}
+	rec->written += len;
+	rec->unsynced += len;
+	if (cfg->rec_sync_size > 0 && rec->unsynced >= cfg->rec_sync_size) {
+		if (fdatasync(rec->fd) == -1)
+			return (-1);
+		// Synced data are not needed in page cache anymore
+		posix_fadvise(rec->fd, rec->synced, rec->written-rec->synced,
+			POSIX_FADV_DONTNEED);
+		rec->synced = rec->written;
+		rec->unsynced = 0;
+	}
+	return (0);
+}
+
+/*
+ * Flush the block and close the current segment. Unused preallocated space
+ * is released.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int rec_close_segment(struct recorder * rec) {
+	int res;
+	res = 0;
+	if (rec->fill > 0 && rec_write_block(rec, rec->fill) == -1)
+		res = -1;
+	rec->fill = 0;
+	if (rec->allocated > rec->written &&
+		ftruncate(rec->fd, rec->written) == -1) {
+		res = -1;
+	}
+	if (rec->cfg->rec_sync_size > 0 && fdatasync(rec->fd) == -1)
+		res = -1;
+	if (close(rec->fd) == -1)
+		res = -1;
+	rec->fd = -1;
+	return (res);
+}
+
+/*
+ * Start recording of file output cfg, open a segment with number
+ * rec->segment.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int rec_open(struct recorder * rec, struct endpt_cfg * cfg) {
+	rec->cfg = cfg;
+	rec->fd = -1;
+	rec->fill = 0;
+	rec->block_size = cfg->rec_write_size;
+	// Writes has to be aligned for O_DIRECT
+	rec->block_size = (rec->block_size+RECORD_ALIGN-1)/RECORD_ALIGN*
+		RECORD_ALIGN;
+	if (posix_memalign((void **)&rec->block, RECORD_ALIGN,
+		rec->block_size) != 0) {
+		tdprint(cfg, ERR, "Can't allocate memory for recording\n");
+		rec->block = NULL;
+		return (-1);
+	}
+	if (rec_open_segment(rec) == -1) {
+		free(rec->block);
+		rec->block = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Write ndata bytes from data to the recording. Data are coalesced into
+ * large writes, a new segment is started when the current one is full or
+ * old enough.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int rec_write(struct recorder * rec, char * data, size_t ndata) {
+	struct endpt_cfg * cfg;
+	cfg = rec->cfg;
+	while (ndata > 0) {
+		size_t len;
+		len = rec->block_size-rec->fill;
+		if (len > ndata)
+			len = ndata;
+		memcpy(rec->block+rec->fill, data, len);
+		rec->fill += len;
+		data += len;
+		ndata -= len;
+		if (rec->fill == rec->block_size) {
+			if (rec_write_block(rec, rec->fill) == -1)
+				return (-1);
+			rec->fill = 0;
+		}
+	}
+
+	if ((cfg->rec_rotate_size > 0 &&
+		rec->written+(off_t)rec->fill >= cfg->rec_rotate_size) ||
+		(cfg->rec_rotate_time > 0 &&
+		time(NULL)-rec->seg_start >= cfg->rec_rotate_time)) {
+
+		if (rec_close_segment(rec) == -1)
+			return (-1);
+		rec->segment++;
+		if (rec_open_segment(rec) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Flush and close the recording. When the recording is opened again, it
+ * continues with the next segment.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int rec_close(struct recorder * rec) {
+	int res;
+	res = 0;
+	if (rec->fd != -1)
+		res = rec_close_segment(rec);
+	rec->segment++;
+	free(rec->block);
+	rec->block = NULL;
+	return (res);
+}
@@ -0,0 +1,31 @@
+#ifndef RECORD_H
+#define	RECORD_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "netstream.h"
+
+#define	RECORD_ALIGN 4096 		// Alignment of writes (for O_DIRECT)
+#define	RECORD_WRITE_SIZE (1024*1024) 	// Default size of one write
+
+// Recording state of a file output
+struct recorder {
+	struct endpt_cfg * cfg; // Configuration of the output
+	int fd; 		// Current segment file
+	char * block; 		// Aligned buffer for coalescing writes
+	size_t block_size; 	// Size of block
+	size_t fill; 		// Used bytes in block
+	off_t written; 		// Bytes written into current segment
+	off_t allocated; 	// Preallocated size of current segment
+	off_t unsynced; 	// Bytes written since the last fdatasync
+	off_t synced; 		// Offset of the first unsynced byte
+	time_t seg_start; 	// Time when current segment was opened
+	unsigned int segment; 	// Number of current segment
+	int direct; 		// Current segment is opened with O_DIRECT
+};
+
+int rec_open(struct recorder * rec, struct endpt_cfg * cfg);
+int rec_write(struct recorder * rec, char * data, size_t ndata);
+int rec_close(struct recorder * rec);
+
+#endif
@@ -0,0 +1,169 @@
+#define	_GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "repack.h"
+
+/*
+ * Returns number of bytes of data of length len before a sync byte of
+ * transport stream, which is followed by another one a packet later (if the
+ * data are so long), len if there is none.
+ */
+static size_t ts_skip(const char * data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if ((unsigned char)data[i] == TS_SYNC_BYTE &&
+			(i+TS_PACKET_SIZE >= len ||
+			(unsigned char)data[i+TS_PACKET_SIZE] == TS_SYNC_BYTE))
+			return (i);
+	}
+	return (len);
+}
+
+/* Start repacketizing output cfg into datagrams sent to addr */
+void repack_start(struct repack * rp, struct endpt_cfg * cfg,
+	struct sockaddr * addr, socklen_t addrlen) {
+
+	memset(rp, 0, sizeof (struct repack));
+	rp->cfg = cfg;
+	rp->addr = addr;
+	rp->addrlen = addrlen;
+}
+
+/*
+ * Send complete datagrams to fd, with all also the incomplete one, which is
+ * shorter. Chunks with no piece in the incomplete datagram are released. If
+ * sending fails, the rest of the batch is lost as any lost datagram.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int repack_flush(struct repack * rp, int fd, int all) {
+	struct mmsghdr msgs[REPACK_BATCH];
+	unsigned long keep;
+	int first;
+	int nsent;
+	int ret;
+	ret = 0;
+	if (all && rp->fill > 0) {
+		rp->ndgrams++;
+		rp->first[rp->ndgrams] = rp->npieces;
+		rp->fill = 0;
+	}
+	for (int i = 0; i < rp->ndgrams; i++) {
+		struct msghdr * msg;
+		msg = &msgs[i].msg_hdr;
+		memset(msg, 0, sizeof (struct msghdr));
+		msg->msg_name = rp->addr;
+		msg->msg_namelen = rp->addrlen;
+		msg->msg_iov = &rp->iov[rp->first[i]];
+		msg->msg_iovlen = rp->first[i+1]-rp->first[i];
+	}
+	nsent = 0;
+	while (nsent < rp->ndgrams) {
+		int res;
+		res = sendmmsg(fd, msgs+nsent, rp->ndgrams-nsent, 0);
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res == -1) {
+			ret = -1;
+			break;
+		}
+		nsent += res;
+	}
+	rp->cfg->packets_sent += nsent;
+	first = rp->first[rp->ndgrams];
+	if (first < rp->npieces) {
+		keep = rp->chunk[first];
+		rp->npieces -= first;
+		memmove(rp->iov, rp->iov+first,
+			sizeof (struct iovec)*rp->npieces);
+		memmove(rp->chunk, rp->chunk+first,
+			sizeof (unsigned long)*rp->npieces);
+	} else  {
+		// The rest of a chunk being added will follow
+		keep = rp->adding ? rp->next-1 : rp->next;
+		rp->npieces = 0;
+	}
+	buffer_release(rp->cfg->buf, keep-rp->base);
+	rp->base = keep;
+	rp->ndgrams = 0;
+	rp->first[0] = 0;
+	return (ret);
+}
+
+/*
+ * Flush datagrams when the batch is full, when no more pieces fit or when
+ * too much of the buffer is held. Only if complete datagrams do not free
+ * enough, the incomplete one is sent short.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int repack_limit(struct repack * rp, int fd) {
+	size_t max_held;
+	int ret;
+	max_held = rp->cfg->buf->nitems/2;
+	if (max_held > REPACK_MAX_HELD)
+		max_held = REPACK_MAX_HELD;
+	ret = 0;
+	if (rp->ndgrams == REPACK_BATCH || rp->npieces == REPACK_PIECES ||
+		rp->next-rp->base >= max_held)
+		ret = repack_flush(rp, fd, 0);
+	if (rp->npieces == REPACK_PIECES || rp->next-rp->base >= max_held) {
+		if (repack_flush(rp, fd, 1) == -1)
+			ret = -1;
+	}
+	return (ret);
+}
+
+/*
+ * Add len bytes of data, the chunk at consumer position of the buffer of
+ * the output, to datagrams. The chunk is held until all its pieces are sent.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int repack_add(struct repack * rp, int fd, char * data, size_t len) {
+	unsigned long n;
+	int ret;
+	if (len == 0)
+		return (0);
+	if (buffer_hold(rp->cfg->buf) == -1)
+		return (-1);
+	n = rp->next++;
+	rp->adding = 1;
+	ret = 0;
+	while (len > 0) {
+		size_t take;
+		if (rp->fill == 0 && rp->cfg->packet_sync) {
+			size_t skip;
+			skip = ts_skip(data, len);
+			rp->cfg->packet_skipped += skip;
+			data += skip;
+			len -= skip;
+			if (len == 0)
+				break;
+		}
+		take = rp->cfg->packet_size-rp->fill;
+		if (take > len)
+			take = len;
+		rp->iov[rp->npieces].iov_base = data;
+		rp->iov[rp->npieces].iov_len = take;
+		rp->chunk[rp->npieces++] = n;
+		rp->fill += take;
+		data += take;
+		len -= take;
+		if (rp->fill == rp->cfg->packet_size) {
+			rp->ndgrams++;
+			rp->first[rp->ndgrams] = rp->npieces;
+			rp->fill = 0;
+		}
+		if (repack_limit(rp, fd) == -1)
+			ret = -1;
+	}
+	rp->adding = 0;
+	if (repack_limit(rp, fd) == -1)
+		ret = -1;
+	return (ret);
+}
@@ -0,0 +1,43 @@
+#ifndef REPACK_H
+#define	REPACK_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "netstream.h"
+#include "replay.h"
+
+/*
+ * Repacketizer of UDP outputs with Packet set. The stream is cut into
+ * datagrams of the configured size regardless of the chunks of the buffer.
+ * Datagrams are gathered from pieces of chunks, which are held in the buffer
+ * until they are sent, and sent in batches by sendmmsg, so the data are not
+ * copied. With PacketSync, each datagram starts at a sync byte of MPEG
+ * transport stream, bytes before it are skipped.
+ */
+#define	REPACK_BATCH 32 	// Datagrams sent by one sendmmsg
+#define	REPACK_PIECES 512 	// Pieces of chunks in datagrams of a batch
+#define	REPACK_MAX_HELD (WRITE_BUFFER_BLOCK_COUNT/2) // Chunks held at most
+#define	UDP_MAX_PAYLOAD 65507 	// Largest payload of an UDP datagram
+
+// Repacketizer of an UDP output
+struct repack {
+	struct endpt_cfg * cfg; // Output
+	struct sockaddr * addr; // Destination of datagrams
+	socklen_t addrlen; 	// Length of addr
+	struct iovec iov[REPACK_PIECES]; // Pieces of datagrams, oldest first
+	unsigned long chunk[REPACK_PIECES]; // Number of chunk of each piece
+	int npieces; 		// Number of pieces
+	int ndgrams; 		// Complete datagrams in pieces
+	int first[REPACK_BATCH+1]; // First piece of each datagram
+	size_t fill; 		// Bytes of the incomplete datagram
+	unsigned long base; 	// Number of the oldest held chunk
+	unsigned long next; 	// Number of the next chunk
+	int adding; 		// The newest chunk is being added
+};
+
+void repack_start(struct repack * rp, struct endpt_cfg * cfg,
+	struct sockaddr * addr, socklen_t addrlen);
+int repack_add(struct repack * rp, int fd, char * data, size_t len);
+int repack_flush(struct repack * rp, int fd, int all);
+
+#endif
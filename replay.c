@@ -0,0 +1,277 @@
+#define	_GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "endpts.h"
+#include "replay.h"
+
+/* Initialize replay state rp of file input cfg */
+void replay_init(struct replay * rp, struct endpt_cfg * cfg) {
+	rp->cfg = cfg;
+	rp->map = NULL;
+	rp->len = 0;
+}
+
+/*
+ * Map file fd into memory. The existing mapping is reused if the file has not
+ * changed since it was mapped.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int replay_map(struct replay * rp, int fd) {
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		warn("Can't stat %s", rp->cfg->name);
+		return (-1);
+	}
+	if (rp->map != NULL && st.st_dev == rp->dev && st.st_ino == rp->ino &&
+		st.st_size == rp->len &&
+		st.st_mtim.tv_sec == rp->mtime.tv_sec &&
+		st.st_mtim.tv_nsec == rp->mtime.tv_nsec) {
+
+		return (0);
+	}
+	// Chunks of the old mapping can still be queued in buffers, so it is
+	// never unmapped
+	rp->map = NULL;
+	rp->len = 0;
+	if (st.st_size == 0)
+		return (0);
+
+	char * map;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		warn("Can't map %s", rp->cfg->name);
+		return (-1);
+	}
+	if (madvise(map, st.st_size, MADV_SEQUENTIAL) == -1) {
+		tdprint(rp->cfg, WARN, "madvise failed: %s\n",
+			strerror(errno));
+	}
+	rp->map = map;
+	rp->len = st.st_size;
+	rp->dev = st.st_dev;
+	rp->ino = st.st_ino;
+	rp->mtime = st.st_mtim;
+	return (0);
+}
+
+/* Ask the kernel to read ahead the file after offset pos */
+void replay_readahead(struct replay * rp, size_t pos) {
+	while (rp->advised < rp->len && rp->advised < pos+REPLAY_READAHEAD) {
+		size_t len;
+		len = rp->len-rp->advised;
+		if (len > REPLAY_READAHEAD)
+			len = REPLAY_READAHEAD;
+		madvise(rp->map+rp->advised, len, MADV_WILLNEED);
+		rp->advised += len;
+	}
+}
+
+/*
+ * Find alignment of TS packets starting at offset from. If there are no
+ * packets, ts_pos is set to the end of the file.
+ */
+static void ts_sync(struct replay * rp, size_t from) {
+	unsigned char * map;
+	map = (unsigned char *)rp->map;
+	for (size_t pos = from; pos+TS_PACKET_SIZE < rp->len; pos++) {
+		if (map[pos] == TS_SYNC_BYTE &&
+			map[pos+TS_PACKET_SIZE] == TS_SYNC_BYTE) {
+
+			rp->ts_pos = pos;
+			return;
+		}
+	}
+	rp->ts_pos = rp->len;
+}
+
+/*
+ * Find the next TS packet with PCR on the PCR PID. PCR is stored to pcr and
+ * offset of the packet to offset.
+ *
+ * Returns 1 if a packet was found, 0 at the end of the file.
+ */
+static int ts_next_pcr(struct replay * rp, uint64_t * pcr, size_t * offset) {
+	while (rp->ts_pos+TS_PACKET_SIZE <= rp->len) {
+		unsigned char * pkt;
+		pkt = (unsigned char *)rp->map+rp->ts_pos;
+		if (pkt[0] != TS_SYNC_BYTE) {
+			ts_sync(rp, rp->ts_pos+1);
+			continue;
+		}
+		*offset = rp->ts_pos;
+		rp->ts_pos += TS_PACKET_SIZE;
+		// Adaptation field with PCR flag
+		if (!(pkt[3] & 0x20) || pkt[4] < 7 || !(pkt[5] & 0x10))
+			continue;
+		int pid;
+		pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+		if (rp->pcr_pid != -1 && pid != rp->pcr_pid)
+			continue;
+		rp->pcr_pid = pid;
+		*pcr = ((uint64_t)pkt[6] << 25 | (uint64_t)pkt[7] << 17 |
+			(uint64_t)pkt[8] << 9 | (uint64_t)pkt[9] << 1 |
+			pkt[10] >> 7)*300 + ((pkt[10] & 0x01) << 8 | pkt[11]);
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Move to the next interval between two PCRs. Time of data without a valid
+ * PCR interval (before the first PCR, after a discontinuity or at the end of
+ * the file) is estimated from the rate of the last interval.
+ */
+static void replay_next_interval(struct replay * rp) {
+	rp->seg_off = rp->next_off;
+	rp->seg_time = rp->next_time;
+
+	uint64_t pcr;
+	size_t offset;
+	if (!ts_next_pcr(rp, &pcr, &offset)) {
+		rp->next_off = rp->len;
+		rp->next_time = rp->seg_time+(rp->len-rp->seg_off)*rp->rate;
+		return;
+	}
+	uint64_t step;
+	step = (pcr+PCR_WRAP-rp->last_pcr)%PCR_WRAP;
+	if (rp->have_pcr && step <= PCR_MAX_GAP && offset > rp->seg_off) {
+		rp->next_time = rp->seg_time+step*1e9/PCR_CLOCK;
+		rp->rate = (rp->next_time-rp->seg_time)/(offset-rp->seg_off);
+	} else  {
+		rp->next_time = rp->seg_time+(offset-rp->seg_off)*rp->rate;
+	}
+	rp->next_off = offset;
+	rp->last_pcr = pcr;
+	rp->have_pcr = 1;
+}
+
+/* Start the next pass of the replay from the beginning of the file */
+static void replay_rewind(struct replay * rp) {
+	rp->advised = 0;
+	if (rp->cfg->replay_pcr) {
+		ts_sync(rp, 0);
+		rp->next_off = 0;
+		rp->have_pcr = 0;
+		replay_next_interval(rp);
+	}
+}
+
+/* Returns time of byte at offset pos since the start of the replay in ns */
+static double replay_time(struct replay * rp, size_t pos) {
+	if (!rp->cfg->replay_pcr)
+		return (rp->sent*rp->rate);
+	while (pos >= rp->next_off)
+		replay_next_interval(rp);
+	return (rp->seg_time+(pos-rp->seg_off)*
+		(rp->next_time-rp->seg_time)/(rp->next_off-rp->seg_off));
+}
+
+/*
+ * Wait until deadline (monotonic time in ns). Signals are checked at least
+ * every REPLAY_SIGNAL_CHECK chunks even if there is no waiting.
+ *
+ * Returns 0 when the chunk can be published, REPLAY_KILL on termination
+ * signal, REPLAY_HANDOVER on handover and REPLAY_ERR on error.
+ */
+int replay_wait(struct replay * rp, uint64_t deadline) {
+	uint64_t now;
+	now = now_ns();
+	if (now > deadline+REPLAY_MAX_LAG) {
+		tdprint(rp->cfg, NOTICE, "Replay is late, resetting schedule\n");
+		rp->epoch += now-deadline;
+		deadline = now;
+	}
+	if (deadline <= now && ++rp->unchecked < REPLAY_SIGNAL_CHECK)
+		return (0);
+	rp->unchecked = 0;
+	do  {
+		struct timespec timeout;
+		uint64_t left;
+		left = deadline > now ? deadline-now : 0;
+		timeout.tv_sec = left/1000000000ULL;
+		timeout.tv_nsec = left%1000000000ULL;
+		switch (wait_for_event(rp->cfg, "replay", -1, signal_fds[0],
+			&timeout)) {
+
+			case WFE_SIG_TERM:
+				return (REPLAY_KILL);
+			case WFE_HANDOVER:
+				return (REPLAY_HANDOVER);
+			case WFE_POLL_ERR:
+				return (REPLAY_ERR);
+		}
+		now = now_ns();
+	} while (now < deadline);
+	return (0);
+}
+
+/*
+ * Replay file fd of input rp->cfg into all buffers filled by input. The file
+ * is mapped into memory and buffers get references to the mapping, so data
+ * are not copied. The replay is paced by the configured bitrate or by PCR of
+ * the MPEG transport stream. fd is closed.
+ *
+ * Returns REPLAY_END at the end of the file, REPLAY_KILL on termination signal,
+ * REPLAY_HANDOVER on handover and REPLAY_ERR on error.
+ */
+int replay_file(struct io_cfg * cfg, struct replay * rp, int fd) {
+	struct endpt_cfg * in;
+	in = rp->cfg;
+	int res;
+	res = replay_map(rp, fd);
+	close(fd);
+	if (res == -1)
+		return (REPLAY_ERR);
+	if (rp->len == 0)
+		return (REPLAY_END);
+	tdprint(in, INFO, "Replaying %zu bytes from %s\n", rp->len, in->name);
+
+	int paced;
+	paced = in->replay_pcr || in->replay_bitrate > 0;
+	rp->rate = 0;
+	if (in->replay_bitrate > 0)
+		rp->rate = 8e9/in->replay_bitrate;
+	rp->sent = 0;
+	rp->pcr_pid = -1;
+	rp->next_time = 0;
+	rp->unchecked = 0;
+	replay_rewind(rp);
+	rp->epoch = now_ns();
+
+	size_t pos;
+	pos = 0;
+	while (1) {
+		if (pos == rp->len) {
+			if (!in->replay_loop)
+				return (REPLAY_END);
+			pos = 0;
+			replay_rewind(rp);
+		}
+		size_t len;
+		len = rp->len-pos;
+		if (len > READ_BUFFER_BLOCK_SIZE)
+			len = READ_BUFFER_BLOCK_SIZE;
+		replay_readahead(rp, pos);
+
+		uint64_t deadline;
+		if (paced)
+			deadline = rp->epoch+(uint64_t)replay_time(rp, pos);
+		else
+			deadline = now_ns();
+		res = replay_wait(rp, deadline);
+		if (res != 0)
+			return (res);
+		buffers_insert_ref(cfg->feeds, cfg->n_feeds, rp->map+pos, len);
+		pos += len;
+		rp->sent += len;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef REPLAY_H
+#define	REPLAY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "netstream.h"
+
+#define	REPLAY_END 0
+#define	REPLAY_ERR -1
+#define	REPLAY_KILL -2
+#define	REPLAY_HANDOVER -3
+
+#define	REPLAY_READAHEAD (4*1024*1024) 	// Size of madvise read-ahead window
+#define	REPLAY_MAX_LAG 1000000000ULL 	// Schedule is reset after this lag (ns)
+#define	REPLAY_SIGNAL_CHECK 64 		// Chunks between checks of signals
+
+#define	TS_PACKET_SIZE 188
+#define	TS_SYNC_BYTE 0x47
+#define	PCR_CLOCK 27000000ULL 		// PCR ticks per second
+#define	PCR_WRAP (((uint64_t)1 << 33)*300) // PCR wraps around at this value
+#define	PCR_MAX_GAP PCR_CLOCK 		// Larger PCR step is a discontinuity
+
+// Replay state of a memory mapped file input
+struct replay {
+	struct endpt_cfg * cfg; // Configuration of the input
+	char * map; 		// Mapped file (NULL - not mapped yet)
+	size_t len; 		// Length of the mapping
+	dev_t dev; 		// Device of the mapped file
+	ino_t ino; 		// Inode of the mapped file
+	struct timespec mtime; 	// Modification time of the mapped file
+	size_t advised; 	// End of the read-ahead window
+	uint64_t epoch; 	// Monotonic time of the start of the replay (ns)
+	uint64_t sent; 		// Bytes published since the start of the replay
+	double rate; 		// Time of one byte (ns)
+	int unchecked; 		// Chunks published since the last signal check
+	size_t ts_pos; 		// Offset of the next TS packet
+	int pcr_pid; 		// PID carrying PCR (-1 - not known yet)
+	int have_pcr; 		// Is last_pcr valid?
+	uint64_t last_pcr; 	// Last PCR seen
+	size_t seg_off; 	// Offset of the start of current PCR interval
+	double seg_time; 	// Time of seg_off since the start (ns)
+	size_t next_off; 	// Offset of the end of current PCR interval
+	double next_time; 	// Time of next_off since the start (ns)
+};
+
+void replay_init(struct replay * rp, struct endpt_cfg * cfg);
+int replay_map(struct replay * rp, int fd);
+void replay_readahead(struct replay * rp, size_t pos);
+int replay_wait(struct replay * rp, uint64_t deadline);
+int replay_file(struct io_cfg * cfg, struct replay * rp, int fd);
+
+#endif
@@ -0,0 +1,298 @@
+#define	_DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "selector.h"
+
+#define	SEL_HASH_BASE 257u
+
+/*
+ * Create selector of all inputs of I/O config cfg. The first input is the
+ * primary one, the others are standby inputs in order of priority.
+ *
+ * Returns the selector or NULL if allocation fails.
+ */
+struct selector * selector_create(struct io_cfg * cfg) {
+	struct selector * sel;
+	sel = calloc(1, sizeof (struct selector));
+	if (sel == NULL)
+		return (NULL);
+	sel->inputs = calloc(cfg->n_inputs, sizeof (struct sel_input));
+	if (sel->inputs == NULL) {
+		free(sel);
+		return (NULL);
+	}
+	sel->cfg = cfg;
+	sel->n_inputs = cfg->n_inputs;
+	for (int i = 0; i < sel->n_inputs; i++) {
+		struct sel_input * in;
+		in = &sel->inputs[i];
+		in->cfg = &cfg->input[i];
+		in->backlog = malloc(SEL_BACKLOG);
+		in->chunks = malloc(sizeof (size_t)*SEL_CHUNKS);
+		if (in->backlog == NULL || in->chunks == NULL) {
+			for (int j = 0; j <= i; j++) {
+				free(sel->inputs[j].backlog);
+				free(sel->inputs[j].chunks);
+			}
+			free(sel->inputs);
+			free(sel);
+			return (NULL);
+		}
+	}
+	pthread_mutex_init(&sel->lock, NULL);
+	return (sel);
+}
+
+/*
+ * Publish ndata bytes from data into all buffers filled by input and remember
+ * the tail of published data.
+ */
+static void sel_publish(struct selector * sel, char * data, size_t ndata) {
+	if (ndata == 0)
+		return;
+	buffers_insert(sel->cfg->feeds, sel->cfg->n_feeds, data, ndata);
+	if (ndata >= SEL_MATCH) {
+		memcpy(sel->tail, data+ndata-SEL_MATCH, SEL_MATCH);
+		sel->ntail = SEL_MATCH;
+		return;
+	}
+	if (sel->ntail+ndata > SEL_MATCH) {
+		size_t shift;
+		shift = sel->ntail+ndata-SEL_MATCH;
+		memmove(sel->tail, sel->tail+shift, sel->ntail-shift);
+		sel->ntail -= shift;
+	}
+	memcpy(sel->tail+sel->ntail, data, ndata);
+	sel->ntail += ndata;
+}
+
+/*
+ * Publish data of input in from offset off of its backlog to the end. Chunks
+ * are published as they were received, so messages are kept.
+ */
+static void backlog_publish(struct selector * sel, struct sel_input * in,
+	size_t off) {
+
+	size_t pos;
+	pos = 0;
+	for (int i = 0; i < in->nchunks; i++) {
+		size_t end;
+		end = pos+in->chunks[i];
+		if (end > off) {
+			size_t from;
+			from = pos > off ? pos : off;
+			sel_publish(sel, in->backlog+from, end-from);
+		}
+		pos = end;
+	}
+	in->nbacklog = 0;
+	in->nchunks = 0;
+	in->searched = 0;
+}
+
+/* Append ndata bytes from data as a chunk to the backlog of input in */
+static void backlog_add(struct sel_input * in, char * data, size_t ndata) {
+	if (ndata > SEL_BACKLOG/2) {
+		data += ndata-SEL_BACKLOG/2;
+		ndata = SEL_BACKLOG/2;
+	}
+	if (in->nbacklog+ndata > SEL_BACKLOG || in->nchunks == SEL_CHUNKS) {
+		// Oldest chunks are dropped, about half of the backlog is kept
+		size_t drop;
+		int ndrop;
+		drop = 0;
+		ndrop = 0;
+		while (ndrop < in->nchunks && (in->nchunks-ndrop > SEL_CHUNKS/2 ||
+			in->nbacklog+ndata-drop > SEL_BACKLOG/2)) {
+
+			drop += in->chunks[ndrop++];
+		}
+		memmove(in->backlog, in->backlog+drop, in->nbacklog-drop);
+		memmove(in->chunks, in->chunks+ndrop,
+			sizeof (size_t)*(in->nchunks-ndrop));
+		in->nbacklog -= drop;
+		in->nchunks -= ndrop;
+		in->searched = in->searched > drop ? in->searched-drop : 0;
+	}
+	memcpy(in->backlog+in->nbacklog, data, ndata);
+	in->nbacklog += ndata;
+	in->chunks[in->nchunks++] = ndata;
+}
+
+/*
+ * Search the backlog of input in for the tail of published data. Rolling hash
+ * of a window is compared with hash of the tail, only windows with the same
+ * hash are compared byte by byte.
+ *
+ * Returns offset just after the tail in the backlog or -1 if it is not found.
+ */
+static ssize_t backlog_find_tail(struct selector * sel, struct sel_input * in) {
+	if (in->nbacklog < in->searched+SEL_MATCH)
+		return (-1);
+	unsigned char * tail;
+	unsigned char * data;
+	uint32_t target;
+	uint32_t hash;
+	uint32_t power;
+	tail = (unsigned char *)sel->tail;
+	data = (unsigned char *)in->backlog+in->searched;
+	target = 0;
+	hash = 0;
+	power = 1;
+	for (int i = 0; i < SEL_MATCH; i++) {
+		target = target*SEL_HASH_BASE+tail[i];
+		hash = hash*SEL_HASH_BASE+data[i];
+		if (i > 0)
+			power *= SEL_HASH_BASE;
+	}
+	size_t nwin;
+	nwin = in->nbacklog-in->searched-SEL_MATCH+1;
+	for (size_t pos = 0; pos < nwin; pos++) {
+		if (hash == target && memcmp(data+pos, tail, SEL_MATCH) == 0)
+			return (in->searched+pos+SEL_MATCH);
+		if (pos+1 < nwin) {
+			hash = (hash-data[pos]*power)*SEL_HASH_BASE+
+				data[pos+SEL_MATCH];
+		}
+	}
+	in->searched += nwin;
+	return (-1);
+}
+
+/*
+ * Try to continue the stream from the backlog of the newly active input in.
+ * Data up to the end of the last published data are skipped. If the input
+ * lags, its data are skipped until it catches up. If the tail is not found in
+ * SEL_BACKLOG/2 bytes received after the switch, the input is not a copy of
+ * the stream and its data are published as they are.
+ */
+static void sel_align(struct selector * sel, struct sel_input * in) {
+	if (sel->ntail < SEL_MATCH) {
+		// Nothing to continue
+		backlog_publish(sel, in, 0);
+		sel->aligning = 0;
+		return;
+	}
+	ssize_t off;
+	off = backlog_find_tail(sel, in);
+	if (off != -1) {
+		tdprint(in->cfg, INFO, "Input aligned, %zd bytes skipped\n",
+			off);
+		backlog_publish(sel, in, off);
+		sel->aligning = 0;
+	} else if (sel->waited > SEL_BACKLOG/2) {
+		tdprint(in->cfg, WARN, "Input does not continue the stream, "
+			"data may be lost or repeated\n");
+		backlog_publish(sel, in, 0);
+		sel->aligning = 0;
+	}
+}
+
+/* Make input id active, the stream continues from its backlog */
+static void sel_switch(struct selector * sel, int id) {
+	tdprint(sel->inputs[id].cfg, NOTICE, "Switching from input %d to "
+		"input %d\n", sel->active, id);
+	sel->inputs[sel->active].nbacklog = 0;
+	sel->inputs[sel->active].nchunks = 0;
+	sel->active = id;
+	sel->aligning = 1;
+	sel->waited = 0;
+	sel->inputs[id].searched = 0;
+	sel_align(sel, &sel->inputs[id]);
+}
+
+/*
+ * Pass ndata bytes received by input id to the selector. Data of the active
+ * input are published, data of standby inputs are kept in their backlog. The
+ * active input is switched when it stalls (no data for its StallTimeout) or
+ * when an input with higher priority has been receiving data for
+ * SEL_HOLDOFF.
+ */
+void selector_input(struct selector * sel, int id, char * data, size_t ndata) {
+	if (ndata == 0)
+		return;
+	pthread_mutex_lock(&sel->lock);
+	if (sel->ended) {
+		pthread_mutex_unlock(&sel->lock);
+		return;
+	}
+	struct sel_input * in;
+	uint64_t now;
+	in = &sel->inputs[id];
+	now = now_ns();
+	if (!in->up || now-in->last > in->cfg->stall_timeout*1000000ULL) {
+		if (!in->up) {
+			tdprint(in->cfg, INFO, "Input %d is receiving data\n",
+				id);
+		}
+		in->up = 1;
+		in->since = now;
+	}
+	in->last = now;
+
+	if (id == sel->active) {
+		if (!sel->aligning) {
+			sel_publish(sel, data, ndata);
+		} else  {
+			backlog_add(in, data, ndata);
+			sel->waited += ndata;
+			sel_align(sel, in);
+		}
+		pthread_mutex_unlock(&sel->lock);
+		return;
+	}
+
+	backlog_add(in, data, ndata);
+	struct sel_input * act;
+	act = &sel->inputs[sel->active];
+	if (act->up && now-act->last > act->cfg->stall_timeout*1000000ULL) {
+		tdprint(act->cfg, WARN, "Input %d stalled\n", sel->active);
+		act->up = 0;
+	}
+	if (!act->up || (id < sel->active && now-in->since >= SEL_HOLDOFF))
+		sel_switch(sel, id);
+	pthread_mutex_unlock(&sel->lock);
+}
+
+/*
+ * Report failure of input id, it is switched over with the next data of
+ * a standby input.
+ */
+void selector_down(struct selector * sel, int id) {
+	pthread_mutex_lock(&sel->lock);
+	sel->inputs[id].up = 0;
+	sel->inputs[id].nbacklog = 0;
+	sel->inputs[id].nchunks = 0;
+	pthread_mutex_unlock(&sel->lock);
+}
+
+/*
+ * Report end of input id, ndata is BUF_END_DATA, BUF_KILL or BUF_HANDOVER.
+ * Termination is published at once, end of data and handover only when all
+ * inputs have ended.
+ *
+ * Returns the number of inputs still running.
+ */
+int selector_end(struct selector * sel, int id, ssize_t ndata) {
+	pthread_mutex_lock(&sel->lock);
+	struct sel_input * in;
+	in = &sel->inputs[id];
+	in->up = 0;
+	in->ended = 1;
+	int running;
+	running = 0;
+	for (int i = 0; i < sel->n_inputs; i++) {
+		if (!sel->inputs[i].ended)
+			running++;
+	}
+	if (!sel->ended && (ndata == BUF_KILL || running == 0)) {
+		buffers_insert(sel->cfg->feeds, sel->cfg->n_feeds, NULL, ndata);
+		sel->ended = 1;
+	}
+	pthread_mutex_unlock(&sel->lock);
+	return (running);
+}
@@ -0,0 +1,47 @@
+#ifndef SELECTOR_H
+#define	SELECTOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "netstream.h"
+
+#define	SEL_MATCH 256 			// Published tail searched in standby data
+#define	SEL_BACKLOG (256*1024) 		// Data kept from each standby input
+#define	SEL_CHUNKS 4096 		// Chunks kept from each standby input
+#define	SEL_STALL_TIMEOUT 100 		// Default stall timeout in ms
+#define	SEL_HOLDOFF 1000000000ULL 	// Healthy time before switching back (ns)
+
+// State of one input of the selector
+struct sel_input {
+	struct endpt_cfg * cfg; // Configuration of the input
+	int up; 		// Is the input receiving data?
+	int ended; 		// Has the input thread ended?
+	uint64_t last; 		// Time of the last data (ns)
+	uint64_t since; 	// Time when the input went up (ns)
+	char * backlog; 	// Recent data received while standby
+	size_t nbacklog; 	// Length of data in backlog
+	size_t * chunks; 	// Lengths of chunks in backlog
+	int nchunks; 		// Number of chunks in backlog
+	size_t searched; 	// Backlog searched for the tail when aligning
+};
+
+// Selector of redundant inputs
+struct selector {
+	struct io_cfg * cfg; 	// I/O config, its feeds get selected data
+	int n_inputs; 		// Number of inputs
+	struct sel_input * inputs; // Inputs in order of priority
+	int active; 		// Index of the active input
+	int aligning; 		// Is the active input searched for the tail?
+	size_t waited; 		// Data received while aligning
+	int ended; 		// Was the end of the stream published?
+	char tail[SEL_MATCH]; 	// Last published data
+	size_t ntail; 		// Length of data in tail
+	pthread_mutex_t lock; 	// Lock of the whole state
+};
+
+struct selector * selector_create(struct io_cfg * cfg);
+void selector_input(struct selector * sel, int id, char * data, size_t ndata);
+void selector_down(struct selector * sel, int id);
+int selector_end(struct selector * sel, int id, ssize_t ndata);
+
+#endif
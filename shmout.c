@@ -0,0 +1,109 @@
+#define	_GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "netstream.h"
+#include "shmout.h"
+
+/* Wake all readers waiting on the ring */
+static void shm_out_wake(struct shm_out * so) {
+	__atomic_add_fetch(&so->ring->futex, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &so->ring->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Create or open shared memory ring of output cfg. Slots are as large as items
+ * of the output buffer. If the ring exists with the same geometry, sequence
+ * numbers continue, so running readers are not confused.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int shm_out_open(struct shm_out * so, struct endpt_cfg * cfg) {
+	uint32_t slot_size;
+	uint32_t stride;
+	so->cfg = cfg;
+	slot_size = cfg->buf->it_size;
+	stride = shm_ring_stride(slot_size);
+	so->size = SHM_RING_HDR_SIZE+(size_t)cfg->shm_slots*stride;
+
+	int fd;
+	fd = shm_open(cfg->name, O_RDWR | O_CREAT,
+		S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1) {
+		warn("Could not open shared memory %s", cfg->name);
+		return (-1);
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 ||
+		(st.st_size != so->size && ftruncate(fd, so->size) == -1)) {
+		warn("Could not resize shared memory %s", cfg->name);
+		close(fd);
+		return (-1);
+	}
+	so->ring = mmap(NULL, so->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+	if (so->ring == MAP_FAILED) {
+		warn("Could not map shared memory %s", cfg->name);
+		return (-1);
+	}
+
+	struct shm_ring * ring;
+	ring = so->ring;
+	if (ring->magic != SHM_RING_MAGIC || ring->version != SHM_RING_VERSION ||
+		ring->nslots != cfg->shm_slots || ring->slot_size != slot_size ||
+		ring->stride != stride) {
+
+		memset(ring, 0, so->size);
+		ring->version = SHM_RING_VERSION;
+		ring->nslots = cfg->shm_slots;
+		ring->slot_size = slot_size;
+		ring->stride = stride;
+		ring->head = 1;
+		__atomic_store_n(&ring->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+	}
+	__atomic_and_fetch(&ring->flags, ~SHM_RING_END, __ATOMIC_RELEASE);
+	tdprint(cfg, INFO, "Shared memory ring %s: %u slots of %u bytes\n",
+		cfg->name, ring->nslots, ring->slot_size);
+	return (0);
+}
+
+/* Publish ndata bytes from data as the next chunk of the ring */
+void shm_out_write(struct shm_out * so, char * data, size_t ndata) {
+	struct shm_ring * ring;
+	struct shm_slot * slot;
+	uint64_t seq;
+	ring = so->ring;
+	seq = ring->head;
+	slot = shm_ring_slot(ring, seq);
+	if (ndata > ring->slot_size)
+		ndata = ring->slot_size;
+
+	// Readers using the old chunk see that it is being overwritten
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((char *)(slot+1), data, ndata);
+	slot->len = ndata;
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, seq+1, __ATOMIC_RELEASE);
+	shm_out_wake(so);
+}
+
+/*
+ * Mark end of the stream and unmap the ring. The shared memory object is
+ * kept, so readers can read the rest of the stream.
+ */
+void shm_out_close(struct shm_out * so) {
+	__atomic_or_fetch(&so->ring->flags, SHM_RING_END, __ATOMIC_RELEASE);
+	shm_out_wake(so);
+	munmap(so->ring, so->size);
+	so->ring = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef SHMOUT_H
+#define	SHMOUT_H
+
+#include <stddef.h>
+#include "netstream.h"
+#include "shmring.h"
+
+// Shared memory output
+struct shm_out {
+	struct endpt_cfg * cfg; // Configuration of the output
+	struct shm_ring * ring; // Mapped ring
+	size_t size; 		// Size of the mapping
+};
+
+int shm_out_open(struct shm_out * so, struct endpt_cfg * cfg);
+void shm_out_write(struct shm_out * so, char * data, size_t ndata);
+void shm_out_close(struct shm_out * so);
+
+#endif
@@ -0,0 +1,157 @@
+#define	_GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmreader.h"
+
+/*
+ * Reader library for shared memory outputs of netstream. It does not depend
+ * on the rest of netstream, see shmring.h for the protocol.
+ */
+
+/*
+ * Map shared memory ring name read-only. The reader starts with the next
+ * written chunk (SHMR_NEWEST) or the oldest chunk in the ring (SHMR_OLDEST).
+ *
+ * Returns 0 on success, -1 on error (errno is set).
+ */
+int shm_reader_open(struct shm_reader * r, const char * name, int start) {
+	int fd;
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1)
+		return (-1);
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return (-1);
+	}
+	if (st.st_size < SHM_RING_HDR_SIZE) {
+		close(fd);
+		errno = EAGAIN;
+		return (-1);
+	}
+	r->size = st.st_size;
+	r->ring = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r->ring == MAP_FAILED)
+		return (-1);
+
+	struct shm_ring * ring;
+	ring = r->ring;
+	if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+		ring->version != SHM_RING_VERSION || ring->nslots == 0 ||
+		SHM_RING_HDR_SIZE+(size_t)ring->nslots*ring->stride > r->size) {
+
+		munmap(r->ring, r->size);
+		errno = EINVAL;
+		return (-1);
+	}
+	uint64_t head;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	r->cursor = head;
+	if (start == SHMR_OLDEST)
+		r->cursor = head > ring->nslots ? head-ring->nslots+1 : 1;
+	r->lost = 0;
+	return (0);
+}
+
+/*
+ * Wait for a change of futex word of the ring from value val at most
+ * timeout_ms milliseconds (-1 - forever).
+ */
+static void shm_reader_wait(struct shm_reader * r, uint32_t val,
+	int timeout_ms) {
+
+	struct timespec ts;
+	struct timespec * tsp;
+	tsp = NULL;
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms/1000;
+		ts.tv_nsec = (timeout_ms%1000)*1000000L;
+		tsp = &ts;
+	}
+	syscall(SYS_futex, &r->ring->futex, FUTEX_WAIT, val, tsp, NULL, 0);
+}
+
+/*
+ * Get the next chunk of the stream. Pointer to data in the ring is stored to
+ * data, data are valid until the writer reuses the slot, which can be checked
+ * by shm_reader_valid. If the reader is too slow, overwritten chunks are
+ * skipped and counted in lost. Waits at most timeout_ms milliseconds for a
+ * chunk (-1 - forever).
+ *
+ * Returns length of the chunk, SHMR_END at the end of the stream or
+ * SHMR_AGAIN after timeout.
+ */
+ssize_t shm_reader_next(struct shm_reader * r, const char ** data,
+	int timeout_ms) {
+
+	struct shm_ring * ring;
+	ring = r->ring;
+	int waited;
+	waited = 0;
+	while (1) {
+		uint32_t futex;
+		uint64_t head;
+		futex = __atomic_load_n(&ring->futex, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (r->cursor+ring->nslots <= head) {
+			// Slot was reused, continue in the middle of the ring
+			uint64_t next;
+			next = head-ring->nslots/2;
+			r->lost += next-r->cursor;
+			r->cursor = next;
+			continue;
+		}
+		if (r->cursor >= head) {
+			if (__atomic_load_n(&ring->flags, __ATOMIC_ACQUIRE) &
+				SHM_RING_END) {
+				return (SHMR_END);
+			}
+			if (waited)
+				return (SHMR_AGAIN);
+			shm_reader_wait(r, futex, timeout_ms);
+			waited = timeout_ms >= 0;
+			continue;
+		}
+
+		struct shm_slot * slot;
+		uint32_t len;
+		slot = shm_ring_slot(ring, r->cursor);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != r->cursor)
+			continue;
+		len = slot->len;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != r->cursor ||
+			len > ring->slot_size) {
+			continue;
+		}
+		*data = (const char *)(slot+1);
+		r->cursor++;
+		return (len);
+	}
+}
+
+/*
+ * Returns 1 if the chunk returned by the last shm_reader_next was not
+ * overwritten since, 0 otherwise.
+ */
+int shm_reader_valid(struct shm_reader * r) {
+	struct shm_slot * slot;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	slot = shm_ring_slot(r->ring, r->cursor-1);
+	return (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == r->cursor-1);
+}
+
+/* Unmap the ring of reader r */
+void shm_reader_close(struct shm_reader * r) {
+	munmap(r->ring, r->size);
+	r->ring = NULL;
+}
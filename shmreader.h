@@ -0,0 +1,30 @@
+#ifndef SHMREADER_H
+#define	SHMREADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "shmring.h"
+
+#define	SHMR_END -1 	// End of the stream
+#define	SHMR_AGAIN -2 	// No chunk until timeout
+#define	SHMR_ERR -3 	// Invalid ring
+
+#define	SHMR_NEWEST 0 	// Start with the next written chunk
+#define	SHMR_OLDEST 1 	// Start with the oldest chunk in the ring
+
+// Reader of a shared memory ring of netstream
+struct shm_reader {
+	struct shm_ring * ring; // Mapped ring (read-only)
+	size_t size; 		// Size of the mapping
+	uint64_t cursor; 	// Sequence number of the next chunk
+	uint64_t lost; 		// Number of chunks overwritten before reading
+};
+
+int shm_reader_open(struct shm_reader * r, const char * name, int start);
+ssize_t shm_reader_next(struct shm_reader * r, const char ** data,
+	int timeout_ms);
+int shm_reader_valid(struct shm_reader * r);
+void shm_reader_close(struct shm_reader * r);
+
+#endif
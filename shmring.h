@@ -0,0 +1,78 @@
+#ifndef SHMRING_H
+#define	SHMRING_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory ring of a shm output. The segment is a POSIX
+ * shared memory object created by netstream, readers map it read-only.
+ *
+ *	offset	size		content
+ *	0	64		struct shm_ring (header)
+ *	64	nslots*stride	slots, each struct shm_slot followed by data
+ *
+ * Every chunk of the stream gets a sequence number, starting with 1. Chunk
+ * with sequence number seq is stored in slot seq%nslots. Writer publishes a
+ * chunk this way:
+ *
+ *	1. slot seq is set to 0 (slot is being written)
+ *	2. data and len are written
+ *	3. slot seq is set to the sequence number of the chunk (release)
+ *	4. head is set to the sequence number + 1 (release)
+ *	5. futex is incremented and all waiters are woken (FUTEX_WAKE)
+ *
+ * The writer never waits for readers. Each reader keeps its own cursor (the
+ * sequence number of the next chunk it wants). Chunks head-nslots+1 to head-1
+ * are available. If the cursor falls behind head-nslots+1, chunks were lost.
+ * A reader can use data in place and then check that slot seq still equals
+ * the sequence number of the chunk (the chunk was not overwritten meanwhile).
+ * Idle reader waits by FUTEX_WAIT on futex with the value read before it
+ * checked head.
+ *
+ * When the stream ends, SHM_RING_END is set in flags. All fields are in host
+ * byte order.
+ */
+
+#define	SHM_RING_MAGIC 0x4d48534e 	// "NSHM"
+#define	SHM_RING_VERSION 1
+#define	SHM_RING_HDR_SIZE 64 		// Size of the header, slots follow
+#define	SHM_RING_ALIGN 64 		// Alignment of slots
+#define	SHM_RING_SLOTS 1024 		// Default number of slots
+
+#define	SHM_RING_END 0x1 		// Flag: the stream has ended
+
+// Header of the ring
+struct shm_ring {
+	uint32_t magic; 	// SHM_RING_MAGIC
+	uint32_t version; 	// SHM_RING_VERSION
+	uint32_t nslots; 	// Number of slots
+	uint32_t slot_size; 	// Maximal length of data in a slot
+	uint32_t stride; 	// Distance between slots in bytes
+	uint32_t flags; 	// SHM_RING_* flags
+	uint32_t futex; 	// Incremented after each published chunk
+	uint32_t reserved;
+	uint64_t head; 		// Sequence number of the next written chunk
+};
+
+// Header of a slot, data follow
+struct shm_slot {
+	uint64_t seq; 		// Sequence number of the chunk (0 - being written)
+	uint32_t len; 		// Length of data
+	uint32_t reserved;
+};
+
+/* Returns distance between slots for slots with slot_size bytes of data */
+static inline uint32_t shm_ring_stride(uint32_t slot_size) {
+	return ((sizeof (struct shm_slot)+slot_size+SHM_RING_ALIGN-1)/
+		SHM_RING_ALIGN*SHM_RING_ALIGN);
+}
+
+/* Returns pointer to the slot of chunk seq in ring */
+static inline struct shm_slot * shm_ring_slot(struct shm_ring * ring,
+	uint64_t seq) {
+
+	return ((struct shm_slot *)((char *)ring+SHM_RING_HDR_SIZE+
+		(seq%ring->nslots)*ring->stride));
+}
+
+#endif
@@ -0,0 +1,146 @@
+#define	_GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "netstream.h"
+#include "spill.h"
+
+/* Returns size of a record with ndata bytes of data */
+static size_t spill_rec_size(ssize_t ndata) {
+	if (ndata < 0)
+		ndata = 0;
+	return (SPILL_HDR+(ndata+SPILL_ALIGN-1)/SPILL_ALIGN*SPILL_ALIGN);
+}
+
+/*
+ * Create spill file name of size bytes. The space is allocated at once, so
+ * a full disk is found now and not when the mapping is written.
+ *
+ * Returns the spill or NULL on error.
+ */
+struct spill * spill_open(char * name, size_t size) {
+	struct spill * sp;
+	sp = calloc(1, sizeof (struct spill));
+	if (sp == NULL) {
+		dprint(WARN, "Can't allocate memory for spill file\n");
+		return (NULL);
+	}
+	int fd;
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		warn("Can't open spill file %s", name);
+		free(sp);
+		return (NULL);
+	}
+	int res;
+	res = posix_fallocate(fd, 0, size);
+	if (res != 0) {
+		dprint(ERR, "Can't allocate spill file %s: %s\n", name,
+			strerror(res));
+		close(fd);
+		free(sp);
+		return (NULL);
+	}
+	sp->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sp->map == MAP_FAILED) {
+		warn("Can't map spill file %s", name);
+		free(sp);
+		return (NULL);
+	}
+	madvise(sp->map, size, MADV_SEQUENTIAL);
+	sp->name = name;
+	sp->size = size;
+	return (sp);
+}
+
+/*
+ * Append a record with ndata bytes from data and its meta. If ndata < 0, only
+ * the header is written.
+ *
+ * Returns 0 on success, -1 if the file is full.
+ */
+int spill_append(struct spill * sp, char * data, ssize_t ndata,
+	struct chunk_meta * meta) {
+
+	size_t rec;
+	size_t off;
+	rec = spill_rec_size(ndata);
+	if (sp->used == 0) {
+		sp->head = 0;
+		sp->tail = 0;
+		sp->next = 0;
+	}
+	if (sp->head > sp->tail || sp->used == 0) {
+		// Free space is at the end and at the start
+		if (sp->size-sp->head >= rec) {
+			off = sp->head;
+		} else if (sp->tail >= rec) {
+			if (sp->size-sp->head >= SPILL_HDR)
+				*(int64_t *)(sp->map+sp->head) = SPILL_WRAP;
+			sp->used += sp->size-sp->head;
+			off = 0;
+		} else  {
+			return (-1);
+		}
+	} else if (sp->tail-sp->head >= rec) {
+		off = sp->head;
+	} else  {
+		return (-1);
+	}
+	int64_t * hdr;
+	hdr = (int64_t *)(sp->map+off);
+	hdr[0] = ndata;
+	hdr[1] = meta->seq;
+	hdr[2] = meta->stamp;
+	if (ndata > 0)
+		memcpy(sp->map+off+SPILL_HDR, data, ndata);
+	sp->head = off+rec;
+	sp->used += rec;
+	if (ndata > 0)
+		sp->nbytes += ndata;
+	sp->pending++;
+	return (0);
+}
+
+/*
+ * Take the next record, data points to its data in the mapping and its meta
+ * is stored to meta. The record stays valid until spill_release is called.
+ *
+ * Returns length of data of the record (negative for markers).
+ */
+ssize_t spill_take(struct spill * sp, char ** data, struct chunk_meta * meta) {
+	sp->held = 0;
+	if (sp->size-sp->next < SPILL_HDR ||
+		*(int64_t *)(sp->map+sp->next) == SPILL_WRAP) {
+
+		sp->held = sp->size-sp->next;
+		sp->next = 0;
+	}
+	int64_t * hdr;
+	int64_t ndata;
+	hdr = (int64_t *)(sp->map+sp->next);
+	ndata = hdr[0];
+	meta->seq = hdr[1];
+	meta->stamp = hdr[2];
+	*data = sp->map+sp->next+SPILL_HDR;
+	sp->held += spill_rec_size(ndata);
+	sp->next += spill_rec_size(ndata);
+	if (ndata > 0)
+		sp->nbytes -= ndata;
+	sp->pending--;
+	return (ndata);
+}
+
+/* Free the space of the record taken last */
+void spill_release(struct spill * sp) {
+	sp->used -= sp->held;
+	sp->tail = sp->next;
+	sp->held = 0;
+}
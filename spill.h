@@ -0,0 +1,42 @@
+#ifndef SPILL_H
+#define	SPILL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "netstream.h"
+
+#define	SPILL_SIZE (64*1024*1024) 	// Default size of a spill file
+#define	SPILL_MIN_SIZE (1024*1024) 	// Minimal size of a spill file
+#define	SPILL_HDR 24 			// Size of record header
+#define	SPILL_ALIGN 8 			// Alignment of records
+#define	SPILL_WRAP INT64_MIN 		// Record length: continue at offset 0
+
+/*
+ * Spill file of an output. It is a circular log of records in a memory mapped
+ * file, each record is a header with length of data (int64_t, negative for
+ * end of stream markers), sequence number and timestamp followed by data
+ * padded to SPILL_ALIGN bytes. Records
+ * are appended at head and consumed from next, space up to tail is freed when
+ * the consumer releases the record. When the file is empty, head returns to
+ * the start, so the file is written sequentially.
+ */
+struct spill {
+	char * name; 		// Path of the file
+	char * map; 		// Mapped file
+	size_t size; 		// Size of the file
+	size_t head; 		// Offset of the next appended record
+	size_t tail; 		// Offset of the oldest record not released
+	size_t next; 		// Offset of the next record to consume
+	size_t used; 		// Bytes between tail and head
+	size_t held; 		// Bytes of the record being consumed
+	size_t nbytes; 		// Data bytes waiting in the file
+	int pending; 		// Records waiting in the file
+};
+
+struct spill * spill_open(char * name, size_t size);
+int spill_append(struct spill * sp, char * data, ssize_t ndata,
+	struct chunk_meta * meta);
+ssize_t spill_take(struct spill * sp, char ** data, struct chunk_meta * meta);
+void spill_release(struct spill * sp);
+
+#endif
@@ -0,0 +1,138 @@
+#!/bin/sh
+#
+# Failure-recovery benchmark, needs netstream built by `make FAULTS=1`.
+#
+# A feeder replays fb.in at a fixed bitrate over TCP to a relay, which sends it
+# over TCP to receivers writing files. Faults are injected into the relay by
+# NETSTREAM_FAULTS (see fault.h), all endpoints retry. For each scenario the
+# failures, the time to recover (from the statistics of the relay) and the
+# bytes lost (missing in the files of the receivers) are printed.
+#
+# Usage: ./fault_bench.sh [retry_delay_ms [outputs]]
+
+DELAY=${1:-1000}	# RetryDelay of all endpoints in ms
+MANY=${2:-8}		# Outputs failing at once in the last scenario
+PORT=3100		# Port of the relay, receivers use the following ones
+SIZE=1048576		# Size of the stream
+RATE=4M			# Bitrate of the stream
+TIME=5			# Duration of a scenario in seconds
+
+if ! grep -q NETSTREAM_FAULTS ../netstream
+then
+	echo "netstream is not built with FAULTS=1"
+	exit 1
+fi
+
+head -c $SIZE /dev/urandom > fb.in
+
+# Write configs of the feeder, the relay and receivers for n outputs
+write_configs () {
+	cat > fb.feed.conf <<EOF
+-
+ Direction: input
+ Type: file
+ Name: fb.in
+ Mmap: yes
+ Bitrate: $RATE
+-
+ Direction: output
+ Type: socket
+ Name: localhost
+ Port: $PORT
+ Protocol: TCP
+ Retry: yes
+ RetryDelay: $DELAY
+EOF
+	cat > fb.relay.conf <<EOF
+-
+ Direction: input
+ Type: socket
+ Name: localhost
+ Port: $PORT
+ Protocol: TCP
+ Retry: yes
+ RetryDelay: $DELAY
+EOF
+	for i in `seq $1`
+	do
+		cat >> fb.relay.conf <<EOF
+-
+ Direction: output
+ Type: socket
+ Name: localhost
+ Port: $(($PORT+$i))
+ Protocol: TCP
+ Retry: yes
+ RetryDelay: $DELAY
+EOF
+		cat > fb.recv$i.conf <<EOF
+-
+ Direction: input
+ Type: socket
+ Name: localhost
+ Port: $(($PORT+$i))
+ Protocol: TCP
+ Retry: yes
+ RetryDelay: $DELAY
+-
+ Direction: output
+ Type: file
+ Name: fb.$i.out
+EOF
+	done
+}
+
+# Run scenario $1 with faults $2 injected into the relay with $3 outputs
+run_scenario () {
+	write_configs $3
+	PIDS=""
+	for i in `seq $3`
+	do
+		rm -f fb.$i.out
+		../netstream -c fb.recv$i.conf > /dev/null 2>&1 &
+		PIDS="$PIDS $!"
+	done
+	NETSTREAM_FAULTS=$2 ../netstream -c fb.relay.conf 2> fb.log &
+	RELAY=$!
+	sleep 1
+	../netstream -c fb.feed.conf > /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+	sleep $TIME
+	kill -USR1 $RELAY
+	sleep 1
+	kill $RELAY $PIDS > /dev/null 2>&1
+	wait
+	sleep 1
+	LOST=0
+	for i in `seq $3`
+	do
+		LOST=$(($LOST+$SIZE-`stat -c %s fb.$i.out`))
+	done
+	awk -v name="$1" -v lost=$LOST '
+		# The end of the feed is the last failure of the input
+		/failures/ {
+			gsub(",", "")
+			fail += ($1 == "input" ? $4-1 : $4)
+			rec += $6; sum += $6*$9
+			if ($12 > max)
+				max = $12
+		}
+		END {
+			printf "%-22s %8d %9d %10.1f %10.1f %10d\n", name, fail,
+				rec, (rec > 0 ? sum/rec : 0), max, lost
+		}' fb.log
+	# Ports of closed connections stay in TIME_WAIT
+	PORT=$(($PORT+$3+1))
+}
+
+printf "%-22s %8s %9s %10s %10s %10s\n" "scenario" "failures" \
+	"recovered" "avg ms" "max ms" "bytes lost"
+run_scenario "write error" "write@out0:200" 1
+run_scenario "read error" "read@in0:200" 1
+run_scenario "end of stream" "eof@in0:200" 1
+run_scenario "stalled write" "stall@out0:200x2" 1
+run_scenario "connect refused x3" "write@out0:200,connect@out0:2x3" 1
+run_scenario "resolver failure x3" "write@out0:200,resolve@out0:2x3" 1
+run_scenario "$MANY outputs fail" "write@out:200" $MANY
+
+rm -f fb.in fb.*.out fb.*.conf fb.log
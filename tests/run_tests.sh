@@ -177,6 +177,437 @@ else
 	FAIL=1
 fi
 
+# Test 9 - multicast over loopback
+rm -f 9.out
+run_test 9 "file -> multicast UDP -> file" b
+sleep 1
+../netstream -c 9.send.conf > /dev/null 2>&1
+sleep 1
+check_result "b" 9
+print_result
+qkill $NSPID
+
+# Test 10 - kernel TLS over loopback with a self-signed certificate
+echo -n "Running test 10 (file -> TLS TCP -> file)... "
+openssl req -x509 -newkey rsa:2048 -nodes -keyout tls.key -out tls.crt \
+	-days 1 -subj /CN=localhost -addext "subjectAltName=IP:127.0.0.1" \
+	> /dev/null 2>&1
+if ! ../netstream -c 10.conf -t > /dev/null 2>&1
+then
+	echo "skipped (built without TLS)"
+elif [ ! -d /sys/module/tls ]
+then
+	echo "skipped (no kernel TLS)"
+else
+	rm -f 10.out
+	../netstream -c 10.conf > /dev/null 2>&1 &
+	NSPID=$!
+	sleep 1
+	../netstream -c 10.send.conf > /dev/null 2>&1
+	sleep 1
+	check_result "a" 10
+	print_result
+	qkill $NSPID
+fi
+rm -f tls.key tls.crt
+
+# Test 11 - recording with rotation
+rm -f 11.*.seg 11.out
+run_test 11 "file -> rotated recording"
+print_result q
+cat 11.0.seg 11.1.seg > 11.out
+check_result "a" 11
+print_result
+rm -f 11.*.seg
+
+# Test 12 - paced replay of a mapped file
+rm -f 12.out
+run_test 12 "mapped file at 128 kbit/s -> file"
+print_result q
+check_result "b" 12
+print_result
+
+# Test 13 - Unix domain seqpacket socket
+rm -f 13.out
+run_test 13 "file -> unix seqpacket -> file" b
+sleep 1
+../netstream -c 13.send.conf > /dev/null 2>&1
+sleep 1
+check_result "b" 13
+print_result
+qkill $NSPID
+
+# Test 14 - named pipe
+rm -f 14.out 14.fifo
+run_test 14 "file -> fifo -> file" b
+sleep 1
+../netstream -c 14.send.conf > /dev/null 2>&1
+sleep 1
+check_result "b" 14
+print_result
+qkill $NSPID
+rm -f 14.fifo
+
+# Test 15 - shared memory ring read by the test consumer
+rm -f 15.out /dev/shm/netstream-test-15
+run_test 15 "file -> shared memory"
+print_result q
+./shm_consumer -o /netstream-test-15 > 15.out 2> /dev/null
+check_result "b" 15
+print_result
+rm -f /dev/shm/netstream-test-15
+
+# Test 16 - outputs expanded from a template
+rm -f 16.*.out
+run_test 16 "file -> files from a profile"
+print_result q
+SUM=0
+for i in 1 2 3
+do
+	check_result "a" "16.$i"
+	SUM=$(($SUM+$RES))
+done
+RES=$SUM
+print_result
+rm -f 16.*.out
+
+# Test 17 - primary and standby input with the same content
+rm -f 17.out
+run_test 17 "file + standby file -> file"
+print_result q
+check_result "a" 17
+print_result
+
+# Test 18 - output connects late, data wait in a spill file
+rm -f 18.in 18.out 18.spill
+for i in `seq 300`
+do
+	cat a.in b.in >> 18.in
+done
+run_test 18 "file -> TCP connected late through a spill file" b
+sleep 2
+nc -lp 3004 > 18.out & > /dev/null 2>&1
+NCPID=$!
+sleep 3
+check_result 18 18
+print_result
+qkill $NCPID
+qkill $NSPID
+rm -f 18.in 18.spill
+
+# Test 19 - framed stream with sequence numbers and checksums
+rm -f 19.in 19.out
+for i in `seq 10`
+do
+	cat a.in b.in >> 19.in
+done
+run_test 19 "file -> framed TCP -> file" b
+sleep 1
+../netstream -c 19.send.conf > /dev/null 2>&1
+sleep 1
+check_result 19 19
+print_result
+qkill $NSPID
+rm -f 19.in
+
+# Test 20 - framed UDP with row and column FEC
+rm -f 20.in 20.out
+for i in `seq 5`
+do
+	cat a.in b.in >> 20.in
+done
+run_test 20 "file -> framed UDP with FEC -> file" b
+sleep 1
+../netstream -c 20.send.conf > /dev/null 2>&1
+sleep 1
+check_result 20 20
+print_result
+qkill $NSPID
+
+# Test 20b - datagrams dropped by injected faults are reconstructed, one in
+# each row of the first matrix after its first row (frames are waited for
+# only when FEC frames have been seen) and two in a row of the second one,
+# each alone in its column
+echo -n "Running test 20b (file -> lossy framed UDP with FEC -> file)... "
+if ! grep -q NETSTREAM_FAULTS ../netstream
+then
+	echo "skipped (built without FAULTS=1)"
+else
+	rm -f 20.out
+	../netstream -c 20.conf > /dev/null 2> 20b.log &
+	NSPID=$!
+	sleep 1
+	LOSS=write@out0:7,write@out0:13,write@out0:19
+	LOSS=$LOSS,write@out0:22,write@out0:24
+	NETSTREAM_FAULTS=$LOSS ../netstream -c 20.send.conf > /dev/null 2>&1
+	sleep 1
+	kill -USR1 $NSPID
+	sleep 1
+	check_result 20 20
+	if ! grep -q "recovered 5" 20b.log
+	then
+		RES=1
+	fi
+	print_result
+	qkill $NSPID
+fi
+rm -f 20.in 20b.log
+
+# Test 21 - TCP output with zero copy sending
+rm -f 21.in 21.out
+for i in `seq 10`
+do
+	cat a.in b.in >> 21.in
+done
+run_test 21 "file -> TCP with zero copy -> file" b
+sleep 1
+../netstream -c 21.send.conf > /dev/null 2>&1
+sleep 1
+check_result 21 21
+print_result
+qkill $NSPID
+rm -f 21.in
+
+# Test 22 - relay handed over to a new process during the stream
+rm -f 22.in 22.out 22.sock
+for i in `seq 10`
+do
+	cat a.in b.in >> 22.in
+done
+run_test 22 "file -> TCP relay upgraded during the stream -> file" b
+sleep 1
+../netstream -u 22.sock -c 22.relay.conf > /dev/null 2>&1 &
+sleep 1
+../netstream -c 22.send.conf > /dev/null 2>&1 &
+SENDPID=$!
+sleep 1
+../netstream -u 22.sock -c 22.relay.conf > /dev/null 2>&1 &
+wait $SENDPID
+sleep 1
+check_result 22 22
+print_result
+qkill $NSPID
+rm -f 22.in 22.sock
+
+# Test 23 - output woken for batches of data
+rm -f 23.in 23.out
+for i in `seq 10`
+do
+	cat a.in b.in >> 23.in
+done
+run_test 23 "file -> file woken by batches"
+print_result q
+check_result 23 23
+print_result
+rm -f 23.in
+
+# Test 24 - probe of neighbours, one of them is unreachable
+rm -f 24.json
+run_test 24 "probe of neighbours with a burst" b
+sleep 1
+../netstream -t -c 24.probe.conf > 24.json 2>/dev/null
+if [ $? -eq 1 ] &&
+	grep -q '"index": 0, .*"ok": true, .*"overflow": false' 24.json &&
+	grep -q '"index": 1, .*"ok": false' 24.json
+then
+	RES=0
+else
+	RES=1
+fi
+print_result
+qkill $NSPID
+rm -f 24.json
+
+# Test 25 - buffer sized by time under a memory limit
+rm -f 25.in 25.out
+for i in `seq 40`
+do
+	cat a.in b.in >> 25.in
+done
+echo -n "Running test 25 (mapped file -> file with a 2 s buffer in 1 MiB)... "
+../netstream -m 1M -c 25.conf > /dev/null 2>&1
+RES=$?
+print_result q
+check_result 25 25
+print_result
+rm -f 25.in
+
+# Test 26 - outputs of different priority under an egress limit
+rm -f 26.in 26.out 26.low.out
+for i in `seq 10`
+do
+	cat a.in b.in >> 26.in
+done
+echo -n "Running test 26 (mapped file -> high and low priority files)... "
+../netstream -e 8M -c 26.conf > /dev/null 2>&1
+RES=$?
+print_result q
+check_result 26 26
+print_result
+rm -f 26.in 26.low.out
+
+# Test 27 - UDP output repacketized to datagrams of 500 B
+rm -f 27.in 27.out
+for i in `seq 5`
+do
+	cat a.in b.in >> 27.in
+done
+run_test 27 "file -> UDP in datagrams of 500 B -> file" b
+sleep 1
+../netstream -c 27.send.conf > /dev/null 2>&1
+sleep 1
+check_result 27 27
+print_result
+qkill $NSPID
+rm -f 27.in
+
+# Test 28 - payload of an UDP and a TCP flow replayed from captures
+rm -f 28.out 28.tcp.out
+run_test 28 "UDP flow of pcap -> file, TCP flow of pcapng -> file"
+print_result q
+diff a.in 28.out > /dev/null
+RES=$?
+print_result q
+../netstream -c 28.tcp.conf > /dev/null 2>&1
+RES=$?
+print_result q
+diff b.in 28.tcp.out > /dev/null
+RES=$?
+print_result
+rm -f 28.out 28.tcp.out
+
+# Test 29 - costs of stages measured and printed at exit
+rm -f 29.out
+echo -n "Running test 29 (file -> file with costs of stages)... "
+../netstream -p -c 29.conf 2> 29.log > /dev/null
+RES=$?
+print_result q
+diff b.in 29.out > /dev/null
+RES=$?
+print_result q
+grep -q "read runs" 29.log && grep -q "write runs" 29.log
+RES=$?
+print_result
+rm -f 29.out 29.log
+
+# Test 30 - framed UDP with retransmission of lost frames
+rm -f 30.in 30.out
+for i in `seq 5`
+do
+	cat a.in b.in >> 30.in
+done
+run_test 30 "file -> framed UDP with ARQ -> file" b
+sleep 1
+../netstream -c 30.send.conf > /dev/null 2>&1
+sleep 1
+check_result 30 30
+print_result
+qkill $NSPID
+
+# Test 30b - datagrams dropped by injected faults are asked for and sent again
+echo -n "Running test 30b (file -> lossy framed UDP with ARQ -> file)... "
+if ! grep -q NETSTREAM_FAULTS ../netstream
+then
+	echo "skipped (built without FAULTS=1)"
+else
+	rm -f 30.out
+	../netstream -c 30.conf > /dev/null 2> 30b.log &
+	NSPID=$!
+	sleep 1
+	NETSTREAM_FAULTS=write@out0:5x3,write@out0:30 \
+		../netstream -c 30.send.conf -p > /dev/null 2> 30b.send.log
+	sleep 1
+	kill -USR1 $NSPID
+	sleep 1
+	check_result 30 30
+	if ! grep -q "received again [1-9]" 30b.log ||
+		! grep -q "frames sent again [1-9]" 30b.send.log
+	then
+		RES=1
+	fi
+	print_result
+	qkill $NSPID
+fi
+rm -f 30.in 30b.log 30b.send.log
+
+# Test 31 - failover to a standby input ahead by more than a half of backlog
+rm -f 31.in 31.out 31.a.fifo 31.b.fifo
+head -c 409600 /dev/urandom > 31.in
+mkfifo 31.a.fifo 31.b.fifo
+# Pipes are opened for reading and writing, so that netstream doesn't see
+# the end before data are written, and are not passed to netstream
+exec 3<> 31.a.fifo 4<> 31.b.fifo
+echo -n "Running test 31 (fifo + standby fifo ahead -> file)... "
+../netstream -c 31.conf 3>&- 4>&- > /dev/null 2>&1 &
+NSPID=$!
+sleep 1
+# Data are written in blocks of 25 KiB, so that the ring doesn't overflow
+for i in 0 1 2 3 4 5 6 7 8 9
+do
+	dd if=31.in bs=25600 skip=$i count=1 >&3 2> /dev/null
+	sleep 0.1
+done
+sleep 1
+# The backlog of the standby input overflows
+dd if=31.in bs=25600 count=12 >&4 2> /dev/null
+sleep 1
+exec 3>&-
+sleep 1
+for i in 12 13 14 15
+do
+	dd if=31.in bs=25600 skip=$i count=1 >&4 2> /dev/null
+	sleep 0.1
+done
+sleep 1
+exec 4>&-
+sleep 1
+check_result 31 31
+print_result
+qkill $NSPID
+rm -f 31.in 31.out 31.a.fifo 31.b.fifo
+
+# Test 32 - TCP output dropping data for a receiver which stops reading
+rm -f 32.in 32.out 32.log
+for i in `seq 150`
+do
+	cat a.in b.in >> 32.in
+done
+echo -n "Running test 32 (file -> TCP with MaxUnsent to a stopped reader)... "
+# Options of the TCP socket pass the check of the configuration
+nc -lp 3010 > /dev/null 2>&1 &
+NCPID=$!
+sleep 1
+../netstream -c 32.send.conf -t > /dev/null 2>&1
+RES=$?
+qkill $NCPID
+if [ $RES -eq 0 ]
+then
+	../netstream -c 32.conf > /dev/null 2>&1 &
+	NSPID=$!
+	sleep 1
+	../netstream -c 32.send.conf -v > /dev/null 2> 32.log &
+	SENDPID=$!
+	sleep 1
+	# The receiver stops reading for a while
+	kill -STOP $NSPID
+	sleep 1
+	kill -CONT $NSPID
+	wait $SENDPID
+	sleep 1
+	# Data are dropped, but the stream goes on to its end
+	tail -c 10240 32.in > 32.tail.in
+	tail -c 10240 32.out > 32.tail.out
+	check_result 32.tail 32.tail
+	if ! grep -q "dropping data" 32.log ||
+		! grep -q "chunks dropped" 32.log
+	then
+		RES=1
+	fi
+	qkill $NSPID
+fi
+print_result
+rm -f 32.in 32.log 32.tail.in 32.tail.out
+
 if [ $FAIL -eq 0 ]
 then
 	echo "All tests successfully passed"
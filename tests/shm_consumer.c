@@ -0,0 +1,59 @@
+/*
+ * Test consumer of a netstream shared memory output. Copies the stream from
+ * the ring to standard output until the stream ends.
+ *
+ * Usage: shm_consumer [-o] name
+ *	-o	start with the oldest chunk in the ring
+ */
+#define	_XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shmreader.h"
+
+int main(int argc, char ** argv) {
+	int start;
+	int opt;
+	start = SHMR_NEWEST;
+	while ((opt = getopt(argc, argv, "o")) != -1) {
+		switch (opt) {
+			case 'o':
+				start = SHMR_OLDEST;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-o] name\n", argv[0]);
+				return (2);
+		}
+	}
+	if (optind != argc-1) {
+		fprintf(stderr, "Usage: %s [-o] name\n", argv[0]);
+		return (2);
+	}
+
+	struct shm_reader r;
+	if (shm_reader_open(&r, argv[optind], start) == -1) {
+		perror("shm_reader_open");
+		return (1);
+	}
+	while (1) {
+		const char * data;
+		ssize_t len;
+		len = shm_reader_next(&r, &data, -1);
+		if (len == SHMR_END)
+			break;
+		if (len < 0)
+			continue;
+		if (fwrite(data, 1, len, stdout) != len) {
+			perror("fwrite");
+			return (1);
+		}
+		if (!shm_reader_valid(&r))
+			fprintf(stderr, "Chunk overwritten while it was read\n");
+	}
+	if (r.lost > 0)
+		fprintf(stderr, "%llu chunks lost\n", (unsigned long long)r.lost);
+	shm_reader_close(&r);
+	return (0);
+}
@@ -0,0 +1,308 @@
+/*
+ * Benchmark of sending a stream over TCP with copying and with MSG_ZEROCOPY
+ * for various chunk sizes. Chunks are sent from a ring of 128 slots like the
+ * buffer of a netstream output, with zero copy at most 64 chunks wait for
+ * completion. Throughput and CPU time of the sender are printed, so the chunk
+ * size from which zero copy pays off can be found.
+ *
+ * Without host and port a sink is started on loopback. Note that the kernel
+ * always copies data sent over loopback, so zero copy only adds overhead
+ * there; use a sink on another machine (e.g. `nc -l port >/dev/null`).
+ *
+ * Usage: zc_bench [-s seconds] [host port]
+ */
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define	SO_ZEROCOPY 60
+#endif
+
+#define	RING_SLOTS 128
+#define	MAX_HELD 64
+#define	MIN_CHUNK 1024
+#define	MAX_CHUNK (256*1024)
+
+// Result of one run
+struct result {
+	double bytes; 		// Bytes sent
+	double secs; 		// Wall time
+	double cpu; 		// CPU time of the sender
+	unsigned long sends; 	// Zero copy sends
+	unsigned long copied; 	// Zero copy sends copied by the kernel
+};
+
+/* Returns current time of clock in seconds */
+static double now(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (ts.tv_sec+ts.tv_nsec/1e9);
+}
+
+/* Returns CPU time used by this process in seconds */
+static double cpu_time(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6+
+		ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6);
+}
+
+/*
+ * Start a sink reading and discarding data on a loopback port, which is
+ * stored to port.
+ *
+ * Returns pid of the sink or -1 on error.
+ */
+static pid_t start_sink(char * port, size_t nport) {
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	int lfd;
+	pid_t pid;
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd == -1)
+		return (-1);
+	memset(&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addrlen = sizeof (addr);
+	if (bind(lfd, (struct sockaddr *)&addr, addrlen) == -1 ||
+		listen(lfd, 16) == -1 ||
+		getsockname(lfd, (struct sockaddr *)&addr, &addrlen) == -1) {
+
+		close(lfd);
+		return (-1);
+	}
+	snprintf(port, nport, "%d", ntohs(addr.sin_port));
+	pid = fork();
+	if (pid != 0) {
+		close(lfd);
+		return (pid);
+	}
+	while (1) {
+		static char data[MAX_CHUNK];
+		int fd;
+		fd = accept(lfd, NULL, NULL);
+		if (fd == -1)
+			_exit(1);
+		while (read(fd, data, sizeof (data)) > 0)
+			;
+		close(fd);
+	}
+}
+
+/* Returns socket connected to host and port or -1 on error */
+static int connect_to(char * host, char * port) {
+	struct addrinfo hints;
+	struct addrinfo * res;
+	int fd;
+	memset(&hints, 0, sizeof (hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return (-1);
+	fd = socket(res->ai_family, SOCK_STREAM, 0);
+	if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) == -1) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return (fd);
+}
+
+/*
+ * Read completions from the error queue of fd. The last completed send is
+ * stored to done and the number of copied sends is added to r.
+ *
+ * Returns 1 if anything was read, 0 otherwise.
+ */
+static int read_completions(int fd, uint32_t * done, struct result * r) {
+	int any;
+	any = 0;
+	while (1) {
+		char control[128];
+		struct msghdr msg;
+		struct cmsghdr * cmsg;
+		memset(&msg, 0, sizeof (msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return (any);
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+			struct sock_extended_err * serr;
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_errno != 0 ||
+				serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				r->copied += serr->ee_data-serr->ee_info+1;
+			*done = serr->ee_data+1;
+			any = 1;
+		}
+	}
+}
+
+/*
+ * Send chunks of size bytes from ring to host and port for secs seconds,
+ * with MSG_ZEROCOPY if zc is set. The result is stored to r.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int run(char * host, char * port, char * ring, size_t size, int zc,
+	double secs, struct result * r) {
+
+	int fd;
+	int optval;
+	uint32_t sent;
+	uint32_t done;
+	int slot;
+	double start;
+	double cpu;
+	memset(r, 0, sizeof (*r));
+	fd = connect_to(host, port);
+	if (fd == -1)
+		return (-1);
+	optval = 1;
+	if (zc && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval,
+		sizeof (optval)) == -1) {
+
+		close(fd);
+		return (-1);
+	}
+	sent = 0;
+	done = 0;
+	slot = 0;
+	start = now(CLOCK_MONOTONIC);
+	cpu = cpu_time();
+	while (now(CLOCK_MONOTONIC)-start < secs) {
+		char * data;
+		size_t left;
+		// The slot is written again by the input only when completed
+		while (zc && sent-done >= MAX_HELD) {
+			struct pollfd pfd;
+			if (read_completions(fd, &done, r))
+				continue;
+			pfd.fd = fd;
+			pfd.events = 0;
+			poll(&pfd, 1, 100);
+		}
+		data = ring+slot*size;
+		data[0]++;
+		slot = (slot+1)%RING_SLOTS;
+		left = size;
+		while (left > 0) {
+			ssize_t res;
+			res = send(fd, data, left, zc ? MSG_ZEROCOPY : 0);
+			if (res == -1 && errno == ENOBUFS)
+				res = send(fd, data, left, 0);
+			else if (res >= 0 && zc)
+				sent++;
+			if (res == -1) {
+				close(fd);
+				return (-1);
+			}
+			data += res;
+			left -= res;
+		}
+		r->bytes += size;
+		if (zc)
+			read_completions(fd, &done, r);
+	}
+	while (zc && done != sent) {
+		struct pollfd pfd;
+		if (read_completions(fd, &done, r))
+			continue;
+		pfd.fd = fd;
+		pfd.events = 0;
+		poll(&pfd, 1, 100);
+	}
+	r->secs = now(CLOCK_MONOTONIC)-start;
+	r->cpu = cpu_time()-cpu;
+	r->sends = sent;
+	close(fd);
+	return (0);
+}
+
+int main(int argc, char ** argv) {
+	char portbuf[16];
+	char * host;
+	char * port;
+	char * ring;
+	double secs;
+	pid_t sink;
+	int opt;
+	secs = 1;
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+			case 's':
+				secs = atof(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-s seconds] "
+					"[host port]\n", argv[0]);
+				return (2);
+		}
+	}
+	sink = -1;
+	if (optind == argc) {
+		host = "127.0.0.1";
+		sink = start_sink(portbuf, sizeof (portbuf));
+		if (sink == -1) {
+			perror("sink");
+			return (1);
+		}
+		port = portbuf;
+	} else if (optind == argc-2) {
+		host = argv[optind];
+		port = argv[optind+1];
+	} else  {
+		fprintf(stderr, "Usage: %s [-s seconds] [host port]\n",
+			argv[0]);
+		return (2);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	ring = calloc(RING_SLOTS, MAX_CHUNK);
+	if (ring == NULL) {
+		perror("calloc");
+		return (1);
+	}
+
+	printf("%8s %10s %10s %10s %10s %8s\n", "chunk", "copy MB/s",
+		"zc MB/s", "copy s/GB", "zc s/GB", "copied");
+	for (size_t size = MIN_CHUNK; size <= MAX_CHUNK; size *= 2) {
+		struct result copy;
+		struct result zc;
+		if (run(host, port, ring, size, 0, secs, &copy) == -1 ||
+			run(host, port, ring, size, 1, secs, &zc) == -1) {
+
+			perror("run");
+			break;
+		}
+		printf("%8zu %10.1f %10.1f %10.3f %10.3f %7.0f%%\n", size,
+			copy.bytes/copy.secs/1e6,
+			zc.bytes/zc.secs/1e6,
+			copy.cpu/(copy.bytes/1e9),
+			zc.cpu/(zc.bytes/1e9),
+			zc.sends > 0 ? 100.0*zc.copied/zc.sends : 0.0);
+	}
+	free(ring);
+	if (sink != -1) {
+		kill(sink, SIGTERM);
+		waitpid(sink, NULL, 0);
+	}
+	return (0);
+}
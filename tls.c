@@ -0,0 +1,197 @@
+#define	_XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#ifdef HAVE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#endif
+
+#include "netstream.h"
+#include "tls.h"
+
+/* Returns 1 if netstream was compiled with TLS support, 0 otherwise */
+int tls_supported(void) {
+#ifdef HAVE_TLS
+	return (1);
+#else
+	return (0);
+#endif
+}
+
+#ifdef HAVE_TLS
+
+/*
+ * Ciphers for TLS 1.2 which can be offloaded to the kernel. TLS 1.3 suites
+ * are all supported by the kernel.
+ */
+#define	TLS_KTLS_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:" \
+	"ECDHE-RSA-AES128-GCM-SHA256:" \
+	"ECDHE-ECDSA-AES256-GCM-SHA384:" \
+	"ECDHE-RSA-AES256-GCM-SHA384:" \
+	"ECDHE-ECDSA-CHACHA20-POLY1305:" \
+	"ECDHE-RSA-CHACHA20-POLY1305"
+
+/* Print all queued OpenSSL errors */
+static void tls_print_errors(void * id) {
+	unsigned long err;
+	char errbuf[256];
+	while ((err = ERR_get_error()) != 0) {
+		ERR_error_string_n(err, errbuf, sizeof (errbuf));
+		tdprint(id, ERR, "TLS: %s\n", errbuf);
+	}
+}
+
+/*
+ * Get TLS context of endpoint cfg, create it on the first use.
+ *
+ * Returns the context or NULL on error.
+ */
+static SSL_CTX * tls_get_ctx(struct endpt_cfg * cfg) {
+	if (cfg->tls_ctx != NULL)
+		return (cfg->tls_ctx);
+
+	SSL_CTX * ctx;
+	if (cfg->dir == DIR_INPUT)
+		ctx = SSL_CTX_new(TLS_server_method());
+	else
+		ctx = SSL_CTX_new(TLS_client_method());
+	if (ctx == NULL) {
+		tls_print_errors(cfg);
+		return (NULL);
+	}
+	// Record encryption is done by the kernel after the handshake
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_TICKET);
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	// OpenSSL offloads only TLS 1.2 receiving to the kernel
+	if (cfg->dir == DIR_INPUT)
+		SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+	if (SSL_CTX_set_cipher_list(ctx, TLS_KTLS_CIPHERS) != 1)
+		goto ctx_err;
+
+	if (cfg->tls_cert != NULL) {
+		if (SSL_CTX_use_certificate_chain_file(ctx,
+			cfg->tls_cert) != 1) {
+			goto ctx_err;
+		}
+		if (SSL_CTX_use_PrivateKey_file(ctx,
+			cfg->tls_key != NULL ? cfg->tls_key : cfg->tls_cert,
+			SSL_FILETYPE_PEM) != 1) {
+			goto ctx_err;
+		}
+	}
+	if (cfg->tls_ca != NULL) {
+		if (SSL_CTX_load_verify_locations(ctx, cfg->tls_ca, NULL) != 1)
+			goto ctx_err;
+	} else if (cfg->dir == DIR_OUTPUT) {
+		if (SSL_CTX_set_default_verify_paths(ctx) != 1)
+			goto ctx_err;
+	}
+	if (cfg->dir == DIR_OUTPUT && cfg->tls_verify) {
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	} else if (cfg->dir == DIR_INPUT && cfg->tls_ca != NULL) {
+		// Client certificate is required only with CAFile
+		SSL_CTX_set_verify(ctx,
+			SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+			NULL);
+	}
+	cfg->tls_ctx = ctx;
+	return (ctx);
+
+ctx_err:
+	tls_print_errors(cfg);
+	SSL_CTX_free(ctx);
+	return (NULL);
+}
+
+/* Set send and receive timeout of socket fd to sec seconds (0 - none) */
+static void tls_set_timeout(int fd, int sec) {
+	struct timeval tv;
+	tv.tv_sec = sec;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+}
+
+/*
+ * Make TLS handshake on connected TCP socket fd of endpoint cfg and hand
+ * record encryption over to the kernel (TCP_ULP "tls"). After success, fd is
+ * used by plain read/write as before, the kernel encrypts written data and
+ * decrypts read data.
+ *
+ * Returns 0 on success, -1 if the handshake fails or kernel TLS is not
+ * available.
+ */
+int tls_start(struct endpt_cfg * cfg, int fd) {
+	SSL_CTX * ctx;
+	ctx = tls_get_ctx(cfg);
+	if (ctx == NULL)
+		return (-1);
+
+	SSL * ssl;
+	ssl = SSL_new(ctx);
+	if (ssl == NULL || SSL_set_fd(ssl, fd) != 1) {
+		tls_print_errors(cfg);
+		SSL_free(ssl);
+		return (-1);
+	}
+	if (cfg->dir == DIR_OUTPUT && cfg->tls_verify) {
+		struct in6_addr addr;
+		if (inet_pton(AF_INET, cfg->name, &addr) == 1 ||
+			inet_pton(AF_INET6, cfg->name, &addr) == 1) {
+			X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl),
+				cfg->name);
+		} else  {
+			SSL_set_tlsext_host_name(ssl, cfg->name);
+			SSL_set1_host(ssl, cfg->name);
+		}
+	}
+
+	int res;
+	tls_set_timeout(fd, TLS_HANDSHAKE_TIMEOUT);
+	if (cfg->dir == DIR_INPUT)
+		res = SSL_accept(ssl);
+	else
+		res = SSL_connect(ssl);
+	tls_set_timeout(fd, 0);
+	if (res != 1) {
+		tdprint(cfg, ERR, "TLS handshake failed\n");
+		tls_print_errors(cfg);
+		SSL_free(ssl);
+		return (-1);
+	}
+
+	int offloaded;
+	if (cfg->dir == DIR_INPUT)
+		offloaded = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+	else
+		offloaded = BIO_get_ktls_send(SSL_get_wbio(ssl));
+	if (!offloaded) {
+		tdprint(cfg, ERR, "Kernel TLS is not available for %s %s "
+			"(is the tls kernel module loaded?)\n",
+			SSL_get_version(ssl),
+			SSL_get_cipher_name(ssl));
+		SSL_free(ssl);
+		return (-1);
+	}
+	tdprint(cfg, INFO, "TLS established (%s %s), encryption done by "
+		"kernel\n",
+		SSL_get_version(ssl),
+		SSL_get_cipher_name(ssl));
+	// The socket BIO does not close fd, the kernel keeps the TLS state
+	SSL_free(ssl);
+	return (0);
+}
+
+#else
+
+/* Stub without TLS support, endpoints with TLS are refused by config check */
+int tls_start(struct endpt_cfg * cfg, int fd) {
+	tdprint(cfg, ERR, "Netstream was built without TLS support\n");
+	return (-1);
+}
+
+#endif
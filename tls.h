@@ -0,0 +1,12 @@
+#ifndef TLS_H
+#define	TLS_H
+
+#include "netstream.h"
+
+// Timeout of TLS handshake in seconds
+#define	TLS_HANDSHAKE_TIMEOUT 10
+
+int tls_supported(void);
+int tls_start(struct endpt_cfg * cfg, int fd);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define	TRACE_H
+
+/*
+ * Static tracepoints (USDT) of provider `netstream` on the hot paths, built
+ * only with `make SDT=1` (needs sys/sdt.h of systemtap). A probe is a single
+ * nop until a tracer such as bpftrace attaches to it, arguments are only
+ * read by the tracer. Without SDT the probes are not compiled at all.
+ *
+ * Probes and their arguments:
+ *   chunk_read	(input name, bytes)
+ *   chunk_insert	(buffer, bytes, chunks waiting after the insert)
+ *   drop		(buffer, chunks, reason TRACE_DROP_*)
+ *   wake		(buffer, chunks waiting) - a waiting output is woken
+ *   write_start	(buffer, output name, bytes)
+ *   write_done	(buffer, output name, bytes)
+ *   reconnect	(endpoint name, failures) - an endpoint retries
+ *
+ * Buffer is the address of the buffer of an output, so events of buffers can
+ * be matched with writes of outputs. Scripts are in tools/.
+ */
+
+// Reasons of drops
+#define	TRACE_DROP_FULL 0 	// Buffer is full, the oldest chunk is dropped
+#define	TRACE_DROP_HELD 1 	// Buffer is full of held chunks, new is dropped
+#define	TRACE_DROP_SPILL 2 	// Spill file is full
+#define	TRACE_DROP_SHED 3 	// Low priority output sheds old chunks
+#define	TRACE_DROP_SLOW 4 	// Receiver does not take data (MaxUnsent)
+
+#ifdef SDT
+#include <sys/sdt.h>
+#define	TRACE2(name, a, b) DTRACE_PROBE2(netstream, name, a, b)
+#define	TRACE3(name, a, b, c) DTRACE_PROBE3(netstream, name, a, b, c)
+#else
+#define	TRACE2(name, a, b) do { } while (0)
+#define	TRACE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,539 @@
+#define	_GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "endpts.h"
+#include "upgrade.h"
+
+static int listen_fd = -1; 	// Socket for handover requests
+static int upgrade_fd = -1; 	// Connection to the new process
+static int pending; 		// Was handover requested?
+
+/* Fill addr with address of Unix domain socket path, returns -1 if too long */
+static int upgrade_addr(struct sockaddr_un * addr, char * path) {
+	memset(addr, 0, sizeof (struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof (addr->sun_path)) {
+		dprint(ERR, "Too long socket path %s\n", path);
+		return (-1);
+	}
+	strcpy(addr->sun_path, path);
+	return (0);
+}
+
+/* Read exactly len bytes from fd to data, returns 0 on success, -1 otherwise */
+static int read_full(int fd, void * data, size_t len) {
+	while (len > 0) {
+		ssize_t res;
+		res = read(fd, data, len);
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			return (-1);
+		data = (char *)data+res;
+		len -= res;
+	}
+	return (0);
+}
+
+/*
+ * Send record rec with rec->len bytes from data and nfds descriptors from fds
+ * attached over fd.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int send_rec(int fd, struct upg_rec * rec, char * data, int * fds,
+	int nfds) {
+
+	char control[CMSG_SPACE(2*sizeof (int))];
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct iovec * cur;
+	int iovcnt;
+	memset(&msg, 0, sizeof (msg));
+	iov[0].iov_base = rec;
+	iov[0].iov_len = sizeof (struct upg_rec);
+	iov[1].iov_base = data;
+	iov[1].iov_len = rec->len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = rec->len > 0 ? 2 : 1;
+	if (nfds > 0) {
+		struct cmsghdr * cmsg;
+		memset(control, 0, sizeof (control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(nfds*sizeof (int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds*sizeof (int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds*sizeof (int));
+	}
+	// Descriptors go with the first byte, the rest may need more writes
+	cur = iov;
+	iovcnt = msg.msg_iovlen;
+	while (iovcnt > 0) {
+		ssize_t res;
+		msg.msg_iov = cur;
+		msg.msg_iovlen = iovcnt;
+		res = sendmsg(fd, &msg, 0);
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res == -1)
+			return (-1);
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		while (iovcnt > 0 && (size_t)res >= cur->iov_len) {
+			res -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			cur->iov_base = (char *)cur->iov_base+res;
+			cur->iov_len -= res;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Receive record rec over fd, attached descriptors are stored to fds (-1 for
+ * missing ones, the listening socket first) and following data to *data
+ * (allocated, NULL if there are none).
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int recv_rec(int fd, struct upg_rec * rec, int * fds, char ** data) {
+	char control[CMSG_SPACE(2*sizeof (int))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr * cmsg;
+	int nfds;
+	fds[0] = -1;
+	fds[1] = -1;
+	*data = NULL;
+	memset(&msg, 0, sizeof (msg));
+	iov.iov_base = rec;
+	iov.iov_len = sizeof (struct upg_rec);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof (control);
+	if (recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) !=
+		sizeof (struct upg_rec))
+		return (-1);
+	nfds = 0;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		nfds = (cmsg->cmsg_len-CMSG_LEN(0))/sizeof (int);
+		if (nfds > 2)
+			nfds = 2;
+		memcpy(fds, CMSG_DATA(cmsg), nfds*sizeof (int));
+	}
+	// Only the connection is attached
+	if (rec->fds == UPG_CONN && nfds == 1) {
+		fds[1] = fds[0];
+		fds[0] = -1;
+	}
+	if (rec->len > 0) {
+		*data = malloc(rec->len);
+		if (*data == NULL || read_full(fd, *data, rec->len) == -1) {
+			free(*data);
+			*data = NULL;
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/* Close descriptors in fds, which can't be used */
+static void close_fds(int * fds) {
+	if (fds[0] != -1)
+		close(fds[0]);
+	if (fds[1] != -1)
+		close(fds[1]);
+}
+
+/*
+ * Use record rec with descriptors fds and data received from the old process
+ * in config cfg. Descriptors and data which are not used are freed.
+ */
+static void upgrade_apply(struct io_cfg * cfg, struct upg_rec * rec,
+	int * fds, char * data) {
+
+	struct endpt_cfg * ep;
+	ep = NULL;
+	if (rec->kind == UPG_INPUT && rec->index < (uint32_t)cfg->n_inputs)
+		ep = &cfg->input[rec->index];
+	else if (rec->kind != UPG_INPUT && rec->index < (uint32_t)cfg->n_outs)
+		ep = &cfg->outs[rec->index];
+	if (rec->kind != UPG_SEQ && (ep == NULL ||
+		(rec->kind != UPG_CHUNK && (ep->type != rec->type ||
+		ep->protocol != rec->protocol)))) {
+
+		dprint(WARN, "Endpoint %u differs from the old one, its state "
+			"is not taken over\n", rec->index);
+		close_fds(fds);
+		free(data);
+		return;
+	}
+	switch (rec->kind) {
+		case UPG_INPUT:
+			ep->ho_listenfd = fds[0];
+			ep->ho_fd = fds[1];
+			ep->ho_carry = data;
+			ep->ho_ncarry = rec->len;
+			return;
+		case UPG_OUTPUT:
+			if (fds[0] != -1)
+				close(fds[0]);
+			ep->ho_fd = fds[1];
+			if (rec->len <= sizeof (ep->ho_addr)) {
+				memcpy(&ep->ho_addr, data, rec->len);
+				ep->ho_addrlen = rec->len;
+			}
+			break;
+		case UPG_CHUNK:
+			close_fds(fds);
+			if (rec->len <= ep->buf->it_size) {
+				struct chunk_meta meta;
+				meta.seq = rec->seq;
+				meta.stamp = rec->stamp;
+				buffer_insert_meta(ep->buf, data, rec->len,
+					&meta);
+			}
+			break;
+		case UPG_SEQ:
+			close_fds(fds);
+			buffer_set_last_seq(rec->seq);
+			break;
+	}
+	free(data);
+}
+
+/*
+ * Take over the stream from a process running with handover socket path, if
+ * there is one. Sockets, unsent chunks and the sequence number received from
+ * it are stored in cfg, buffers of outputs must be already set up.
+ *
+ * Returns 0 on success (also if no process runs), -1 on error.
+ */
+int upgrade_receive(struct io_cfg * cfg, char * path) {
+	struct sockaddr_un addr;
+	int fd;
+	if (upgrade_addr(&addr, path) == -1)
+		return (-1);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		warn("Could not create socket %s", path);
+		return (-1);
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof (addr)) == -1) {
+		dprint(INFO, "No process to take over from at %s\n", path);
+		close(fd);
+		return (0);
+	}
+
+	struct upg_hello hello;
+	memcpy(hello.magic, UPG_MAGIC, 4);
+	hello.n_inputs = cfg->n_inputs;
+	hello.n_outs = cfg->n_outs;
+	if (write(fd, &hello, sizeof (hello)) != sizeof (hello)) {
+		warn("Could not send handover request");
+		close(fd);
+		return (-1);
+	}
+	dprint(NOTICE, "Taking over from the running process\n");
+	while (1) {
+		struct upg_rec rec;
+		int fds[2];
+		char * data;
+		if (recv_rec(fd, &rec, fds, &data) == -1) {
+			dprint(ERR, "Handover failed, the running process "
+				"refused it or ended\n");
+			close(fd);
+			return (-1);
+		}
+		if (rec.kind == UPG_END) {
+			close_fds(fds);
+			free(data);
+			break;
+		}
+		upgrade_apply(cfg, &rec, fds, data);
+	}
+	close(fd);
+	dprint(NOTICE, "Stream taken over, continuing after chunk %llu\n",
+		(unsigned long long)buffer_last_seq());
+	return (0);
+}
+
+/* Thread waiting for a new process, which takes the stream over */
+static void * upgrade_thread(void * args) {
+	struct io_cfg * cfg;
+	cfg = (struct io_cfg *)args;
+	sigset_t sigset;
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+	while (1) {
+		struct upg_hello hello;
+		int fd;
+		fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			warn("Could not accept handover request");
+			return (NULL);
+		}
+		if (read_full(fd, &hello, sizeof (hello)) == -1 ||
+			memcmp(hello.magic, UPG_MAGIC, 4) != 0 ||
+			hello.n_inputs != (uint32_t)cfg->n_inputs ||
+			hello.n_outs != (uint32_t)cfg->n_outs) {
+
+			dprint(WARN, "Refusing handover to a process with "
+				"different endpoints\n");
+			close(fd);
+			continue;
+		}
+		// The new process binds the path itself
+		close(listen_fd);
+		upgrade_fd = fd;
+		__atomic_store_n(&pending, 1, __ATOMIC_RELEASE);
+		dprint(NOTICE, "Handing the stream over to a new process\n");
+		int8_t signum;
+		signum = SIG_HANDOVER;
+		if (write(signal_fds[1], &signum, 1)) {
+		}
+		return (NULL);
+	}
+}
+
+/*
+ * Listen for handover requests of a new process on Unix domain socket path,
+ * a stale socket is removed. Endpoints of config cfg are compared with the
+ * endpoints of the new process.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int upgrade_listen(struct io_cfg * cfg, char * path) {
+	struct sockaddr_un addr;
+	if (upgrade_addr(&addr, path) == -1)
+		return (-1);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1) {
+		warn("Could not create socket %s", path);
+		return (-1);
+	}
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof (addr)) == -1 ||
+		listen(listen_fd, 1) == -1) {
+
+		warn("Could not bind to %s", path);
+		close(listen_fd);
+		return (-1);
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, upgrade_thread, (void *)cfg)) {
+		dprint(ERR, "Failed to start thread\n");
+		close(listen_fd);
+		return (-1);
+	}
+	pthread_detach(thread);
+	return (0);
+}
+
+/* Returns 1 if the stream is being handed over to a new process */
+int upgrade_pending(void) {
+	return (__atomic_load_n(&pending, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Send state of all endpoints of cfg to the new process, all endpoint threads
+ * have ended. Sockets kept by endpoints, chunks not sent by outputs and the
+ * sequence number are sent.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int upgrade_send(struct io_cfg * cfg) {
+	struct upg_rec rec;
+	int fds[2];
+	int nfds;
+	int res;
+	res = 0;
+	for (int i = 0; i < cfg->n_inputs && res == 0; i++) {
+		struct endpt_cfg * in;
+		in = &cfg->input[i];
+		if (in->ho_listenfd == -1 && in->ho_fd == -1)
+			continue;
+		memset(&rec, 0, sizeof (rec));
+		rec.kind = UPG_INPUT;
+		rec.index = i;
+		rec.type = in->type;
+		rec.protocol = in->protocol;
+		rec.len = in->ho_fd != -1 ? in->ho_ncarry : 0;
+		nfds = 0;
+		if (in->ho_listenfd != -1) {
+			rec.fds |= UPG_LISTEN;
+			fds[nfds++] = in->ho_listenfd;
+		}
+		if (in->ho_fd != -1) {
+			rec.fds |= UPG_CONN;
+			fds[nfds++] = in->ho_fd;
+		}
+		res = send_rec(upgrade_fd, &rec, in->ho_carry, fds, nfds);
+	}
+	for (int i = 0; i < cfg->n_outs && res == 0; i++) {
+		struct endpt_cfg * out;
+		out = &cfg->outs[i];
+		if (out->ho_fd == -1)
+			continue;
+		memset(&rec, 0, sizeof (rec));
+		rec.kind = UPG_OUTPUT;
+		rec.index = i;
+		rec.type = out->type;
+		rec.protocol = out->protocol;
+		rec.fds = UPG_CONN;
+		rec.len = out->ho_addrlen;
+		res = send_rec(upgrade_fd, &rec, (char *)&out->ho_addr,
+			&out->ho_fd, 1);
+	}
+	// Outputs which were not connected left chunks in their buffers
+	for (int i = 0; i < cfg->n_outs && res == 0; i++) {
+		struct buffer * buf;
+		buf = cfg->outs[i].buf;
+		while (res == 0) {
+			struct buffer_stats st;
+			ssize_t len;
+			buffer_get_stats(buf, &st);
+			if (st.items == 0 && st.spill_items == 0)
+				break;
+			len = buffer_after_delete(buf);
+			if (len < 0)
+				continue;
+			struct chunk_meta meta;
+			buffer_cons_meta(buf, &meta);
+			memset(&rec, 0, sizeof (rec));
+			rec.kind = UPG_CHUNK;
+			rec.index = i;
+			rec.len = len;
+			rec.seq = meta.seq;
+			rec.stamp = meta.stamp;
+			res = send_rec(upgrade_fd, &rec,
+				buffer_cons_data_pointer(buf), NULL, 0);
+		}
+	}
+	memset(&rec, 0, sizeof (rec));
+	rec.kind = UPG_SEQ;
+	rec.seq = buffer_last_seq();
+	if (res == 0)
+		res = send_rec(upgrade_fd, &rec, NULL, NULL, 0);
+	rec.kind = UPG_END;
+	if (res == 0)
+		res = send_rec(upgrade_fd, &rec, NULL, NULL, 0);
+	if (res == -1)
+		warn("Error in handover");
+	close(upgrade_fd);
+	return (res);
+}
+
+/*
+ * Match socket fd inherited by socket activation with an input of cfg by its
+ * type and port or path.
+ *
+ * Returns 0 if an input takes the socket, -1 otherwise.
+ */
+static int inherit_fd(struct io_cfg * cfg, int fd) {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int type;
+	socklen_t typelen;
+	addrlen = sizeof (addr);
+	typelen = sizeof (type);
+	if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) == -1 ||
+		getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typelen) == -1)
+		return (-1);
+	for (int i = 0; i < cfg->n_inputs; i++) {
+		struct endpt_cfg * in;
+		int stream;
+		int match;
+		in = &cfg->input[i];
+		if (in->ho_listenfd != -1 || in->ho_fd != -1)
+			continue;
+		match = 0;
+		stream = 1;
+		if (in->type == T_SOCKET && (addr.ss_family == AF_INET ||
+			addr.ss_family == AF_INET6)) {
+
+			char port[8];
+			in_port_t nport;
+			struct sockaddr_in * sin;
+			struct sockaddr_in6 * sin6;
+			sin = (struct sockaddr_in *)&addr;
+			sin6 = (struct sockaddr_in6 *)&addr;
+			stream = in->protocol == IPPROTO_TCP;
+			if (addr.ss_family == AF_INET)
+				nport = sin->sin_port;
+			else
+				nport = sin6->sin6_port;
+			snprintf(port, sizeof (port), "%u", ntohs(nport));
+			match = type == (stream ? SOCK_STREAM : SOCK_DGRAM) &&
+				strcmp(port, in->port) == 0;
+		} else if (in->type == T_UNIX && addr.ss_family == AF_UNIX) {
+			stream = in->socktype != SOCK_DGRAM;
+			match = type == in->socktype && strcmp(in->name,
+				((struct sockaddr_un *)&addr)->sun_path) == 0;
+		}
+		if (!match)
+			continue;
+		dprint(INFO, "Input %d uses inherited socket %d\n", i, fd);
+		if (stream)
+			in->ho_listenfd = fd;
+		else
+			in->ho_fd = fd;
+		return (0);
+	}
+	return (-1);
+}
+
+/*
+ * Use sockets passed by socket activation (LISTEN_FDS and LISTEN_PID in the
+ * environment) for inputs of cfg which did not take over sockets from the
+ * previous process. Sockets are matched with inputs by port or path.
+ */
+void upgrade_inherit(struct io_cfg * cfg) {
+	char * pid;
+	char * nfds;
+	int n;
+	pid = getenv("LISTEN_PID");
+	nfds = getenv("LISTEN_FDS");
+	if (pid == NULL || nfds == NULL || atol(pid) != (long)getpid())
+		return;
+	n = atoi(nfds);
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	// Passed descriptors start after stderr
+	for (int fd = 3; fd < 3+n; fd++) {
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (inherit_fd(cfg, fd) == -1) {
+			dprint(WARN, "Inherited socket %d does not match any "
+				"input\n", fd);
+			close(fd);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef UPGRADE_H
+#define	UPGRADE_H
+
+#include <stdint.h>
+#include "netstream.h"
+
+/*
+ * Handover of a running stream to a new process (e.g. a new build). The
+ * running process listens on a Unix domain socket given by -u. A new process
+ * started with the same -u connects to it and sends a hello. The old process
+ * stops its inputs, which keep their sockets, lets its outputs send all
+ * buffered data and sends records to the new process, descriptors of sockets
+ * are attached to them (SCM_RIGHTS). Then it ends and the new process
+ * continues with the same sockets and the same sequence numbers.
+ */
+#define	UPG_MAGIC "NSU1"
+
+// Hello of a new process, the configs must have the same endpoints
+struct upg_hello {
+	char magic[4]; 		// UPG_MAGIC
+	uint32_t n_inputs; 	// Number of inputs
+	uint32_t n_outs; 	// Number of outputs
+};
+
+// Kinds of records
+#define	UPG_INPUT 1 		// Sockets and unparsed data of input
+#define	UPG_OUTPUT 2 		// Socket and destination of output
+#define	UPG_CHUNK 3 		// Chunk not sent by output
+#define	UPG_SEQ 4 		// Sequence number of the last chunk
+#define	UPG_END 5 		// End of handover
+
+// Attached descriptors
+#define	UPG_LISTEN 1 		// Listening socket
+#define	UPG_CONN 2 		// Connection, other socket or file
+
+// Record sent by the old process, followed by len bytes of data
+struct upg_rec {
+	uint32_t kind; 		// Kind of record
+	uint32_t index; 	// Input or output
+	uint32_t fds; 		// Attached descriptors
+	uint32_t len; 		// Length of data
+	int32_t type; 		// Type of endpoint
+	int32_t protocol; 	// Protocol of endpoint
+	uint64_t seq; 		// Sequence number
+	uint64_t stamp; 	// Time of chunk
+};
+
+int upgrade_receive(struct io_cfg * cfg, char * path);
+int upgrade_listen(struct io_cfg * cfg, char * path);
+int upgrade_pending(void);
+int upgrade_send(struct io_cfg * cfg);
+void upgrade_inherit(struct io_cfg * cfg);
+
+#endif
@@ -0,0 +1,178 @@
+#define	_GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "netstream.h"
+#include "buffer.h"
+#include "zerocopy.h"
+
+#ifndef SO_ZEROCOPY
+#define	SO_ZEROCOPY 60
+#endif
+
+/*
+ * Enable zero copy on socket fd of output cfg and forget chunks of the
+ * previous connection. If the kernel does not support it, data are copied.
+ */
+void zc_start(struct zerocopy * zc, struct endpt_cfg * cfg, int fd) {
+	int optval;
+	memset(zc, 0, sizeof (struct zerocopy));
+	zc->cfg = cfg;
+	optval = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval,
+		sizeof (optval)) == -1) {
+
+		tdprint(cfg, WARN, "Zero copy is not supported, data are "
+			"copied\n");
+		return;
+	}
+	zc->on = 1;
+}
+
+/*
+ * Send len bytes from data preceded by frame header hdr (NULL - none) to fd
+ * with MSG_ZEROCOPY. The memory of data must not change until the chunk is
+ * completed, which is reported by zc_reap. The header is kept in the state.
+ * If the kernel can't pin more memory, the rest of the chunk is copied.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int zc_write(struct zerocopy * zc, int fd, char * hdr, char * data,
+	size_t len) {
+
+	struct zc_chunk * ch;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ch = &zc->chunks[(zc->head+zc->count)%ZC_MAX_HELD];
+	zc->count++;
+	ch->used = 0;
+	memset(&msg, 0, sizeof (msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 0;
+	if (hdr != NULL) {
+		memcpy(ch->hdr, hdr, FRAME_HEADER_SIZE);
+		iov[msg.msg_iovlen].iov_base = ch->hdr;
+		iov[msg.msg_iovlen++].iov_len = FRAME_HEADER_SIZE;
+	}
+	iov[msg.msg_iovlen].iov_base = data;
+	iov[msg.msg_iovlen++].iov_len = len;
+	while (msg.msg_iovlen > 0) {
+		ssize_t res;
+		res = sendmsg(fd, &msg, MSG_ZEROCOPY);
+		if (res == -1 && errno == ENOBUFS) {
+			res = sendmsg(fd, &msg, 0);
+		} else if (res >= 0) {
+			ch->used = 1;
+			ch->last_id = zc->next_id++;
+		}
+		if (res == -1)
+			return (-1);
+		while (msg.msg_iovlen > 0 &&
+			(size_t)res >= msg.msg_iov->iov_len) {
+
+			res -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base+res;
+			msg.msg_iov->iov_len -= res;
+		}
+	}
+	zc->cfg->zc_sent++;
+	return (0);
+}
+
+/* Read all completion notifications from the error queue of socket fd */
+static void zc_read_errqueue(struct zerocopy * zc, int fd) {
+	while (1) {
+		char control[128];
+		struct msghdr msg;
+		struct cmsghdr * cmsg;
+		memset(&msg, 0, sizeof (msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+			struct sock_extended_err * serr;
+			if (!(cmsg->cmsg_level == SOL_IP &&
+				cmsg->cmsg_type == IP_RECVERR) &&
+				!(cmsg->cmsg_level == SOL_IPV6 &&
+				cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_errno != 0 ||
+				serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				zc->cfg->zc_copied += serr->ee_data-
+					serr->ee_info+1;
+				if (!zc->warned) {
+					tdprint(zc->cfg, NOTICE, "Kernel copies "
+						"zero copy data, zero copy "
+						"does not pay off\n");
+					zc->warned = 1;
+				}
+			}
+			zc->done = serr->ee_data;
+			zc->any_done = 1;
+		}
+	}
+}
+
+/*
+ * Collect completions of zero copy sends on socket fd. When ZC_MAX_HELD
+ * chunks or a half of the ring of the buffer (a ring sized by time may be
+ * smaller) are waiting, it blocks until some complete.
+ *
+ * Returns the number of completed chunks (their buffer items can be
+ * released) or -1 if the connection failed.
+ */
+int zc_reap(struct zerocopy * zc, int fd) {
+	size_t max_held;
+	int ndone;
+	max_held = zc->cfg->buf->nitems/2;
+	if (max_held > ZC_MAX_HELD)
+		max_held = ZC_MAX_HELD;
+	ndone = 0;
+	while (1) {
+		zc_read_errqueue(zc, fd);
+		while (zc->count > 0) {
+			struct zc_chunk * ch;
+			ch = &zc->chunks[zc->head];
+			if (ch->used && (!zc->any_done ||
+				(int32_t)(ch->last_id-zc->done) > 0))
+				break;
+			zc->head = (zc->head+1)%ZC_MAX_HELD;
+			zc->count--;
+			ndone++;
+		}
+		if ((size_t)zc->count < max_held)
+			return (ndone);
+
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = 0;
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+			return (-1);
+		if (pfd.revents & (POLLHUP | POLLNVAL))
+			return (-1);
+		int err;
+		socklen_t errlen;
+		errlen = sizeof (err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 &&
+			err != 0) {
+
+			errno = err;
+			return (-1);
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef ZEROCOPY_H
+#define	ZEROCOPY_H
+
+#include <stdint.h>
+#include "netstream.h"
+#include "frame.h"
+
+// Chunks sent with MSG_ZEROCOPY and not yet completed, at most a half of the
+// ring, the rest of the buffer stays free for the input
+#define	ZC_MAX_HELD (WRITE_BUFFER_BLOCK_COUNT/2)
+
+// Chunk sent with MSG_ZEROCOPY, its buffer item is held until completion
+struct zc_chunk {
+	int used; 		// Was any part sent with zero copy?
+	uint32_t last_id; 	// Id of the last send of the chunk
+	char hdr[FRAME_HEADER_SIZE]; // Frame header sent with the chunk
+};
+
+// Zero copy state of a TCP output
+struct zerocopy {
+	struct endpt_cfg * cfg; // Output
+	int on; 		// Is zero copy enabled on the socket?
+	struct zc_chunk chunks[ZC_MAX_HELD]; // Sent chunks, oldest first
+	int head; 		// Index of the oldest chunk
+	int count; 		// Number of chunks waiting for completion
+	uint32_t next_id; 	// Id of the next zero copy send
+	uint32_t done; 		// Sends up to this id are completed
+	int any_done; 		// Was any send completed?
+	int warned; 		// Was copying by the kernel reported?
+};
+
+void zc_start(struct zerocopy * zc, struct endpt_cfg * cfg, int fd);
+int zc_write(struct zerocopy * zc, int fd, char * hdr, char * data,
+	size_t len);
+int zc_reap(struct zerocopy * zc, int fd);
+
+#endif